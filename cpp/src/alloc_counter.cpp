@@ -0,0 +1,51 @@
+#include "alloc_counter.hpp"
+
+#ifdef CANDOR_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+thread_local uint64_t t_allocations = 0;
+
+void* counted_alloc(size_t size) {
+    t_allocations++;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* counted_aligned_alloc(size_t size, std::align_val_t align) {
+    t_allocations++;
+    size_t alignment = static_cast<size_t>(align);
+    size = (size + alignment - 1) / alignment * alignment;
+    if (void* p = std::aligned_alloc(alignment, size == 0 ? alignment : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+} // namespace
+
+uint64_t thread_allocation_count() { return t_allocations; }
+
+// Replacements for the global allocation functions. The nothrow forms fall through to
+// these in the standard library.
+void* operator new(size_t size) { return counted_alloc(size); }
+void* operator new[](size_t size) { return counted_alloc(size); }
+void* operator new(size_t size, std::align_val_t align) { return counted_aligned_alloc(size, align); }
+void* operator new[](size_t size, std::align_val_t align) { return counted_aligned_alloc(size, align); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+#else
+
+uint64_t thread_allocation_count() { return 0; }
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Number of operator new calls made by the calling thread so far.
+ *
+ * Test hook for checking that a hot loop does not allocate: compare the value before and
+ * after an iteration. Only counts when built with CANDOR_COUNT_ALLOCATIONS (see
+ * alloc_counter.cpp); otherwise always returns 0. Allocations made with malloc directly,
+ * e.g. inside libzmq or the K4A SDK, are not seen.
+ */
+uint64_t thread_allocation_count();
+
+/**
+ * True if this build counts allocations.
+ */
+constexpr bool allocation_counting_enabled() {
+#ifdef CANDOR_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
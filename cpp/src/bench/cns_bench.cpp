@@ -0,0 +1,242 @@
+/**
+ * CNS throughput benchmark
+ *
+ * Drives a running CNS from several client threads, each with its own REQ socket the way
+ * nodes talk to it, and reports requests per second and round trip latency. A share of the
+ * requests are registrations so the registry's write path is exercised alongside lookups.
+ * Each encoding the CNS accepts (see cns_protocol.hpp) can be measured in turn, together with
+ * the CPU time spent per request by the benchmark's clients and, given its pid, by the CNS.
+ * See docs/name_server.md for the throughput the CNS is expected to sustain.
+ */
+
+#include <zmq.hpp>
+#include <argparse/argparse.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "cns_protocol.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+static string bench_topic(int i) {
+    return "/bench/" + to_string(i) + "/data";
+}
+
+static json register_request(int i) {
+    return {
+        {"self", "/bench/client"},
+        {"action", "register"},
+        {"topic", bench_topic(i)},
+        {"ip", "127.0.0.1"},
+        {"port", 6000 + i}
+    };
+}
+
+static json lookup_request(int i) {
+    return {
+        {"self", "/bench/client"},
+        {"action", "lookup"},
+        {"topic", bench_topic(i)}
+    };
+}
+
+static bool round_trip(zmq::socket_t& socket, const string& request, zmq::message_t& reply) {
+    socket.send(zmq::buffer(request), zmq::send_flags::none);
+    return socket.recv(reply, zmq::recv_flags::none).has_value();
+}
+
+/**
+ * CPU time used so far by this process, all threads, in seconds.
+ */
+static double process_cpu_seconds() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * CPU time used so far by another process, in seconds, or a negative value if it cannot be read.
+ */
+static double process_cpu_seconds(int pid) {
+    ifstream stat("/proc/" + to_string(pid) + "/stat");
+    string line;
+    if (!getline(stat, line)) {
+        return -1;
+    }
+    // Fields after the parenthesised command name; utime and stime are fields 14 and 15
+    size_t end = line.rfind(')');
+    if (end == string::npos) {
+        return -1;
+    }
+    istringstream fields(line.substr(end + 2));
+    string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++) {
+        if (i == 14) utime = stoull(field);
+        if (i == 15) stime = stoull(field);
+    }
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void client_loop(zmq::context_t* context, string address, int topics, int write_percent,
+                        CnsEncoding encoding, chrono::steady_clock::time_point deadline, int seed,
+                        vector<double>* samples, atomic<uint64_t>* failures) {
+    zmq::socket_t socket(*context, zmq::socket_type::req);
+    socket.set(zmq::sockopt::linger, 0);
+    socket.set(zmq::sockopt::rcvtimeo, 1000);
+    socket.connect(address);
+
+    mt19937 rng(seed);
+    uniform_int_distribution<int> topic_dist(0, topics - 1);
+    uniform_int_distribution<int> percent_dist(0, 99);
+    while (chrono::steady_clock::now() < deadline) {
+        int topic = topic_dist(rng);
+        auto start = chrono::steady_clock::now();
+        json request = percent_dist(rng) < write_percent ? register_request(topic) : lookup_request(topic);
+        zmq::message_t reply;
+        if (!round_trip(socket, encode_cns_message(request, encoding), reply)) {
+            // A REQ socket that missed its reply is stuck, start over with a fresh one
+            failures->fetch_add(1);
+            socket = zmq::socket_t(*context, zmq::socket_type::req);
+            socket.set(zmq::sockopt::linger, 0);
+            socket.set(zmq::sockopt::rcvtimeo, 1000);
+            socket.connect(address);
+            continue;
+        }
+        // Decode like a node would, so the client CPU figure covers both directions
+        decode_cns_message(reply.data(), reply.size());
+        samples->push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("cns_bench");
+    program.add_argument("-a", "--address")
+        .help("CNS to benchmark")
+        .default_value(string("tcp://127.0.0.1:5555"));
+    program.add_argument("-c", "--clients")
+        .help("Concurrent client threads")
+        .default_value(8)
+        .scan<'i', int>();
+    program.add_argument("-t", "--topics")
+        .help("Distinct topics registered and looked up")
+        .default_value(200)
+        .scan<'i', int>();
+    program.add_argument("-w", "--write-percent")
+        .help("Share of requests that are registrations")
+        .default_value(5)
+        .scan<'i', int>();
+    program.add_argument("-d", "--duration")
+        .help("Seconds to run each encoding")
+        .default_value(5)
+        .scan<'i', int>();
+    program.add_argument("-e", "--encoding")
+        .help("Request encoding: json, msgpack, cbor or all")
+        .default_value(string("json"));
+    program.add_argument("-p", "--server-pid")
+        .help("pid of the CNS, to also report its CPU time per request")
+        .default_value(0)
+        .scan<'i', int>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    string address = program.get<string>("address");
+    int clients = program.get<int>("clients");
+    int topics = max(1, program.get<int>("topics"));
+    int write_percent = program.get<int>("write-percent");
+    int duration = program.get<int>("duration");
+    int server_pid = program.get<int>("server-pid");
+
+    vector<CnsEncoding> encodings;
+    string encoding_name = program.get<string>("encoding");
+    try {
+        if (encoding_name == "all") {
+            encodings = {CnsEncoding::JSON, CnsEncoding::MSGPACK, CnsEncoding::CBOR};
+        } else {
+            encodings = {parse_cns_encoding(encoding_name)};
+        }
+    } catch (const std::invalid_argument& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    zmq::context_t context(1);
+
+    // Make every topic resolvable before measuring
+    {
+        zmq::socket_t socket(context, zmq::socket_type::req);
+        socket.set(zmq::sockopt::linger, 0);
+        socket.set(zmq::sockopt::rcvtimeo, 2000);
+        socket.connect(address);
+        for (int i = 0; i < topics; i++) {
+            zmq::message_t reply;
+            if (!round_trip(socket, register_request(i).dump(), reply)) {
+                cerr << "No reply from CNS at " << address << endl;
+                return 1;
+            }
+        }
+    }
+
+    printf("%-8s %-8s %-8s %12s %12s %12s %12s %10s %14s %14s\n", "encoding", "clients", "writes", "req/s", "mean (us)",
+           "p50 (us)", "p99 (us)", "timeouts", "client us/req", "server us/req");
+    for (CnsEncoding encoding : encodings) {
+        vector<vector<double>> samples(clients);
+        atomic<uint64_t> failures{0};
+        vector<thread> threads;
+        double client_cpu_start = process_cpu_seconds();
+        double server_cpu_start = server_pid > 0 ? process_cpu_seconds(server_pid) : -1;
+        auto start = chrono::steady_clock::now();
+        auto deadline = start + chrono::seconds(duration);
+        for (int i = 0; i < clients; i++) {
+            threads.emplace_back(client_loop, &context, address, topics, write_percent, encoding, deadline, i + 1,
+                                 &samples[i], &failures);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double client_cpu = process_cpu_seconds() - client_cpu_start;
+        double server_cpu = server_cpu_start >= 0 ? process_cpu_seconds(server_pid) - server_cpu_start : -1;
+
+        vector<double> all;
+        for (const auto& s : samples) {
+            all.insert(all.end(), s.begin(), s.end());
+        }
+        if (all.empty()) {
+            cerr << "No " << cns_encoding_name(encoding) << " requests completed" << endl;
+            return 1;
+        }
+        sort(all.begin(), all.end());
+        double sum = 0;
+        for (double s : all) sum += s;
+
+        printf("%-8s %-8d %-7d%% %12.0f %12.1f %12.1f %12.1f %10lu %14.1f ", cns_encoding_name(encoding), clients,
+               write_percent, all.size() / elapsed, sum / all.size(), all[all.size() / 2],
+               all[min(all.size() - 1, all.size() * 99 / 100)], static_cast<unsigned long>(failures.load()),
+               client_cpu * 1e6 / all.size());
+        if (server_cpu >= 0) {
+            printf("%14.1f\n", server_cpu * 1e6 / all.size());
+        } else {
+            printf("%14s\n", "-");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * CNS blob benchmark
+ *
+ * Measures large values in the CNS key/value store, per value size:
+ *  - inline set/get: the value as one JSON string, the way set_parameter/get_parameter send it
+ *  - blob set: set_blob of new content, and again of the same content (no chunk uploaded)
+ *  - cold get: get_blob with an empty chunk cache, every chunk fetched
+ *  - warm get: get_blob again, every chunk from the cache (what a restarted node pays)
+ *  - range read: read_blob of the first CNS_MAX_BLOB_READ bytes
+ * Needs a CNS on the default port (./cns). See docs/name_server.md for how blobs are stored.
+ */
+
+#include <argparse/argparse.hpp>
+#include <quill/Backend.h>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "node.hpp"
+
+using namespace std;
+
+class BlobBenchNode : public GenericNode {
+    public:
+        BlobBenchNode(const string& cache_directory) : GenericNode("bench", "blob", "127.0.0.1", "127.0.0.1") {
+            set_blob_cache_directory(cache_directory);
+        }
+
+        using GenericNode::get_blob;
+        using GenericNode::get_parameter;
+        using GenericNode::read_blob;
+        using GenericNode::set_blob;
+        using GenericNode::set_parameter;
+};
+
+template <typename Fn>
+static double time_ms(Fn&& fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("cns_blob_bench");
+    program.add_argument("-s", "--sizes")
+        .help("Comma separated value sizes in KiB")
+        .default_value(string("64,1024,8192"));
+    program.add_argument("--cache-dir")
+        .help("Chunk cache for the benchmark, emptied before each cold read")
+        .default_value(string("/tmp/candor/blob_bench"));
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    string cache_directory = program.get<string>("cache-dir");
+    quill::Backend::start();
+
+    BlobBenchNode node(cache_directory);
+    mt19937_64 random(42);
+    printf("%10s %10s %10s %10s %10s %10s %10s %10s\n", "size (KiB)", "inline set", "inline get", "blob set",
+           "same set", "cold get", "warm get", "range");
+    vector<int> sizes;
+    stringstream list(program.get<string>("sizes"));
+    for (string item; getline(list, item, ',');) {
+        sizes.push_back(stoi(item));
+    }
+    for (int kib : sizes) {
+        // Printable, so the inline path can carry it as a JSON string
+        string value(size_t(kib) * 1024, ' ');
+        for (char& c : value) {
+            c = static_cast<char>('a' + random() % 26);
+        }
+        string key = "/bench/blob/" + to_string(kib);
+        string read;
+
+        double inline_set = time_ms([&] { node.set_parameter(key + "/inline", value); });
+        double inline_get = time_ms([&] { read = node.get_parameter(key + "/inline")["data"].get<string>(); });
+        node.set_parameter(key + "/inline", "");
+
+        double blob_set = time_ms([&] { node.set_blob(key, value); });
+        double same_set = time_ms([&] { node.set_blob(key, value); });
+        std::filesystem::remove_all(cache_directory);
+        double cold_get = time_ms([&] { node.get_blob(key, read); });
+        if (read != value) {
+            cerr << "Blob of " << kib << " KiB read back wrong" << endl;
+            return 1;
+        }
+        double warm_get = time_ms([&] { node.get_blob(key, read); });
+        double range = time_ms([&] { node.read_blob(key, 0, CNS_MAX_BLOB_READ, read); });
+
+        printf("%10d %8.1fms %8.1fms %8.1fms %8.1fms %8.1fms %8.1fms %8.1fms\n", kib, inline_set, inline_get, blob_set,
+               same_set, cold_get, warm_get, range);
+    }
+    std::filesystem::remove_all(cache_directory);
+    return 0;
+}
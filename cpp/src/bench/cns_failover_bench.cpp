@@ -0,0 +1,223 @@
+/**
+ * CNS failover benchmark
+ *
+ * Starts a primary CNS and a hot standby of it as two local processes, then measures:
+ *  - replication lag: from a registration being acknowledged by the primary until a lookup
+ *    on the standby finds it
+ *  - client failover: from the primary being killed (SIGKILL, no goodbye) until a client
+ *    that follows the failover rules of GenericNode::cns_request gets an answer from the
+ *    standby it learned from the primary
+ *  - promotion: from the kill until the standby reports itself as the primary
+ * See docs/name_server.md for how replication and failover work.
+ */
+
+#include <zmq.hpp>
+#include <argparse/argparse.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cns_protocol.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+static pid_t start_cns(const string& binary, const vector<string>& args) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        vector<char*> argv;
+        argv.push_back(const_cast<char*>(binary.c_str()));
+        for (const string& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(binary.c_str(), argv.data());
+        perror("execv");
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop_cns(pid_t pid, int signal) {
+    kill(pid, signal);
+    waitpid(pid, nullptr, 0);
+}
+
+/**
+ * One request on a fresh REQ socket, so a lost reply never leaves a socket stuck.
+ *
+ * @return false if no reply came within timeout_ms
+ */
+static bool request(zmq::context_t& context, const string& endpoint, const json& body, int timeout_ms, json& reply) {
+    zmq::socket_t socket(context, zmq::socket_type::req);
+    socket.set(zmq::sockopt::linger, 0);
+    socket.set(zmq::sockopt::rcvtimeo, timeout_ms);
+    socket.connect("tcp://" + endpoint);
+    string encoded = encode_cns_message(body, CnsEncoding::MSGPACK);
+    socket.send(zmq::buffer(encoded), zmq::send_flags::none);
+    zmq::message_t msg;
+    if (!socket.recv(msg, zmq::recv_flags::none)) {
+        return false;
+    }
+    reply = decode_cns_message(msg.data(), msg.size());
+    return true;
+}
+
+static json status_request() {
+    return {
+        {"self", "/bench/failover"},
+        {"action", "status"}
+    };
+}
+
+static json lookup_request(const string& topic) {
+    return {
+        {"self", "/bench/failover"},
+        {"action", "lookup"},
+        {"topic", topic}
+    };
+}
+
+/**
+ * Polls until check() holds or timeout_ms passes.
+ */
+template <typename Check>
+static bool wait_for(Check&& check, int timeout_ms) {
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+    while (chrono::steady_clock::now() < deadline) {
+        if (check()) {
+            return true;
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return false;
+}
+
+static double ms_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("cns_failover_bench");
+    program.add_argument("-b", "--cns-binary")
+        .help("Path to the cns executable")
+        .default_value(string("./cns"));
+    program.add_argument("-p", "--port")
+        .help("Port of the primary; it also uses the next three")
+        .default_value(6555)
+        .scan<'i', int>();
+    program.add_argument("-s", "--standby-port")
+        .help("Port of the standby; it also uses the next three")
+        .default_value(6565)
+        .scan<'i', int>();
+    program.add_argument("-t", "--topics")
+        .help("Topics registered on the primary before it is killed")
+        .default_value(200)
+        .scan<'i', int>();
+    program.add_argument("-r", "--runs")
+        .help("Failovers to measure")
+        .default_value(3)
+        .scan<'i', int>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    string binary = program.get<string>("cns-binary");
+    int port = program.get<int>("port");
+    int standby_port = program.get<int>("standby-port");
+    int topics = max(1, program.get<int>("topics"));
+    int runs = max(1, program.get<int>("runs"));
+    string primary = "127.0.0.1:" + to_string(port);
+    string standby = "127.0.0.1:" + to_string(standby_port);
+
+    zmq::context_t context(1);
+    printf("%-4s %10s %14s %14s %18s %16s\n", "run", "topics", "lag p50 (ms)", "lag max (ms)", "client answer (ms)",
+           "promoted (ms)");
+    for (int run = 0; run < runs; run++) {
+        pid_t primary_pid = start_cns(binary, {"-p", to_string(port), "--in-memory"});
+        json reply;
+        if (!wait_for([&] { return request(context, primary, status_request(), 100, reply); }, 5000)) {
+            cerr << "Primary CNS did not come up" << endl;
+            stop_cns(primary_pid, SIGKILL);
+            return 1;
+        }
+        pid_t standby_pid = start_cns(binary, {"-p", to_string(standby_port), "--in-memory", "--standby",
+                                               "-mip", "127.0.0.1", "--master-port", to_string(port)});
+        // The primary learns its standby from the standby's first sync
+        if (!wait_for([&] {
+                return request(context, primary, status_request(), 100, reply) && reply.value("standby", "") == standby;
+            }, 5000)) {
+            cerr << "Standby CNS did not sync" << endl;
+            stop_cns(standby_pid, SIGKILL);
+            stop_cns(primary_pid, SIGKILL);
+            return 1;
+        }
+
+        vector<double> lags;
+        for (int i = 0; i < topics; i++) {
+            string topic = "/bench/" + to_string(i) + "/data";
+            json registration = {
+                {"self", "/bench/failover"},
+                {"action", "register"},
+                {"topic", topic},
+                {"ip", "127.0.0.1"},
+                {"port", 7000 + i}
+            };
+            if (!request(context, primary, registration, 1000, reply)) {
+                cerr << "Registration failed" << endl;
+                break;
+            }
+            auto acknowledged = chrono::steady_clock::now();
+            if (wait_for([&] {
+                    return request(context, standby, lookup_request(topic), 100, reply) && reply.value("found", false);
+                }, 2000)) {
+                lags.push_back(ms_since(acknowledged));
+            }
+        }
+        sort(lags.begin(), lags.end());
+        string probe = "/bench/" + to_string(topics - 1) + "/data";
+
+        // A client keeps asking the primary, and moves to the standby once the primary has
+        // not answered for CNS_FAILOVER_TIMEOUT_MS, the way GenericNode does
+        auto killed = chrono::steady_clock::now();
+        stop_cns(primary_pid, SIGKILL);
+        string current = primary;
+        auto waiting_since = chrono::steady_clock::now();
+        double answered_ms = -1;
+        while (ms_since(killed) < 4 * CNS_FAILOVER_TIMEOUT_MS) {
+            if (request(context, current, lookup_request(probe), 100, reply)) {
+                if (reply.value("found", false)) {
+                    answered_ms = ms_since(killed);
+                }
+                break;
+            }
+            if (current == primary && ms_since(waiting_since) >= CNS_FAILOVER_TIMEOUT_MS) {
+                current = standby;
+            }
+        }
+
+        double promoted_ms = -1;
+        if (wait_for([&] {
+                return request(context, standby, status_request(), 100, reply) && reply.value("role", "") == "primary";
+            }, 4 * CNS_FAILOVER_TIMEOUT_MS)) {
+            promoted_ms = ms_since(killed);
+        }
+        stop_cns(standby_pid, SIGTERM);
+
+        printf("%-4d %10zu %14.2f %14.2f %18.1f %16.1f\n", run, lags.size(), lags.empty() ? -1.0 : lags[lags.size() / 2],
+               lags.empty() ? -1.0 : lags.back(), answered_ms, promoted_ms);
+    }
+    return 0;
+}
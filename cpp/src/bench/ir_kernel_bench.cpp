@@ -0,0 +1,99 @@
+/**
+ * IR conversion microbenchmark
+ *
+ * Compares the OpenCV two pass IR path the Kinect producer used to run
+ * (cv::threshold THRESH_TRUNC + convertTo CV_8UC1) with the fused
+ * ir_truncate_scale_u16_to_u8 kernel, at the IR resolutions of every depth mode.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <argparse/argparse.hpp>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "kinect/image_kernels.hpp"
+
+using namespace std;
+
+struct DepthMode {
+    string name;
+    int width;
+    int height;
+};
+
+// Runs fn iterations times and returns the mean time per call in microseconds
+template <typename Fn>
+static double time_us(int iterations, Fn fn) {
+    fn();  // warm caches and lazy allocations
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn();
+    }
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("ir_kernel_bench");
+    program.add_argument("-n", "--iterations")
+        .help("Conversions per measurement")
+        .default_value(500)
+        .scan<'i', int>();
+    program.add_argument("-t", "--truncate")
+        .help("IR truncation level")
+        .default_value(3000)
+        .scan<'i', int>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    int iterations = program.get<int>("iterations");
+    uint16_t truncate = static_cast<uint16_t>(program.get<int>("truncate"));
+    float scale = 255.0f / truncate;
+
+    vector<DepthMode> modes = {
+        {"NFOV 2x2 binned", 320, 288},
+        {"NFOV unbinned", 640, 576},
+        {"WFOV 2x2 binned", 512, 512},
+        {"WFOV unbinned", 1024, 1024},
+        {"passive IR", 1024, 1024},
+    };
+
+    printf("fused kernel isa: %s\n", image_kernels_isa());
+    printf("%-18s %-10s %14s %14s %14s %9s %9s\n", "mode", "size", "opencv (us)", "scalar (us)", "fused (us)", "speedup", "max diff");
+    for (const auto& mode : modes) {
+        cv::Mat src(mode.height, mode.width, CV_16UC1);
+        cv::randu(src, 0, 8000);
+        size_t count = src.total();
+        const uint16_t* src_data = src.ptr<uint16_t>();
+
+        cv::Mat opencv_out;
+        double opencv_us = time_us(iterations, [&]() {
+            cv::threshold(src, opencv_out, truncate, truncate, cv::THRESH_TRUNC);
+            opencv_out.convertTo(opencv_out, CV_8UC1, 255.0 / truncate);
+        });
+
+        cv::Mat scalar_out(mode.height, mode.width, CV_8UC1);
+        double scalar_us = time_us(iterations, [&]() {
+            ir_truncate_scale_u16_to_u8_scalar(src_data, scalar_out.data, count, truncate, scale);
+        });
+
+        cv::Mat fused_out(mode.height, mode.width, CV_8UC1);
+        double fused_us = time_us(iterations, [&]() {
+            ir_truncate_scale_u16_to_u8(src_data, fused_out.data, count, truncate, scale);
+        });
+
+        // Float vs double rounding can differ by one at exact .5 boundaries
+        double max_diff = cv::norm(opencv_out, fused_out, cv::NORM_INF);
+        string size = to_string(mode.width) + "x" + to_string(mode.height);
+        printf("%-18s %-10s %14.1f %14.1f %14.1f %8.2fx %9.0f\n", mode.name.c_str(), size.c_str(),
+               opencv_us, scalar_us, fused_us, opencv_us / fused_us, max_diff);
+    }
+    return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * Subscriber restart benchmark
+ *
+ * Measures how long a managed subscription (GenericNode::subscribe) goes without frames
+ * when its publisher restarts. The publisher runs as a child process (this binary with
+ * --publish) and comes back on a new port every run, either after a clean shutdown, which
+ * unregisters its topic, or after SIGKILL, in which case its new registration replaces the
+ * old one. For each restart it reports:
+ *  - gap: from the last frame of the old publisher to the first frame of the new one
+ *  - resume: from starting the new publisher process to its first frame arriving
+ * Needs a CNS on the default port (./cns). See docs/name_server.md for how subscriptions
+ * follow their publisher.
+ */
+
+#include <argparse/argparse.hpp>
+#include <quill/Backend.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "node.hpp"
+
+using namespace std;
+
+static const string BENCH_TOPIC = "/bench/restart/frames";
+static std::atomic<bool> g_stop{false};
+
+static void stop_handler(int) {
+    g_stop.store(true);
+}
+
+/**
+ * Publishes small frames on BENCH_TOPIC until SIGTERM.
+ */
+class RestartPublisher : public GenericNode {
+    public:
+        RestartPublisher() : GenericNode("bench", "restart_publisher", "127.0.0.1", "127.0.0.1") {
+            m_socket = setup_publisher({BENCH_TOPIC});
+        }
+
+        void run(int rate_hz) {
+            auto interval = chrono::microseconds(1000000 / max(1, rate_hz));
+            auto next = chrono::steady_clock::now();
+            FrameHeader header;
+            header.width = 4;
+            header.height = 4;
+            header.channels = 1;
+            header.bit_depth = 8;
+            const char payload[16] = {};
+            while (!g_stop.load()) {
+                zmq::message_t header_msg(sizeof(FrameHeader));
+                encode_frame_header(header, header_msg.data(), header_msg.size());
+                m_socket->send(zmq::buffer(BENCH_TOPIC), zmq::send_flags::sndmore);
+                m_socket->send(header_msg, zmq::send_flags::sndmore);
+                m_socket->send(zmq::buffer(payload, sizeof(payload)), zmq::send_flags::none);
+                header.sequence++;
+                next += interval;
+                this_thread::sleep_until(next);
+            }
+        }
+
+    private:
+        unique_ptr<zmq::socket_t> m_socket;
+};
+
+class RestartSubscriber : public GenericNode {
+    public:
+        RestartSubscriber() : GenericNode("bench", "restart_subscriber", "127.0.0.1", "127.0.0.1") {}
+
+        shared_ptr<Subscription> follow(const string& topic) { return subscribe(topic); }
+
+        /**
+         * Receives until `frames` more frames arrived after at least `reconnects` reconnects,
+         * or timeout_ms passes.
+         */
+        bool wait_for_frames(Subscription& subscription, uint64_t reconnects, uint64_t frames, int timeout_ms) {
+            auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+            uint64_t target = subscription.received() + frames;
+            ReceivedFrame frame;
+            while (chrono::steady_clock::now() < deadline) {
+                zmq::pollitem_t items[] = {
+                    { subscription.socket(), 0, ZMQ_POLLIN, 0 }
+                };
+                zmq::poll(items, 1, chrono::milliseconds(1));
+                if (items[0].revents & ZMQ_POLLIN) {
+                    recv_frame(subscription, frame);
+                } else {
+                    subscription.refresh();
+                }
+                if (subscription.reconnects() >= reconnects && subscription.received() >= target) {
+                    return true;
+                }
+            }
+            return false;
+        }
+};
+
+static pid_t start_publisher(const string& binary, int rate_hz) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        string rate = to_string(rate_hz);
+        char* argv[] = {
+            const_cast<char*>(binary.c_str()),
+            const_cast<char*>("--publish"),
+            const_cast<char*>("--rate"),
+            const_cast<char*>(rate.c_str()),
+            nullptr
+        };
+        execv(binary.c_str(), argv);
+        perror("execv");
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop_publisher(pid_t pid, int signal) {
+    kill(pid, signal);
+    waitpid(pid, nullptr, 0);
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("subscriber_restart_bench");
+    program.add_argument("-r", "--runs")
+        .help("Publisher restarts to measure")
+        .default_value(5)
+        .scan<'i', int>();
+    program.add_argument("--rate")
+        .help("Frames per second the publisher sends")
+        .default_value(200)
+        .scan<'i', int>();
+    program.add_argument("--kill")
+        .help("Stop the publisher with SIGKILL instead of a clean shutdown")
+        .default_value(false)
+        .implicit_value(true);
+    program.add_argument("--publish")
+        .help("Run as the publisher (used by the benchmark itself)")
+        .default_value(false)
+        .implicit_value(true);
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    int rate_hz = program.get<int>("rate");
+    quill::Backend::start();
+
+    if (program.get<bool>("publish")) {
+        signal(SIGTERM, stop_handler);
+        RestartPublisher publisher;
+        publisher.run(rate_hz);
+        return 0;
+    }
+
+    int runs = max(1, program.get<int>("runs"));
+    int stop_signal = program.get<bool>("kill") ? SIGKILL : SIGTERM;
+    // Generous: a killed publisher's old registration has to be replaced first
+    const int timeout_ms = 4 * CNS_HEARTBEAT_INTERVAL_MS * CNS_DEFAULT_HEARTBEAT_MISSES;
+
+    // The child is this binary, started again with exec, so it never inherits our threads
+    string binary = "/proc/self/exe";
+    char resolved[4096] = {};
+    if (readlink(binary.c_str(), resolved, sizeof(resolved) - 1) > 0) {
+        binary = resolved;
+    }
+
+    pid_t publisher = start_publisher(binary, rate_hz);
+    RestartSubscriber node;
+    shared_ptr<Subscription> subscription = node.follow(BENCH_TOPIC);
+    if (!node.wait_for_frames(*subscription, 0, 10, timeout_ms)) {
+        cerr << "No frames from the first publisher" << endl;
+        stop_publisher(publisher, SIGKILL);
+        return 1;
+    }
+
+    printf("%-4s %-8s %12s %12s\n", "run", "stop", "gap (ms)", "resume (ms)");
+    vector<double> gaps;
+    for (int run = 0; run < runs; run++) {
+        stop_publisher(publisher, stop_signal);
+        auto started = chrono::steady_clock::now();
+        publisher = start_publisher(binary, rate_hz);
+        uint64_t reconnects = subscription->reconnects() + 1;
+        double gap_ms = -1;
+        double resume_ms = -1;
+        if (node.wait_for_frames(*subscription, reconnects, 1, timeout_ms)) {
+            gap_ms = subscription->last_gap_ms();
+            resume_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+            gaps.push_back(gap_ms);
+        }
+        printf("%-4d %-8s %12.1f %12.1f\n", run, stop_signal == SIGKILL ? "kill" : "clean", gap_ms, resume_ms);
+    }
+    stop_publisher(publisher, SIGTERM);
+
+    if (!gaps.empty()) {
+        sort(gaps.begin(), gaps.end());
+        printf("gap p50 %.1f ms, max %.1f ms over %zu restarts\n", gaps[gaps.size() / 2], gaps.back(), gaps.size());
+    }
+    return 0;
+}
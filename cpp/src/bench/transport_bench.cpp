@@ -0,0 +1,141 @@
+/**
+ * Transport latency benchmark
+ *
+ * Measures one way per message latency (round trip / 2) of a PAIR socket ping-pong over
+ * inproc, ipc and tcp for the frame sizes the Kinect producer publishes. This is what
+ * GenericNode::select_endpoint() trades between when a subscriber is in the same process,
+ * on the same host, or remote.
+ */
+
+#include <zmq.hpp>
+#include <argparse/argparse.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+#include "constants.hpp"
+#include "frame_header.hpp"
+
+using namespace std;
+
+struct FrameSize {
+    string name;
+    size_t bytes;
+};
+
+struct LatencyStats {
+    double mean_us;
+    double p50_us;
+    double p99_us;
+};
+
+// Echoes every message back to the sender until it receives an empty message
+static void echo_loop(zmq::socket_t* socket) {
+    while (true) {
+        zmq::message_t msg;
+        if (!socket->recv(msg, zmq::recv_flags::none)) {
+            continue;
+        }
+        bool done = msg.size() == 0;
+        socket->send(msg, zmq::send_flags::none);
+        if (done) {
+            return;
+        }
+    }
+}
+
+static LatencyStats run_ping_pong(zmq::context_t& context, const string& bind_endpoint, size_t bytes, int iterations, int warmup) {
+    zmq::socket_t server(context, zmq::socket_type::pair);
+    server.set(zmq::sockopt::linger, 0);
+    server.bind(bind_endpoint);
+    string endpoint = server.get(zmq::sockopt::last_endpoint);
+
+    zmq::socket_t client(context, zmq::socket_type::pair);
+    client.set(zmq::sockopt::linger, 0);
+    client.connect(endpoint);
+
+    thread echo(echo_loop, &server);
+
+    vector<char> payload(bytes, 0x5a);
+    vector<double> samples;
+    samples.reserve(iterations);
+    for (int i = 0; i < warmup + iterations; i++) {
+        zmq::message_t request(payload.data(), payload.size());
+        auto start = chrono::steady_clock::now();
+        client.send(request, zmq::send_flags::none);
+        zmq::message_t reply;
+        client.recv(reply, zmq::recv_flags::none);
+        auto elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        if (i >= warmup) {
+            samples.push_back(elapsed / 2.0);
+        }
+    }
+
+    zmq::message_t stop;
+    client.send(stop, zmq::send_flags::none);
+    zmq::message_t stop_reply;
+    client.recv(stop_reply, zmq::recv_flags::none);
+    echo.join();
+
+    sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (double s : samples) sum += s;
+    return LatencyStats{
+        sum / samples.size(),
+        samples[samples.size() / 2],
+        samples[min(samples.size() - 1, samples.size() * 99 / 100)]
+    };
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("transport_bench");
+    program.add_argument("-n", "--iterations")
+        .help("Measured messages per transport and frame size")
+        .default_value(1000)
+        .scan<'i', int>();
+    program.add_argument("-w", "--warmup")
+        .help("Unmeasured messages sent first")
+        .default_value(100)
+        .scan<'i', int>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    int iterations = program.get<int>("iterations");
+    int warmup = program.get<int>("warmup");
+
+    // What the Kinect producer sends per capture (WFOV 2x2 binned IR, 720p color)
+    vector<FrameSize> sizes = {
+        {"header", sizeof(FrameHeader)},
+        {"ir 8-bit 512x512", 512 * 512},
+        {"raw ir 16-bit 512x512", 512 * 512 * 2},
+        {"bgr 1280x720", 1280 * 720 * 3},
+    };
+
+    mkdir(IPC_DIRECTORY, 0777);
+    vector<pair<string, string>> transports = {
+        {"inproc", "inproc://transport_bench"},
+        {"ipc", string("ipc://") + IPC_DIRECTORY + "/transport_bench"},
+        {"tcp", "tcp://127.0.0.1:0"},
+    };
+
+    zmq::context_t context(1);
+    printf("%-24s %-8s %12s %12s %12s\n", "frame", "transport", "mean (us)", "p50 (us)", "p99 (us)");
+    for (const auto& size : sizes) {
+        for (const auto& transport : transports) {
+            LatencyStats stats = run_ping_pong(context, transport.second, size.bytes, iterations, warmup);
+            printf("%-24s %-8s %12.1f %12.1f %12.1f\n", size.name.c_str(), transport.first.c_str(),
+                   stats.mean_us, stats.p50_us, stats.p99_us);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <zmq.hpp>
+#include <zmq_addon.hpp>
+#include <nlohmann/json.hpp>
+
+#include "cns_protocol.hpp"
+
+/**
+ * @brief Set on a CnsClient future when the CNS did not answer before the request's deadline.
+ */
+class CnsTimeout : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief A CNS reply together with the binary frames that followed its body (blob chunks).
+ */
+struct CnsReply {
+    nlohmann::json body;
+    std::vector<zmq::message_t> frames;
+};
+
+/**
+ * @brief Asynchronous CNS client: any number of requests in flight, from any number of threads.
+ *
+ * Requests go out on one DEALER socket as [request id, empty delimiter, body, frames...].
+ * The CNS keeps every frame up to the delimiter as the routing envelope and sends it back
+ * with the reply, so replies are matched to requests by id in whatever order they arrive. Unlike a
+ * REQ socket, a lost reply leaves nothing stuck: the request's future fails with CnsTimeout
+ * at its deadline, and a reply that turns up later is dropped.
+ *
+ * Callers hand requests to an I/O thread over an inproc socket, guarded by a mutex, and
+ * only ever wait on their own future, so a slow CNS holds up the requests waiting for it
+ * and nothing else. If a request times out, and nothing at all has arrived since it was sent
+ * nor for CNS_FAILOVER_TIMEOUT_MS, the DEALER is replaced so messages queued for an unresponsive
+ * CNS are dropped rather than delivered late. Replies to the old DEALER can never arrive,
+ * so every request sent on it fails with CnsTimeout right away instead of at its deadline.
+ */
+class CnsClient {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /**
+         * @param endpoint CNS request endpoint, e.g. "tcp://127.0.0.1:5555"
+         */
+        CnsClient(zmq::context_t& context, const std::string& endpoint, CnsEncoding encoding = CnsEncoding::JSON)
+            : m_context(context), m_endpoint(endpoint), m_encoding(encoding) {
+            static std::atomic<uint64_t> instances{0};
+            m_inbox_endpoint = "inproc://cns_client_" + std::to_string(instances++);
+            // Bound before anything connects to it. No high water mark: a caller blocked in
+            // send while holding m_mtx would deadlock with the I/O thread.
+            m_inbox = zmq::socket_t(m_context, zmq::socket_type::pull);
+            m_inbox.set(zmq::sockopt::rcvhwm, 0);
+            m_inbox.bind(m_inbox_endpoint);
+            m_outbox = zmq::socket_t(m_context, zmq::socket_type::push);
+            m_outbox.set(zmq::sockopt::linger, 0);
+            m_outbox.set(zmq::sockopt::sndhwm, 0);
+            m_outbox.connect(m_inbox_endpoint);
+            m_thread = std::thread(&CnsClient::io_loop, this);
+        }
+
+        /**
+         * Fails every request still in flight.
+         */
+        ~CnsClient() {
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_stop = true;
+            }
+            if (m_thread.joinable()) {
+                m_thread.join();
+            }
+            m_outbox.close();
+            m_inbox.close();
+            fail_all(std::make_exception_ptr(std::runtime_error("CNS client stopped")), false);
+        }
+
+        CnsClient(const CnsClient&) = delete;
+        CnsClient& operator=(const CnsClient&) = delete;
+
+        /**
+         * Sends a request. Thread safe and never blocks on the CNS.
+         *
+         * @return the decoded reply; fails with CnsTimeout if none arrives within timeout, or
+         *         with nlohmann::json::exception if the reply cannot be decoded
+         * @throws std::runtime_error if the client is stopped
+         */
+        std::future<nlohmann::json> request(const nlohmann::json& request, std::chrono::milliseconds timeout) {
+            std::string body = encode_cns_message(request, m_encoding.load());
+            std::vector<zmq::message_t> no_frames;
+            std::lock_guard<std::mutex> lock(m_mtx);
+            Pending& pending = send(body, no_frames, timeout);
+            return pending.promise.get_future();
+        }
+
+        /**
+         * Sends a request followed by binary frames, e.g. a blob chunk, and returns the reply
+         * with the frames that follow its body. Thread safe and never blocks on the CNS.
+         *
+         * @return the reply; fails like request()
+         * @throws std::runtime_error if the client is stopped
+         */
+        std::future<CnsReply> request_frames(const nlohmann::json& request, std::vector<zmq::message_t> frames,
+                                             std::chrono::milliseconds timeout) {
+            std::string body = encode_cns_message(request, m_encoding.load());
+            std::lock_guard<std::mutex> lock(m_mtx);
+            Pending& pending = send(body, frames, timeout);
+            pending.wants_frames = true;
+            return pending.framed.get_future();
+        }
+
+        /**
+         * Sends a request and waits for its reply.
+         *
+         * @throws CnsTimeout if no reply arrives within timeout
+         */
+        nlohmann::json call(const nlohmann::json& request, std::chrono::milliseconds timeout) {
+            return this->request(request, timeout).get();
+        }
+
+        /**
+         * Talks to a different CNS from now on. Requests in flight to the old one fail with
+         * CnsTimeout.
+         */
+        void reconnect(const std::string& endpoint) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_endpoint = endpoint;
+            m_reconnect = true;
+        }
+
+        void set_encoding(CnsEncoding encoding) { m_encoding.store(encoding); }
+
+        size_t in_flight() {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            return m_pending.size();
+        }
+
+    private:
+        struct Pending {
+            std::promise<nlohmann::json> promise;
+            std::promise<CnsReply> framed;   // instead of promise, for request_frames()
+            bool wants_frames = false;
+            bool forwarded = false;          // handed to the current DEALER by the I/O thread
+            Clock::time_point sent;
+            Clock::time_point deadline;
+
+            void fail(std::exception_ptr error) {
+                if (wants_frames) {
+                    framed.set_exception(error);
+                } else {
+                    promise.set_exception(error);
+                }
+            }
+        };
+
+        /**
+         * Hands a request to the I/O thread as [id, body, frames...]. Called with m_mtx held.
+         */
+        Pending& send(const std::string& body, std::vector<zmq::message_t>& frames, std::chrono::milliseconds timeout) {
+            if (m_stop) {
+                throw std::runtime_error("CNS client stopped");
+            }
+            uint64_t id = m_next_id++;
+            Pending& pending = m_pending[id];
+            pending.sent = Clock::now();
+            pending.deadline = pending.sent + timeout;
+
+            zmq::message_t id_frame(&id, sizeof(id));
+            m_outbox.send(id_frame, zmq::send_flags::sndmore);
+            m_outbox.send(zmq::buffer(body), frames.empty() ? zmq::send_flags::none : zmq::send_flags::sndmore);
+            for (size_t i = 0; i < frames.size(); i++) {
+                m_outbox.send(frames[i], i + 1 < frames.size() ? zmq::send_flags::sndmore : zmq::send_flags::none);
+            }
+            return pending;
+        }
+
+        zmq::socket_t open_dealer() {
+            std::string endpoint;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                endpoint = m_endpoint;
+                m_reconnect = false;
+            }
+            zmq::socket_t dealer(m_context, zmq::socket_type::dealer);
+            dealer.set(zmq::sockopt::linger, 0);
+            dealer.connect(endpoint);
+            return dealer;
+        }
+
+        void io_loop() {
+            zmq::socket_t dealer = open_dealer();
+            Clock::time_point last_reply = Clock::now();
+            Clock::time_point next_deadline = Clock::now() + std::chrono::milliseconds(MAX_POLL_MS);
+            std::vector<zmq::message_t> frames;
+            std::vector<uint64_t> forwarded;
+            while (true) {
+                bool reconnect;
+                {
+                    std::lock_guard<std::mutex> lock(m_mtx);
+                    if (m_stop) {
+                        break;
+                    }
+                    reconnect = m_reconnect;
+                }
+                try {
+                    if (reconnect) {
+                        dealer = open_dealer();
+                        abandon_forwarded();
+                    }
+                    zmq::pollitem_t items[] = {
+                        { m_inbox, 0, ZMQ_POLLIN, 0 },
+                        { dealer, 0, ZMQ_POLLIN, 0 }
+                    };
+                    // Sleep until the next deadline, but look at m_stop now and then
+                    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next_deadline - Clock::now());
+                    zmq::poll(items, 2, std::clamp(wait + std::chrono::milliseconds(1), std::chrono::milliseconds(1),
+                                                   std::chrono::milliseconds(MAX_POLL_MS)));
+
+                    // Requests from callers: [id, body, ...] becomes [id, delimiter, body, ...]
+                    if (items[0].revents & ZMQ_POLLIN) {
+                        frames.clear();
+                        forwarded.clear();
+                        while (zmq::recv_multipart(m_inbox, std::back_inserter(frames), zmq::recv_flags::dontwait)) {
+                            if (frames.size() >= 2 && frames[0].size() == sizeof(uint64_t)) {
+                                uint64_t id;
+                                std::memcpy(&id, frames[0].data(), sizeof(id));
+                                forwarded.push_back(id);
+                                dealer.send(frames[0], zmq::send_flags::sndmore);
+                                dealer.send(zmq::message_t(), zmq::send_flags::sndmore);
+                                for (size_t i = 1; i < frames.size(); i++) {
+                                    dealer.send(frames[i], i + 1 < frames.size() ? zmq::send_flags::sndmore : zmq::send_flags::none);
+                                }
+                            }
+                            frames.clear();
+                        }
+                        mark_forwarded(forwarded);
+                    }
+
+                    // Replies: [id, delimiter, body, ...]
+                    if (items[1].revents & ZMQ_POLLIN) {
+                        frames.clear();
+                        while (zmq::recv_multipart(dealer, std::back_inserter(frames), zmq::recv_flags::dontwait)) {
+                            last_reply = Clock::now();
+                            if (frames.size() >= 3 && frames[0].size() == sizeof(uint64_t)) {
+                                uint64_t id;
+                                std::memcpy(&id, frames[0].data(), sizeof(id));
+                                deliver(id, frames);
+                            }
+                            frames.clear();
+                        }
+                    }
+
+                    if (expire(last_reply, next_deadline)
+                            && Clock::now() - last_reply >= std::chrono::milliseconds(CNS_FAILOVER_TIMEOUT_MS)) {
+                        // Nothing at all came back since the expired request went out, nor
+                        // for a whole failover timeout: start over rather than leave requests
+                        // queued for an unresponsive CNS
+                        dealer = open_dealer();
+                        abandon_forwarded();
+                        last_reply = Clock::now();
+                    }
+                } catch (const zmq::error_t& err) {
+                    if (err.num() == ETERM) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        /**
+         * @param frames the whole reply; the frames after its body are moved out
+         */
+        void deliver(uint64_t id, std::vector<zmq::message_t>& frames) {
+            Pending pending;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                auto it = m_pending.find(id);
+                if (it == m_pending.end()) {
+                    return;  // timed out already
+                }
+                pending = std::move(it->second);
+                m_pending.erase(it);
+            }
+            try {
+                nlohmann::json body = decode_cns_message(frames[2].data(), frames[2].size());
+                if (pending.wants_frames) {
+                    CnsReply reply{std::move(body), {}};
+                    std::move(frames.begin() + 3, frames.end(), std::back_inserter(reply.frames));
+                    pending.framed.set_value(std::move(reply));
+                } else {
+                    pending.promise.set_value(std::move(body));
+                }
+            } catch (const nlohmann::json::exception&) {
+                pending.fail(std::current_exception());
+            }
+        }
+
+        /**
+         * Fails requests past their deadline.
+         *
+         * @param next_deadline receives the earliest deadline still pending
+         * @return true if one of them was sent after the last reply arrived
+         */
+        bool expire(Clock::time_point last_reply, Clock::time_point& next_deadline) {
+            std::vector<Pending> expired;
+            bool unanswered = false;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                auto now = Clock::now();
+                next_deadline = now + std::chrono::milliseconds(MAX_POLL_MS);
+                for (auto it = m_pending.begin(); it != m_pending.end();) {
+                    if (it->second.deadline > now) {
+                        next_deadline = std::min(next_deadline, it->second.deadline);
+                        ++it;
+                        continue;
+                    }
+                    unanswered = unanswered || it->second.sent >= last_reply;
+                    expired.push_back(std::move(it->second));
+                    it = m_pending.erase(it);
+                }
+            }
+            for (Pending& pending : expired) {
+                pending.fail(std::make_exception_ptr(CnsTimeout("No reply from the CNS")));
+            }
+            return unanswered;
+        }
+
+        void mark_forwarded(const std::vector<uint64_t>& ids) {
+            if (ids.empty()) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(m_mtx);
+            for (uint64_t id : ids) {
+                auto it = m_pending.find(id);
+                if (it != m_pending.end()) {
+                    it->second.forwarded = true;
+                }
+            }
+        }
+
+        /**
+         * Fails the requests sent on a DEALER that was just replaced. Requests still waiting
+         * in the inbox go out on the new one.
+         */
+        void abandon_forwarded() {
+            fail_all(std::make_exception_ptr(CnsTimeout("CNS connection was reset")), true);
+        }
+
+        /**
+         * @param forwarded_only only fail requests already handed to the DEALER
+         */
+        void fail_all(std::exception_ptr error, bool forwarded_only) {
+            std::vector<Pending> failed;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                for (auto it = m_pending.begin(); it != m_pending.end();) {
+                    if (forwarded_only && !it->second.forwarded) {
+                        ++it;
+                        continue;
+                    }
+                    failed.push_back(std::move(it->second));
+                    it = m_pending.erase(it);
+                }
+            }
+            for (Pending& pending : failed) {
+                pending.fail(error);
+            }
+        }
+
+        static constexpr int MAX_POLL_MS = 100;
+
+        zmq::context_t& m_context;
+        std::string m_endpoint;              // guarded by m_mtx
+        std::atomic<CnsEncoding> m_encoding;
+        std::string m_inbox_endpoint;
+        zmq::socket_t m_inbox;               // PULL, owned by the I/O thread
+        zmq::socket_t m_outbox;              // PUSH, guarded by m_mtx
+
+        std::mutex m_mtx;
+        std::unordered_map<uint64_t, Pending> m_pending;
+        uint64_t m_next_id = 1;
+        bool m_reconnect = false;
+        bool m_stop = false;
+        std::thread m_thread;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "sha256.hpp"
+
+/**
+ * @brief How a CNS request or reply body is encoded.
+ *
+ * JSON bodies are plain JSON text, which is what every existing client (including the python
+ * side) sends. Binary bodies start with a type byte followed by the MessagePack or CBOR
+ * encoding of the same document. Neither type byte can start a JSON text, so the CNS tells
+ * them apart per request and replies in the encoding the request used.
+ */
+enum class CnsEncoding : uint8_t {
+    JSON    = 0,
+    MSGPACK = 1,
+    CBOR    = 2,
+};
+
+constexpr size_t CNS_ENCODING_COUNT = 3;
+
+// Leading type bytes of binary bodies
+constexpr uint8_t CNS_MSGPACK_MARKER = 0x01;
+constexpr uint8_t CNS_CBOR_MARKER = 0x02;
+
+// Registry change events are published on the CNS port plus this offset, as two part
+// messages: CNS_EVENT_TOPIC and a JSON body
+// {"seq": n, "event": "register" | "moved" | "unregister" | "expired" | "reset" | "sync", ...}.
+// register and moved carry the topic's lookup reply under "lookup"; sync is sent every
+// CNS_EVENT_SYNC_INTERVAL_MS so clients can tell a quiet registry from a lost connection.
+constexpr int CNS_EVENTS_PORT_OFFSET = 1;
+constexpr const char* CNS_EVENT_TOPIC = "registry";
+constexpr int CNS_EVENT_SYNC_INTERVAL_MS = 1000;
+
+// Key/value changes are published on the same socket under CNS_DATA_EVENT_PREFIX + key, so
+// a watcher subscribes to exactly the keys (or key prefix) it wants. The body is JSON
+// {"event": "set", "key": k, "data": v, "revision": r}. Revisions come from one counter for
+// the whole store, so a later change always has a higher revision than an earlier one.
+constexpr const char* CNS_DATA_EVENT_PREFIX = "data/";
+
+// Nodes push heartbeats, one way, to the CNS port plus this offset. The body is an encoded
+// {"self": node, "action": "heartbeat", "timestamp": ...}; a node that misses
+// CNS_DEFAULT_HEARTBEAT_MISSES intervals in a row is offline and its topics expire.
+constexpr int CNS_HEARTBEAT_PORT_OFFSET = 2;
+constexpr int CNS_HEARTBEAT_INTERVAL_MS = 1000;
+constexpr int CNS_DEFAULT_HEARTBEAT_MISSES = 5;
+
+// Every registration holds a lease on its topic, renewed by the owner's heartbeats. A
+// "register" may ask for a longer lease_ms than the heartbeat timeout, up to this cap.
+constexpr int64_t CNS_MAX_LEASE_MS = 600000;
+
+// A primary CNS streams every registry mutation to standbys on its port plus this offset,
+// as MessagePack {"seq": n, "mutation": {...}}, and a bare {"seq": n} once a second. A
+// standby that hears nothing for CNS_FAILOVER_TIMEOUT_MS takes over; clients that get no
+// reply for that long switch to the standby the primary advertised in its sync events.
+constexpr int CNS_REPLICATION_PORT_OFFSET = 3;
+constexpr int CNS_FAILOVER_TIMEOUT_MS = 3000;
+
+// Most operations a single "batch" request may carry
+constexpr size_t CNS_MAX_BATCH = 1024;
+
+// Page sizes for "query": topics returned when the request gives no limit, and the most
+// a request may ask for
+constexpr size_t CNS_DEFAULT_QUERY_LIMIT = 100;
+constexpr size_t CNS_MAX_QUERY_LIMIT = 1000;
+
+// "wait_for" parks a lookup of a topic that is not registered yet until it is registered or
+// the request's timeout_ms passes; the CNS caps both the wait and the number of waits parked
+constexpr int64_t CNS_MAX_WAIT_MS = 60000;
+constexpr size_t CNS_MAX_PARKED_WAITS = 10000;
+
+// Large values are stored as blobs: content addressed chunks of at most
+// CNS_BLOB_CHUNK_SIZE bytes, uploaded with "put_chunk" and tied to a key by a "set" that
+// carries {"blob": {"size", "chunks"}} instead of "data". The key's value then reads
+// CNS_BLOB_REF_PREFIX + the blob hash (see cns_blob_hash()), so watchers see every change.
+// Chunks travel as raw binary frames after the request or reply body, and one
+// "get_chunks" or "read_blob" reply carries at most CNS_MAX_BLOB_READ bytes of them.
+constexpr size_t CNS_BLOB_CHUNK_SIZE = 256 * 1024;
+constexpr size_t CNS_MAX_BLOB_READ = 4 * 1024 * 1024;
+constexpr uint64_t CNS_MAX_BLOB_SIZE = uint64_t(1) << 30;
+constexpr const char* CNS_BLOB_REF_PREFIX = "sha256:";
+
+inline const char* cns_encoding_name(CnsEncoding encoding) {
+    switch (encoding) {
+        case CnsEncoding::MSGPACK: return "msgpack";
+        case CnsEncoding::CBOR: return "cbor";
+        default: return "json";
+    }
+}
+
+/**
+ * @throws std::invalid_argument for anything but json, msgpack or cbor
+ */
+inline CnsEncoding parse_cns_encoding(const std::string& name) {
+    if (name == "json") return CnsEncoding::JSON;
+    if (name == "msgpack") return CnsEncoding::MSGPACK;
+    if (name == "cbor") return CnsEncoding::CBOR;
+    throw std::invalid_argument("Unknown CNS encoding: " + name);
+}
+
+/**
+ * Hash of a blob: the SHA-256 of its chunk hashes (lowercase hex) joined in order. It
+ * changes whenever any chunk does, and the CNS can check it without reading the chunks.
+ */
+inline std::string cns_blob_hash(const std::vector<std::string>& chunks) {
+    Sha256 hash;
+    for (const std::string& chunk : chunks) {
+        hash.update(chunk.data(), chunk.size());
+    }
+    return Sha256::to_hex(hash.digest());
+}
+
+/**
+ * Encodes a CNS request or reply body.
+ */
+inline std::string encode_cns_message(const nlohmann::json& message, CnsEncoding encoding) {
+    if (encoding == CnsEncoding::JSON) {
+        return message.dump();
+    }
+    std::string out(1, static_cast<char>(encoding == CnsEncoding::MSGPACK ? CNS_MSGPACK_MARKER : CNS_CBOR_MARKER));
+    if (encoding == CnsEncoding::MSGPACK) {
+        nlohmann::json::to_msgpack(message, nlohmann::detail::output_adapter<char>(out));
+    } else {
+        nlohmann::json::to_cbor(message, nlohmann::detail::output_adapter<char>(out));
+    }
+    return out;
+}
+
+/**
+ * Detects the encoding of a body from its first byte.
+ */
+inline CnsEncoding detect_cns_encoding(const void* data, size_t size) {
+    if (size > 0) {
+        uint8_t marker = static_cast<const uint8_t*>(data)[0];
+        if (marker == CNS_MSGPACK_MARKER) return CnsEncoding::MSGPACK;
+        if (marker == CNS_CBOR_MARKER) return CnsEncoding::CBOR;
+    }
+    return CnsEncoding::JSON;
+}
+
+/**
+ * Decodes a CNS request or reply body in any encoding.
+ *
+ * @param encoding if not null, receives the encoding the body used
+ * @throws nlohmann::json::exception if the body is malformed
+ */
+inline nlohmann::json decode_cns_message(const void* data, size_t size, CnsEncoding* encoding = nullptr) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    CnsEncoding detected = detect_cns_encoding(data, size);
+    if (encoding != nullptr) {
+        *encoding = detected;
+    }
+    switch (detected) {
+        case CnsEncoding::MSGPACK: return nlohmann::json::from_msgpack(bytes + 1, bytes + size);
+        case CnsEncoding::CBOR: return nlohmann::json::from_cbor(bytes + 1, bytes + size);
+        default: return nlohmann::json::parse(bytes, bytes + size);
+    }
+}
@@ -1,3 +1,16 @@
 #pragma once
 
-#define LOG_LOCATION "logs"
\ No newline at end of file
+#define LOG_LOCATION "logs"
+
+// Prepended to a topic when the frame payload is a shared memory slot descriptor.
+// Using a prefix rather than a suffix keeps tcp subscribers of "/x/y" from matching it.
+#define SHM_TOPIC_PREFIX "@shm"
+
+// Directory holding the ipc:// endpoints publishers bind for same host subscribers
+#define IPC_DIRECTORY "/tmp/candor"
+
+// Where the CNS persists its registry by default
+#define CNS_STATE_DIRECTORY "state/cns"
+
+// Where nodes cache the blob chunks they read from the CNS, by hash
+#define BLOB_CACHE_DIRECTORY "/tmp/candor/blobs"
\ No newline at end of file
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <nlohmann/json.hpp>
+
+/**
+ * @brief Pixel layout of the image payload that follows a FrameHeader.
+ */
+enum class PixelFormat : uint8_t {
+    UNKNOWN = 0,
+    GRAY8   = 1,    // single channel, 8 bit
+    GRAY16  = 2,    // single channel, 16 bit little endian
+    BGR8    = 3,    // packed 3 channel, 8 bit
+    BGRA8   = 4,    // packed 4 channel, 8 bit
+};
+
+// "CDF1" when read as little endian bytes. Used to tell binary headers apart from
+// legacy JSON metadata frames, which always start with '{'.
+constexpr uint32_t FRAME_HEADER_MAGIC = 0x31464443;
+constexpr uint16_t FRAME_HEADER_VERSION = 1;
+
+// FrameHeader::flags
+constexpr uint8_t FRAME_FLAG_SHM = 0x01;   // payload is a ShmSlotDescriptor, not pixels
+
+/**
+ * @brief Fixed layout metadata frame sent between the topic and the image payload.
+ *
+ * Every image stream is published as a three part message:
+ *   1. topic
+ *   2. FrameHeader (this struct, raw bytes)
+ *   3. image payload
+ *
+ * The layout is packed and naturally aligned so it can be memcpy'd straight in and out
+ * of a zmq message. All fields are host (little endian) byte order. New fields must only
+ * ever be appended; readers use header_size to skip fields they do not know about.
+ */
+#pragma pack(push, 1)
+struct FrameHeader {
+    uint32_t magic = FRAME_HEADER_MAGIC;
+    uint16_t version = FRAME_HEADER_VERSION;
+    uint16_t header_size = 0;       // sizeof(FrameHeader) of the writer
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint8_t channels = 0;
+    uint8_t bit_depth = 0;
+    uint8_t pixel_format = static_cast<uint8_t>(PixelFormat::UNKNOWN);
+    uint8_t flags = 0;
+    uint32_t reserved = 0;
+    uint64_t device_timestamp = 0;  // device clock, microseconds
+    int64_t source_ts = 0;          // wall clock at capture, milliseconds since epoch
+    uint64_t sequence = 0;          // per stream frame counter
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FrameHeader) == 48, "FrameHeader layout changed - bump FRAME_HEADER_VERSION");
+
+/**
+ * Writes the header into a caller provided buffer.
+ *
+ * @param header the header to encode
+ * @param dst destination buffer, at least sizeof(FrameHeader) bytes
+ * @param dst_size size of the destination buffer
+ * @return the number of bytes written, or 0 if the buffer is too small
+ */
+inline size_t encode_frame_header(const FrameHeader& header, void* dst, size_t dst_size) {
+    if (dst_size < sizeof(FrameHeader)) {
+        return 0;
+    }
+    FrameHeader out = header;
+    out.magic = FRAME_HEADER_MAGIC;
+    out.version = FRAME_HEADER_VERSION;
+    out.header_size = sizeof(FrameHeader);
+    std::memcpy(dst, &out, sizeof(FrameHeader));
+    return sizeof(FrameHeader);
+}
+
+/**
+ * Returns true if the buffer holds a binary FrameHeader (as opposed to legacy JSON).
+ */
+inline bool is_binary_frame_header(const void* data, size_t size) {
+    if (size < sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t magic;
+    std::memcpy(&magic, data, sizeof(magic));
+    return magic == FRAME_HEADER_MAGIC;
+}
+
+/**
+ * Reads a binary FrameHeader out of a buffer without allocating.
+ *
+ * Headers written by newer versions are accepted as long as they are at least as large
+ * as ours; the extra trailing fields are ignored.
+ *
+ * @return true if the buffer holds a valid binary header
+ */
+inline bool decode_frame_header(const void* data, size_t size, FrameHeader& header) {
+    if (!is_binary_frame_header(data, size) || size < sizeof(FrameHeader)) {
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(FrameHeader));
+    return header.header_size >= sizeof(FrameHeader) && header.header_size <= size;
+}
+
+/**
+ * Decodes frame metadata in either the binary or the legacy JSON form.
+ *
+ * The JSON path exists only so that subscribers keep working against producers that
+ * have not been migrated yet; it allocates and is much slower than the binary path.
+ *
+ * @return true if the metadata could be decoded
+ */
+inline bool decode_frame_metadata(const void* data, size_t size, FrameHeader& header) {
+    if (is_binary_frame_header(data, size)) {
+        return decode_frame_header(data, size, header);
+    }
+    if (size == 0 || static_cast<const char*>(data)[0] != '{') {
+        return false;
+    }
+
+    auto metadata = nlohmann::json::parse(static_cast<const char*>(data),
+                                          static_cast<const char*>(data) + size, nullptr, false);
+    if (metadata.is_discarded() || !metadata.contains("width") || !metadata.contains("height")) {
+        return false;
+    }
+
+    header = FrameHeader();
+    header.header_size = sizeof(FrameHeader);
+    header.width = metadata["width"].get<uint32_t>();
+    header.height = metadata["height"].get<uint32_t>();
+    header.channels = metadata.value("channels", 1);
+    header.bit_depth = metadata.value("bit_depth", 8);
+    header.device_timestamp = metadata.value("device_timestamp", uint64_t(0));
+    header.source_ts = metadata.value("source_ts", int64_t(0));
+    header.sequence = metadata.value("sequence", uint64_t(0));
+
+    PixelFormat format = PixelFormat::UNKNOWN;
+    if (header.channels == 1) {
+        format = header.bit_depth == 16 ? PixelFormat::GRAY16 : PixelFormat::GRAY8;
+    } else if (header.channels == 3) {
+        format = PixelFormat::BGR8;
+    } else if (header.channels == 4) {
+        format = PixelFormat::BGRA8;
+    }
+    header.pixel_format = static_cast<uint8_t>(format);
+    return true;
+}
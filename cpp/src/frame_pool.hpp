@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <zmq.hpp>
+
+#include "pipeline.hpp"
+
+class FramePool;
+
+/**
+ * @brief One buffer borrowed from a FramePool.
+ *
+ * Move only. The buffer goes back to the pool when the handle is destroyed, or, once handed
+ * to zmq with to_message(), when zmq releases the message.
+ */
+class FrameBuffer {
+    public:
+        FrameBuffer() = default;
+        FrameBuffer(FrameBuffer&& other) noexcept { swap(other); }
+        FrameBuffer& operator=(FrameBuffer&& other) noexcept {
+            FrameBuffer(std::move(other)).swap(*this);
+            return *this;
+        }
+        FrameBuffer(const FrameBuffer&) = delete;
+        FrameBuffer& operator=(const FrameBuffer&) = delete;
+        inline ~FrameBuffer();
+
+        explicit operator bool() const { return m_data != nullptr; }
+        uint8_t* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+        /**
+         * Wraps the buffer in a zmq message without copying. The handle is left empty.
+         */
+        inline zmq::message_t to_message();
+
+    private:
+        friend class FramePool;
+
+        void swap(FrameBuffer& other) noexcept {
+            std::swap(m_slot, other.m_slot);
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+        }
+
+        void* m_slot = nullptr;
+        uint8_t* m_data = nullptr;
+        size_t m_size = 0;
+};
+
+/**
+ * @brief Fixed set of equally sized frame buffers, allocated once up front.
+ *
+ * Lets the per-frame path fill and publish frames without touching the heap: acquire() pops
+ * a free buffer and the buffer is pushed back from the zmq free callback (which runs on the
+ * zmq I/O thread) or from the handle's destructor. The free list is a HandoffQueue, which is
+ * safe for any number of producers and consumers.
+ *
+ * The backing memory is reference counted by the pool and by every outstanding buffer, so
+ * messages still queued in zmq when the pool is destroyed stay valid until they are sent.
+ */
+class FramePool {
+    public:
+        FramePool(size_t buffer_count, size_t buffer_size) : m_storage(new Storage(buffer_count, buffer_size)) {}
+
+        ~FramePool() { m_storage->unref(); }
+
+        FramePool(const FramePool&) = delete;
+        FramePool& operator=(const FramePool&) = delete;
+
+        /**
+         * Borrows a buffer for a frame of `size` bytes.
+         *
+         * @return an empty handle if size exceeds buffer_size() or every buffer is in use
+         */
+        FrameBuffer acquire(size_t size) {
+            FrameBuffer buffer;
+            uint32_t index;
+            if (size > m_storage->buffer_size || !m_storage->free_list.try_pop(index)) {
+                m_storage->misses.fetch_add(1, std::memory_order_relaxed);
+                return buffer;
+            }
+            m_storage->refs.fetch_add(1, std::memory_order_relaxed);
+            Slot& slot = m_storage->slots[index];
+            buffer.m_slot = &slot;
+            buffer.m_data = slot.data;
+            buffer.m_size = size;
+            return buffer;
+        }
+
+        size_t buffer_count() const { return m_storage->slots.size(); }
+        size_t buffer_size() const { return m_storage->buffer_size; }
+
+        /**
+         * Number of acquire() calls that came back empty.
+         */
+        uint64_t misses() const { return m_storage->misses.load(std::memory_order_relaxed); }
+
+    private:
+        friend class FrameBuffer;
+
+        struct Storage;
+
+        struct Slot {
+            Storage* storage;
+            uint32_t index;
+            uint8_t* data;
+        };
+
+        struct Storage {
+            Storage(size_t count, size_t size) : buffer_size(size), free_list(count) {
+                size_t stride = (size + 63) & ~size_t(63);
+                memory = static_cast<uint8_t*>(std::aligned_alloc(64, stride * count));
+                if (memory == nullptr) {
+                    throw std::bad_alloc();
+                }
+                slots.reserve(count);
+                for (size_t i = 0; i < count; i++) {
+                    slots.push_back({this, static_cast<uint32_t>(i), memory + i * stride});
+                    free_list.try_push(static_cast<uint32_t>(i));
+                }
+            }
+
+            ~Storage() { std::free(memory); }
+
+            void unref() {
+                if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    delete this;
+                }
+            }
+
+            const size_t buffer_size;
+            uint8_t* memory = nullptr;
+            std::vector<Slot> slots;
+            HandoffQueue<uint32_t> free_list;
+            std::atomic<size_t> refs{1};   // the pool itself plus one per outstanding buffer
+            std::atomic<uint64_t> misses{0};
+        };
+
+        static void release(void* slot_ptr) {
+            Slot* slot = static_cast<Slot*>(slot_ptr);
+            Storage* storage = slot->storage;
+            storage->free_list.try_push(uint32_t(slot->index));
+            storage->unref();
+        }
+
+        static void release_message(void* /*data*/, void* hint) {
+            release(hint);
+        }
+
+        Storage* m_storage;
+};
+
+inline FrameBuffer::~FrameBuffer() {
+    if (m_slot != nullptr) {
+        FramePool::release(m_slot);
+    }
+}
+
+inline zmq::message_t FrameBuffer::to_message() {
+    zmq::message_t msg(m_data, m_size, &FramePool::release_message, m_slot);
+    m_slot = nullptr;
+    m_data = nullptr;
+    m_size = 0;
+    return msg;
+}
@@ -7,57 +7,86 @@ using json = nlohmann::json;
 class ImageViewer : public GenericNode {
 public:
     ImageViewer() : GenericNode("ImageViewer", "ImageViewer", "127.0.0.1", "127.0.0.1") {
-        // Optionally, name your window
-        cv::namedWindow("Image Viewer", cv::WINDOW_AUTOSIZE);
-        socket_ = setup_subscriber("/KinectFrameProducer/KinectFrameProducer/kinect");
+        // One window per camera, whatever the cameras are called. The subscriptions follow
+        // a camera producer across restarts, so its window just picks up again.
+        while (cameras_.empty()) {
+            cameras_ = subscribe_matching("/KinectFrameProducer/*/kinect");
+            if (cameras_.empty()) {
+                LOG_WARNING(m_logger, "No cameras registered yet. Retrying...");
+                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+            }
+        }
+        for (const auto& camera : cameras_) {
+            cv::namedWindow(camera->topic(), cv::WINDOW_AUTOSIZE);
+        }
     }
 
     void run() {
+        ReceivedFrame frame;
+        vector<zmq::pollitem_t> items;
+        for (const auto& camera : cameras_) {
+            items.push_back({ camera->socket(), 0, ZMQ_POLLIN, 0 });
+        }
         while (true) {
-            zmq::message_t topic_msg;
-            zmq::message_t metadata_msg;
-            zmq::message_t image_msg;
-
-            // Receive topic
-            if (!socket_->recv(topic_msg, zmq::recv_flags::none)) {
-                cout<<"no topic"<<endl;
-                LOG_ERROR(m_logger, "Failed to receive topic");
-                continue;
+            zmq::poll(items.data(), items.size(), std::chrono::milliseconds(100));
+            for (size_t i = 0; i < items.size(); i++) {
+                if (items[i].revents & ZMQ_POLLIN) {
+                    show_frame(*cameras_[i], frame);
+                } else {
+                    // A restarted camera sends nothing to the old endpoint
+                    cameras_[i]->refresh();
+                }
             }
-            std::string topic(static_cast<char*>(topic_msg.data()), topic_msg.size());
+            cv::waitKey(1);
+        }
 
-            //Receive metadata
-            if (!socket_->recv(metadata_msg, zmq::recv_flags::none)) {
-                cout<<"no metadata"<<endl;
-                LOG_ERROR(m_logger, "Failed to receive metadata");
-                continue;
-            }
-            std::string msg_str(static_cast<char*>(metadata_msg.data()), metadata_msg.size());
-            json metadata = json::parse(msg_str);
+        cv::destroyAllWindows();
+    }
 
-            // Receive image buffer
-            if (!socket_->recv(image_msg, zmq::recv_flags::none)) {
-                cout<<"no image"<<endl;
-                LOG_ERROR(m_logger, "Failed to receive image");
-                continue;
-            }
+private:
+    void show_frame(Subscription& camera, ReceivedFrame& frame) {
+        // Receive topic, metadata and image buffer
+        if (!recv_frame(camera, frame)) {
+            cout<<"bad frame"<<endl;
+            return;
+        }
 
-            cv::Mat img(metadata["height"], metadata["width"], CV_8UC1, image_msg.data());
-            if (img.empty()) {
-                cout<<"bad buffer"<<endl;
-                LOG_ERROR(m_logger, "Failed to decode buffer");
-                continue;
-            }
+        int type = -1;
+        size_t pixel_bytes = 0;
+        switch (static_cast<PixelFormat>(frame.header.pixel_format)) {
+            case PixelFormat::GRAY8:  type = CV_8UC1;  pixel_bytes = 1; break;
+            case PixelFormat::GRAY16: type = CV_16UC1; pixel_bytes = 2; break;
+            case PixelFormat::BGR8:   type = CV_8UC3;  pixel_bytes = 3; break;
+            case PixelFormat::BGRA8:  type = CV_8UC4;  pixel_bytes = 4; break;
+            default: break;
+        }
+        if (type < 0) {
+            LOG_WARNING(m_logger, "Skipping frame {} of {} with unknown pixel format {}", frame.header.sequence,
+                        camera.topic(), frame.header.pixel_format);
+            return;
+        }
+        // Never wrap more bytes than arrived, whatever the header claims
+        size_t expected = static_cast<size_t>(frame.header.width) * frame.header.height * pixel_bytes;
+        if (frame.size < expected) {
+            LOG_WARNING(m_logger, "Skipping frame {} of {}: {} bytes for {}x{}, expected {}", frame.header.sequence,
+                        camera.topic(), frame.size, frame.header.width, frame.header.height, expected);
+            return;
+        }
 
-            cv::imshow("Image Viewer", img);  // Display image
-            cv::waitKey(1);
+        cv::Mat img(frame.header.height, frame.header.width, type, const_cast<void*>(frame.data));
+        if (img.empty()) {
+            cout<<"bad buffer"<<endl;
+            LOG_ERROR(m_logger, "Failed to decode buffer");
+            return;
         }
 
-        cv::destroyAllWindows();
+        cv::imshow(camera.topic(), img);  // Display image
+        if (!frame.is_valid()) {
+            LOG_WARNING(m_logger, "Frame {} was overwritten while it was displayed", frame.header.sequence);
+        }
     }
 
-private:
-    unique_ptr<zmq::socket_t> socket_;
+    vector<shared_ptr<Subscription>> cameras_;
 };
 
 int main() {
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "frame_source.hpp"
+
+/**
+ * @brief FrameSource that replays images from a directory, in a loop, at a fixed rate.
+ *
+ * The directory holds 16 bit single channel IR images named `ir_*.png` and, optionally,
+ * color images named `color_*.png` or `color_*.jpg`, paired by sorted file name. Everything
+ * is decoded up front so disk and codec time does not show up in pipeline measurements;
+ * each frame is then copied into a pool buffer, the way the device DMAs into SDK buffers.
+ */
+class FileFrameSource : public FrameSource {
+    public:
+        /**
+         * @throws std::runtime_error if the directory has no usable IR images
+         */
+        FileFrameSource(const std::string& directory, int fps) : m_pacer(fps) {
+            std::vector<std::string> ir_files = list(directory, "ir_");
+            std::vector<std::string> color_files = list(directory, "color_");
+            if (ir_files.empty()) {
+                throw std::runtime_error("No ir_*.png images in " + directory);
+            }
+
+            for (const std::string& file : ir_files) {
+                cv::Mat ir = cv::imread(file, cv::IMREAD_UNCHANGED);
+                if (ir.type() != CV_16UC1) {
+                    throw std::runtime_error(file + " is not a 16 bit single channel image");
+                }
+                if (!m_ir.empty() && ir.size() != m_ir.front().size()) {
+                    throw std::runtime_error(file + " does not match the size of the first IR image");
+                }
+                m_ir.push_back(ir);
+            }
+            for (size_t i = 0; i < color_files.size() && i < ir_files.size(); i++) {
+                cv::Mat color = cv::imread(color_files[i], cv::IMREAD_UNCHANGED);
+                if (color.type() == CV_8UC3) {
+                    cv::cvtColor(color, color, cv::COLOR_BGR2BGRA);
+                }
+                if (color.type() != CV_8UC4) {
+                    throw std::runtime_error(color_files[i] + " is not an 8 bit BGR or BGRA image");
+                }
+                if (!m_color.empty() && color.size() != m_color.front().size()) {
+                    throw std::runtime_error(color_files[i] + " does not match the size of the first color image");
+                }
+                m_color.push_back(color);
+            }
+            // Pair every IR frame with a color frame, or none at all
+            if (m_color.size() < m_ir.size()) {
+                m_color.clear();
+            }
+
+            m_geometry.ir_width = m_ir.front().cols;
+            m_geometry.ir_height = m_ir.front().rows;
+            if (!m_color.empty()) {
+                m_geometry.color_width = m_color.front().cols;
+                m_geometry.color_height = m_color.front().rows;
+            }
+            m_geometry.fps = fps;
+
+            m_ir_pool = std::make_unique<FramePool>(SOURCE_POOL_SIZE, m_ir.front().total() * m_ir.front().elemSize());
+            if (!m_color.empty()) {
+                m_color_pool = std::make_unique<FramePool>(SOURCE_POOL_SIZE, m_color.front().total() * m_color.front().elemSize());
+            }
+        }
+
+        std::string name() const override { return "file"; }
+        SourceGeometry geometry() const override { return m_geometry; }
+
+        /**
+         * Number of distinct frames loaded.
+         */
+        size_t frame_count() const { return m_ir.size(); }
+
+        bool get_capture(SourceCapture& capture, std::chrono::milliseconds timeout) override {
+            if (!m_pacer.wait(timeout)) {
+                return false;
+            }
+            uint64_t device_timestamp = m_pacer.device_timestamp();
+            size_t index = (m_pacer.frames() - 1) % m_ir.size();
+            capture.ir = load(*m_ir_pool, m_ir[index], device_timestamp);
+            if (m_color_pool) {
+                capture.color = load(*m_color_pool, m_color[index], device_timestamp);
+            }
+            return true;
+        }
+
+    private:
+        static constexpr size_t SOURCE_POOL_SIZE = 16;
+
+        static std::vector<std::string> list(const std::string& directory, const std::string& prefix) {
+            std::vector<std::string> files;
+            for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+                std::string name = entry.path().filename().string();
+                std::string ext = entry.path().extension().string();
+                if (entry.is_regular_file() && name.rfind(prefix, 0) == 0 && (ext == ".png" || ext == ".jpg")) {
+                    files.push_back(entry.path().string());
+                }
+            }
+            std::sort(files.begin(), files.end());
+            return files;
+        }
+
+        static SourceImage load(FramePool& pool, const cv::Mat& image, uint64_t device_timestamp) {
+            FrameBuffer buffer = pool.acquire(image.total() * image.elemSize());
+            if (!buffer) {
+                throw FrameSourceError("File source frame pool exhausted");
+            }
+            std::memcpy(buffer.data(), image.data, buffer.size());
+            return SourceImage(std::move(buffer), image.cols, image.rows, static_cast<int>(image.step), device_timestamp);
+        }
+
+        FramePacer m_pacer;
+        SourceGeometry m_geometry;
+        std::vector<cv::Mat> m_ir;
+        std::vector<cv::Mat> m_color;
+        std::unique_ptr<FramePool> m_ir_pool;
+        std::unique_ptr<FramePool> m_color_pool;
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <zmq.hpp>
+
+#include "../frame_pool.hpp"
+
+/**
+ * @brief Thrown by FrameSource::get_capture for a failed read the caller may retry.
+ */
+struct FrameSourceError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief One image of a capture, independent of where its pixels live.
+ *
+ * Either owns a FramePool buffer or holds a reference on an external buffer (for example
+ * an SDK image) together with the function that drops that reference. Move only; the
+ * pixels can be handed to zmq without copying with to_message().
+ */
+class SourceImage {
+    public:
+        SourceImage() = default;
+
+        /**
+         * Wraps a pool buffer the source has filled.
+         */
+        SourceImage(FrameBuffer buffer, int width, int height, int stride, uint64_t device_timestamp)
+            : m_buffer(std::move(buffer)), m_width(width), m_height(height), m_stride(stride),
+              m_device_timestamp(device_timestamp) {
+            m_data = m_buffer.data();
+            m_size = m_buffer.size();
+        }
+
+        /**
+         * Wraps an external buffer. `release(data, handle)` is called exactly once, either
+         * when this image is destroyed or, after to_message(), when zmq is done with it.
+         */
+        SourceImage(uint8_t* data, size_t size, int width, int height, int stride, uint64_t device_timestamp,
+                    zmq::free_fn* release, void* handle)
+            : m_data(data), m_size(size), m_width(width), m_height(height), m_stride(stride),
+              m_device_timestamp(device_timestamp), m_release(release), m_handle(handle) {}
+
+        SourceImage(SourceImage&& other) noexcept { swap(other); }
+        SourceImage& operator=(SourceImage&& other) noexcept {
+            SourceImage(std::move(other)).swap(*this);
+            return *this;
+        }
+        SourceImage(const SourceImage&) = delete;
+        SourceImage& operator=(const SourceImage&) = delete;
+
+        ~SourceImage() {
+            if (m_release != nullptr) {
+                m_release(m_data, m_handle);
+            }
+        }
+
+        explicit operator bool() const { return m_data != nullptr; }
+        const uint8_t* data() const { return m_data; }
+        size_t size() const { return m_size; }
+        int width() const { return m_width; }
+        int height() const { return m_height; }
+        int stride() const { return m_stride; }
+        uint64_t device_timestamp() const { return m_device_timestamp; }
+
+        /**
+         * Hands the pixels to zmq without copying. The image is left empty.
+         */
+        zmq::message_t to_message() {
+            zmq::message_t msg;
+            if (m_buffer) {
+                msg = m_buffer.to_message();
+            } else {
+                msg = zmq::message_t(m_data, m_size, m_release, m_handle);
+                m_release = nullptr;
+            }
+            SourceImage().swap(*this);
+            return msg;
+        }
+
+    private:
+        void swap(SourceImage& other) noexcept {
+            std::swap(m_buffer, other.m_buffer);
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+            std::swap(m_width, other.m_width);
+            std::swap(m_height, other.m_height);
+            std::swap(m_stride, other.m_stride);
+            std::swap(m_device_timestamp, other.m_device_timestamp);
+            std::swap(m_release, other.m_release);
+            std::swap(m_handle, other.m_handle);
+        }
+
+        FrameBuffer m_buffer;
+        uint8_t* m_data = nullptr;
+        size_t m_size = 0;
+        int m_width = 0;
+        int m_height = 0;
+        int m_stride = 0;
+        uint64_t m_device_timestamp = 0;   // microseconds
+        zmq::free_fn* m_release = nullptr;
+        void* m_handle = nullptr;
+};
+
+/**
+ * @brief Images captured together. `ir` is 16 bit single channel, `color` is BGRA and may
+ * be empty.
+ */
+struct SourceCapture {
+    SourceImage ir;
+    SourceImage color;
+};
+
+/**
+ * @brief Largest images a source will produce, used to size the frame pools.
+ */
+struct SourceGeometry {
+    int ir_width = 0;
+    int ir_height = 0;
+    int color_width = 0;
+    int color_height = 0;
+    int fps = 0;
+};
+
+/**
+ * @brief Where the Kinect producer pipeline gets its captures from.
+ *
+ * Implemented by the Azure Kinect device (K4aFrameSource) and by hardware free sources
+ * (SyntheticFrameSource, FileFrameSource) so the processing and publishing stages can be
+ * run and profiled without a camera. A source is streaming once constructed and is only
+ * ever read from the capture thread.
+ */
+class FrameSource {
+    public:
+        virtual ~FrameSource() = default;
+
+        virtual std::string name() const = 0;
+        virtual SourceGeometry geometry() const = 0;
+
+        /**
+         * Waits for the next capture.
+         *
+         * @return false if the timeout expired first
+         * @throws FrameSourceError if the read failed but the source is still usable
+         */
+        virtual bool get_capture(SourceCapture& capture, std::chrono::milliseconds timeout) = 0;
+};
+
+/**
+ * @brief Releases frames at a fixed rate for sources that are not clocked by hardware.
+ *
+ * If the reader falls more than a frame behind, the missed frames are skipped rather than
+ * released back to back, the same as a camera overwriting frames nobody read.
+ */
+class FramePacer {
+    public:
+        /**
+         * @throws std::invalid_argument if fps is not positive
+         */
+        explicit FramePacer(int fps) : m_period(period(fps)) {}
+
+        /**
+         * Sleeps until the next frame is due.
+         *
+         * @return false if it is not due within timeout
+         */
+        bool wait(std::chrono::milliseconds timeout) {
+            auto now = std::chrono::steady_clock::now();
+            if (m_frames == 0) {
+                m_start = now;
+            }
+            if (m_frames == 0 || now - m_next > m_period) {
+                m_next = now;
+            }
+            if (m_next - now > timeout) {
+                std::this_thread::sleep_for(timeout);
+                return false;
+            }
+            std::this_thread::sleep_until(m_next);
+            m_released = m_next;
+            m_next += m_period;
+            m_frames++;
+            return true;
+        }
+
+        /**
+         * Stand-in device clock for the frame just released, in microseconds since the first.
+         */
+        uint64_t device_timestamp() const {
+            return std::chrono::duration_cast<std::chrono::microseconds>(m_released - m_start).count();
+        }
+
+        /**
+         * Number of frames released so far.
+         */
+        uint64_t frames() const { return m_frames; }
+
+    private:
+        static std::chrono::steady_clock::duration period(int fps) {
+            if (fps <= 0) {
+                throw std::invalid_argument("Frame rate must be positive");
+            }
+            return std::chrono::nanoseconds(1000000000 / fps);
+        }
+
+        std::chrono::steady_clock::duration m_period;
+        std::chrono::steady_clock::time_point m_start;
+        std::chrono::steady_clock::time_point m_next;
+        std::chrono::steady_clock::time_point m_released;
+        uint64_t m_frames = 0;
+};
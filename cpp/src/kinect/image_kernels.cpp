@@ -0,0 +1,198 @@
+#include "image_kernels.hpp"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_KERNELS_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define IMAGE_KERNELS_NEON 1
+#endif
+
+namespace {
+
+inline uint8_t truncate_scale_pixel(uint16_t v, uint16_t truncate, float scale) {
+    float f = static_cast<float>(v < truncate ? v : truncate) * scale;
+    long r = std::lrintf(f);  // round half to even, same as cvRound
+    return static_cast<uint8_t>(r < 0 ? 0 : (r > 255 ? 255 : r));
+}
+
+inline void bgra_to_bgr_tail(const uint8_t* src, uint8_t* dst, size_t begin, size_t pixels) {
+    for (size_t i = begin; i < pixels; i++) {
+        dst[i * 3 + 0] = src[i * 4 + 0];
+        dst[i * 3 + 1] = src[i * 4 + 1];
+        dst[i * 3 + 2] = src[i * 4 + 2];
+    }
+}
+
+#if IMAGE_KERNELS_X86
+
+__attribute__((target("avx2")))
+void ir_truncate_scale_avx2(const uint16_t* src, uint8_t* dst, size_t count, uint16_t truncate, float scale) {
+    const __m256i vtrunc = _mm256_set1_epi16(static_cast<short>(truncate));
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        v = _mm256_min_epu16(v, vtrunc);
+
+        // Widen to 32 bit within each 128 bit lane, scale in float, round back
+        __m256i lo = _mm256_unpacklo_epi16(v, zero);
+        __m256i hi = _mm256_unpackhi_epi16(v, zero);
+        lo = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), vscale));
+        hi = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), vscale));
+
+        // The per lane pack undoes the per lane unpack, so pixel order is preserved
+        __m256i packed = _mm256_packus_epi32(lo, hi);
+        __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), bytes);
+    }
+    for (; i < count; i++) {
+        dst[i] = truncate_scale_pixel(src[i], truncate, scale);
+    }
+}
+
+__attribute__((target("sse4.1")))
+void ir_truncate_scale_sse41(const uint16_t* src, uint8_t* dst, size_t count, uint16_t truncate, float scale) {
+    const __m128i vtrunc = _mm_set1_epi16(static_cast<short>(truncate));
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        v = _mm_min_epu16(v, vtrunc);
+
+        __m128i lo = _mm_unpacklo_epi16(v, zero);
+        __m128i hi = _mm_unpackhi_epi16(v, zero);
+        lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+        hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+
+        __m128i packed = _mm_packus_epi32(lo, hi);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(packed, packed));
+    }
+    for (; i < count; i++) {
+        dst[i] = truncate_scale_pixel(src[i], truncate, scale);
+    }
+}
+
+// The vector loops below store a full register per step but only advance by the bytes that
+// hold BGR data; the few trailing bytes of garbage are overwritten by the next step. The
+// loop bounds leave enough pixels at the end that no store runs past dst.
+
+__attribute__((target("avx2")))
+void bgra_to_bgr_avx2(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    const __m256i drop_alpha = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+    size_t i = 0;
+    for (; i + 11 <= pixels; i += 8) {  // 32 byte store, 24 useful
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, drop_alpha), compact);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 3), v);
+    }
+    bgra_to_bgr_tail(src, dst, i, pixels);
+}
+
+__attribute__((target("ssse3")))
+void bgra_to_bgr_ssse3(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    const __m128i drop_alpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    size_t i = 0;
+    for (; i + 6 <= pixels; i += 4) {  // 16 byte store, 12 useful
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(v, drop_alpha));
+    }
+    bgra_to_bgr_tail(src, dst, i, pixels);
+}
+
+#endif
+
+#if IMAGE_KERNELS_NEON
+
+void ir_truncate_scale_neon(const uint16_t* src, uint8_t* dst, size_t count, uint16_t truncate, float scale) {
+    const uint16x8_t vtrunc = vdupq_n_u16(truncate);
+    const float32x4_t vscale = vdupq_n_f32(scale);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t v = vminq_u16(vld1q_u16(src + i), vtrunc);
+        float32x4_t lo = vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))), vscale);
+        float32x4_t hi = vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))), vscale);
+        uint16x8_t narrowed = vcombine_u16(vqmovn_u32(vcvtnq_u32_f32(lo)), vqmovn_u32(vcvtnq_u32_f32(hi)));
+        vst1_u8(dst + i, vqmovn_u16(narrowed));
+    }
+    for (; i < count; i++) {
+        dst[i] = truncate_scale_pixel(src[i], truncate, scale);
+    }
+}
+
+void bgra_to_bgr_neon(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x4_t bgra = vld4q_u8(src + i * 4);
+        uint8x16x3_t bgr = {{bgra.val[0], bgra.val[1], bgra.val[2]}};
+        vst3q_u8(dst + i * 3, bgr);
+    }
+    bgra_to_bgr_tail(src, dst, i, pixels);
+}
+
+#endif
+
+using TruncateScaleFn = void (*)(const uint16_t*, uint8_t*, size_t, uint16_t, float);
+using BgraToBgrFn = void (*)(const uint8_t*, uint8_t*, size_t);
+
+struct Dispatch {
+    TruncateScaleFn truncate_scale;
+    BgraToBgrFn bgra_to_bgr;
+    const char* isa;
+};
+
+Dispatch select_kernels() {
+#if IMAGE_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {ir_truncate_scale_avx2, bgra_to_bgr_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return {ir_truncate_scale_sse41, bgra_to_bgr_ssse3, "sse4.1"};
+    }
+#elif IMAGE_KERNELS_NEON
+    return {ir_truncate_scale_neon, bgra_to_bgr_neon, "neon"};
+#endif
+    return {ir_truncate_scale_u16_to_u8_scalar, bgra_to_bgr_scalar, "scalar"};
+}
+
+const Dispatch& kernels() {
+    static const Dispatch dispatch = select_kernels();
+    return dispatch;
+}
+
+} // namespace
+
+void ir_truncate_scale_u16_to_u8_scalar(const uint16_t* src, uint8_t* dst, size_t count, uint16_t truncate, float scale) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = truncate_scale_pixel(src[i], truncate, scale);
+    }
+}
+
+void ir_truncate_scale_u16_to_u8(const uint16_t* src, uint8_t* dst, size_t count, uint16_t truncate, float scale) {
+    kernels().truncate_scale(src, dst, count, truncate, scale);
+}
+
+void bgra_to_bgr_scalar(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    bgra_to_bgr_tail(src, dst, 0, pixels);
+}
+
+void bgra_to_bgr(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    kernels().bgra_to_bgr(src, dst, pixels);
+}
+
+const char* image_kernels_isa() {
+    return kernels().isa;
+}
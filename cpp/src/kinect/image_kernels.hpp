@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Fused IR truncate, scale and narrow to 8 bit:
+ *
+ *     dst[i] = saturate_u8(round(min(src[i], truncate) * scale))
+ *
+ * Equivalent to cv::threshold(THRESH_TRUNC) followed by convertTo(CV_8UC1, scale), but in
+ * a single pass with no temporary. The implementation (AVX2, SSE4.1, NEON or scalar) is
+ * picked once at runtime from what the CPU supports.
+ *
+ * @param src 16 bit input pixels
+ * @param dst caller provided output, at least count bytes
+ * @param count number of pixels
+ * @param truncate values above this are clamped to it before scaling
+ * @param scale multiplier applied after truncation, usually 255 / truncate
+ */
+void ir_truncate_scale_u16_to_u8(const uint16_t* src, uint8_t* dst, size_t count, uint16_t truncate, float scale);
+
+/**
+ * Portable reference version of ir_truncate_scale_u16_to_u8, for benchmarks and checks.
+ */
+void ir_truncate_scale_u16_to_u8_scalar(const uint16_t* src, uint8_t* dst, size_t count, uint16_t truncate, float scale);
+
+/**
+ * Drops the alpha channel of packed BGRA pixels, writing packed BGR.
+ *
+ * Meant to write straight into the memory of an outgoing message (or shared memory slot) so
+ * the converted frame is never copied again. Dispatched like ir_truncate_scale_u16_to_u8.
+ *
+ * @param src BGRA input, 4 * pixels bytes
+ * @param dst BGR output, 3 * pixels bytes, must not overlap src
+ * @param pixels number of pixels
+ */
+void bgra_to_bgr(const uint8_t* src, uint8_t* dst, size_t pixels);
+
+/**
+ * Portable reference version of bgra_to_bgr.
+ */
+void bgra_to_bgr_scalar(const uint8_t* src, uint8_t* dst, size_t pixels);
+
+/**
+ * Name of the instruction set the kernels dispatched to.
+ */
+const char* image_kernels_isa();
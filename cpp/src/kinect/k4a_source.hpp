@@ -0,0 +1,122 @@
+#pragma once
+
+#include <k4a/k4a.hpp>
+#include <quill/LogMacros.h>
+#include <quill/Logger.h>
+
+#include "frame_source.hpp"
+
+/**
+ * @brief FrameSource backed by an Azure Kinect device.
+ *
+ * Images are passed on zero copy: each SourceImage holds its own reference on the SDK
+ * image, released when the image (or the zmq message it was turned into) is done.
+ */
+class K4aFrameSource : public FrameSource {
+    public:
+        /**
+         * Opens the device and starts its cameras.
+         *
+         * @param device_index index of the device to open
+         * @param fps 5, 15 or 30
+         * @param master run as wired sync master instead of standalone
+         * @throws std::runtime_error if the device could not be opened or started
+         */
+        K4aFrameSource(uint32_t device_index, int fps, bool master, quill::Logger* logger) : m_logger(logger) {
+            k4a_device_configuration_t config = {
+                K4A_IMAGE_FORMAT_COLOR_BGRA32,                 // color_format
+                K4A_COLOR_RESOLUTION_720P,                     // color_resolution
+                K4A_DEPTH_MODE_WFOV_2X2BINNED,                  // depth_mode
+                K4A_FRAMES_PER_SECOND_30,                      // camera_fps
+                true,                                          // synchronized_images_only
+                0,                                             // depth_delay_off_color_usec
+                K4A_WIRED_SYNC_MODE_STANDALONE,                // wired_sync_mode
+                0,                                             // subordinate delay off master usec
+            };
+            if (fps == 5) {
+                config.camera_fps = K4A_FRAMES_PER_SECOND_5;
+            } else if (fps == 15) {
+                config.camera_fps = K4A_FRAMES_PER_SECOND_15;
+            } else if (fps != 30) {
+                throw std::runtime_error("Azure Kinect supports 5, 15 or 30 fps, not " + std::to_string(fps));
+            }
+            if (master)
+                config.wired_sync_mode = K4A_WIRED_SYNC_MODE_MASTER;
+            else
+                config.wired_sync_mode = K4A_WIRED_SYNC_MODE_STANDALONE;
+
+            // Log device configuration
+            LOG_INFO(m_logger, "Device configuration:");
+            LOG_INFO(m_logger, "  depth_mode: {}", static_cast<int>(config.depth_mode));
+            LOG_INFO(m_logger, "  camera_fps: {}", static_cast<int>(config.camera_fps));
+            LOG_INFO(m_logger, "  wired_sync_mode: {}", static_cast<int>(config.wired_sync_mode));
+
+            // Open the device
+            LOG_INFO(m_logger, "Opening K4A device {}", device_index);
+            try {
+                m_device = k4a::device::open(device_index);
+
+                // Start cameras
+                m_device.start_cameras(&config);
+
+                k4a::calibration calibration = m_device.get_calibration(config.depth_mode, config.color_resolution);
+                m_geometry.ir_width = calibration.depth_camera_calibration.resolution_width;
+                m_geometry.ir_height = calibration.depth_camera_calibration.resolution_height;
+                m_geometry.color_width = calibration.color_camera_calibration.resolution_width;
+                m_geometry.color_height = calibration.color_camera_calibration.resolution_height;
+                m_geometry.fps = fps;
+            } catch (const k4a::error& e) {
+                throw std::runtime_error(std::string("Error: K4A device setup failed: ") + e.what());
+            }
+        }
+
+        ~K4aFrameSource() override {
+            try {
+                LOG_INFO(m_logger, "Closing device...");
+                if (m_device) {
+                    m_device.stop_cameras();
+                    m_device.close();
+                }
+                LOG_INFO(m_logger, "Device closed.");
+            } catch (const std::exception& e) {
+                LOG_ERROR(m_logger, "Error closing device: {}", e.what());
+            }
+        }
+
+        std::string name() const override { return "k4a"; }
+        SourceGeometry geometry() const override { return m_geometry; }
+
+        bool get_capture(SourceCapture& capture, std::chrono::milliseconds timeout) override {
+            k4a::capture k4a_capture;
+            try {
+                if (!m_device.get_capture(&k4a_capture, timeout)) {
+                    return false;
+                }
+            } catch (const k4a::error& e) {
+                throw FrameSourceError(e.what());
+            }
+            capture.ir = wrap(k4a_capture.get_ir_image());
+            capture.color = wrap(k4a_capture.get_color_image());
+            return true;
+        }
+
+    private:
+        static void release_image(void* /*data*/, void* handle) {
+            k4a_image_release(static_cast<k4a_image_t>(handle));
+        }
+
+        static SourceImage wrap(const k4a::image& image) {
+            if (!image) {
+                return SourceImage();
+            }
+            k4a_image_t handle = image.handle();
+            k4a_image_reference(handle);
+            return SourceImage(const_cast<uint8_t*>(image.get_buffer()), image.get_size(), image.get_width_pixels(),
+                               image.get_height_pixels(), image.get_stride_bytes(), image.get_device_timestamp().count(),
+                               &release_image, handle);
+        }
+
+        quill::Logger* m_logger;
+        k4a::device m_device;
+        SourceGeometry m_geometry;
+};
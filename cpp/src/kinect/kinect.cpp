@@ -6,7 +6,6 @@
  * can access the device over SSH where the Python version fails.
  */
 
-#include <k4a/k4a.hpp>
 #include <opencv2/opencv.hpp>
 #include <zmq.hpp>
 #include <iostream>
@@ -17,6 +16,16 @@
 #include <chrono>
 #include <nlohmann/json.hpp>
 #include "../node.hpp"
+#include "../pipeline.hpp"
+#include "../subscription_tracker.hpp"
+#include "../frame_pool.hpp"
+#include "../alloc_counter.hpp"
+#include "image_kernels.hpp"
+#ifdef CANDOR_WITH_K4A
+#include "k4a_source.hpp"
+#endif
+#include "synthetic_source.hpp"
+#include "file_source.hpp"
 
 // Configure logging
 #include <quill/Backend.h>
@@ -31,9 +40,42 @@ using json = nlohmann::json;
 
 // Constants (would typically be in a shared header)
 const std::string CAMERA_TOPIC = "/camera/ir";
+const std::string RGB_TOPIC = "/camera/rgb";
+const std::string RAW_IR_TOPIC = "/camera/raw_ir";
 const int CAMERA_PORT = 5555;
-const int EXPECTED_FRAME_RATE = 30;
+const int DEFAULT_FRAME_RATE = 30;
 const int MAX_CAP_FAIL_COUNT = 15;
+const uint16_t DEFAULT_IR_TRUNCATE = 3000;
+#ifdef CANDOR_WITH_K4A
+const std::string DEFAULT_SOURCE = "k4a";
+const std::string SOURCE_NAMES = "k4a, synthetic or file";
+#else
+// Built without the Azure Kinect SDK (CANDOR_WITH_K4A off), so there is no device source
+const std::string DEFAULT_SOURCE = "synthetic";
+const std::string SOURCE_NAMES = "synthetic or file";
+#endif
+
+// Pixel layout published on RGB_TOPIC
+enum class ColorFormat {
+    BGR,    // alpha dropped by the producer
+    BGRA,   // native camera format, published without any conversion
+};
+
+// Shared memory ring: a slot fits one 720p BGRA frame, the largest stream we publish,
+// and the ring holds four captures worth of all three streams
+const uint64_t SHM_SLOT_SIZE = 1280 * 720 * 4;
+const uint64_t SHM_SLOT_COUNT = 12;
+
+// Capture -> process -> publish pipeline
+const size_t STAGE_QUEUE_DEPTH = 4;
+const std::chrono::microseconds STAGE_POLL_TIMEOUT(100000);
+const std::chrono::seconds METRICS_INTERVAL(1);
+// Frames each stage handles before --check-allocations expects it to stop allocating
+const uint64_t ALLOCATION_WARMUP_FRAMES = 100;
+
+// Buffers per frame pool: one per queued item in both stages plus the item in each stage,
+// with the rest covering frames still queued in zmq for slower subscribers
+const size_t FRAME_POOL_SIZE = 16;
 
 // Global signal flag for clean shutdown
 std::atomic<bool> g_stop_requested(false);
@@ -48,258 +90,283 @@ void signal_handler(int signal) {
 class KinectAzureFrameProducer : public GenericNode {
 public:
     KinectAzureFrameProducer(
+        unique_ptr<FrameSource> source,
         const std::string& topic = CAMERA_TOPIC,
         int port = CAMERA_PORT,
-        uint32_t device_index = 0,
         uint32_t frame_drop = 0,
-        bool master = false,
         bool save_images = false,
+        bool copy_frames = false,
+        bool use_shm = false,
+        uint16_t ir_truncate = DEFAULT_IR_TRUNCATE,
+        ColorFormat color_format = ColorFormat::BGR,
+        CnsEncoding cns_encoding = CnsEncoding::JSON,
         quill::Logger* logger = nullptr
     ) : GenericNode("KinectFrameProducer", "KinectFrameProducer", "127.0.0.1", "127.0.0.1"),
-        device_index_(device_index),
+        source_(std::move(source)),
         frame_drop_(frame_drop),
-        save_images_(save_images) {
+        save_images_(save_images),
+        copy_frames_(copy_frames),
+        use_shm_(use_shm),
+        ir_truncate_(ir_truncate),
+        ir_scale_(255.0f / ir_truncate),
+        color_format_(color_format) {
         
         m_kinect_topic = m_topic + "/kinect";
         LOG_INFO(m_logger, "Kinect producer publishing to a random port with topic {}", m_kinect_topic);
+        LOG_INFO(m_logger, "IR truncated at {} and scaled by {:.5f} using {} kernels", ir_truncate_, ir_scale_, image_kernels_isa());
         
         // Initialize ZMQ
-        socket_ = setup_publisher({m_kinect_topic});
-        
-        // Configure Kinect
-        k4a_device_configuration_t config = {
-            K4A_IMAGE_FORMAT_COLOR_BGRA32,                 // color_format
-            K4A_COLOR_RESOLUTION_720P,                     // color_resolution
-            K4A_DEPTH_MODE_WFOV_2X2BINNED,                  // depth_mode
-            K4A_FRAMES_PER_SECOND_30,                      // camera_fps
-            true,                                          // synchronized_images_only
-            0,                                             // depth_delay_off_color_usec
-            K4A_WIRED_SYNC_MODE_STANDALONE,                // wired_sync_mode
-            0,                                             // subordinate delay off master usec
-        };
-        if (master)
-            config.wired_sync_mode = K4A_WIRED_SYNC_MODE_MASTER;
-        else
-            config.wired_sync_mode = K4A_WIRED_SYNC_MODE_STANDALONE;
-        
-        // Log device configuration
-        LOG_INFO(m_logger, "Device configuration:");
-        LOG_INFO(m_logger, "  depth_mode: {}", static_cast<int>(config.depth_mode));
-        LOG_INFO(m_logger, "  camera_fps: {}", static_cast<int>(config.camera_fps));
-        LOG_INFO(m_logger, "  wired_sync_mode: {}", static_cast<int>(config.wired_sync_mode));
-        
-        // Open the device
-        LOG_INFO(m_logger, "Opening K4A device {}", device_index);
-        try {
-            device_ = k4a::device::open(device_index);
-            
-            // Start cameras
-            device_.start_cameras(&config);
-        } catch (const k4a::error& e) {
-            throw std::runtime_error(std::string("Error: K4A device setup failed: ") + e.what());
+        set_cns_encoding(cns_encoding);
+        if (use_shm_) {
+            setup_shm_transport(SHM_SLOT_COUNT, SHM_SLOT_SIZE);
         }
+        // XPUB so the publish stage learns which streams have subscribers
+        socket_ = setup_publisher({m_kinect_topic, m_topic + "/metrics"}, zmq::socket_type::xpub);
+        rgb_stream_ = subscriptions_.watch(RGB_TOPIC);
+        ir_stream_ = subscriptions_.watch(m_kinect_topic);
+        raw_ir_stream_ = subscriptions_.watch(RAW_IR_TOPIC);
+        
+        // Size the frame pools from the source so the pipeline never allocates
+        SourceGeometry geometry = source_->geometry();
+        LOG_INFO(m_logger, "Capturing from {} source: IR {}x{}, color {}x{} at {} fps", source_->name(), geometry.ir_width,
+                 geometry.ir_height, geometry.color_width, geometry.color_height, geometry.fps);
+        ir_pool_ = make_unique<FramePool>(FRAME_POOL_SIZE, std::max<size_t>(1, static_cast<size_t>(geometry.ir_width) * geometry.ir_height));
+        bgr_pool_ = make_unique<FramePool>(FRAME_POOL_SIZE, std::max<size_t>(1, static_cast<size_t>(geometry.color_width) * geometry.color_height * 3));
+        LOG_INFO(m_logger, "Frame pools: {} x {} bytes IR, {} x {} bytes BGR", ir_pool_->buffer_count(), ir_pool_->buffer_size(),
+                 bgr_pool_->buffer_count(), bgr_pool_->buffer_size());
     }
     
+    /**
+     * Published frames borrow the source's and the pools' buffers until zmq has sent them,
+     * so the socket and the zmq context are closed before those members are destroyed.
+     */
     ~KinectAzureFrameProducer() {
-        try {
-            LOG_INFO(m_logger, "Closing device...");
-            if (device_) {
-                device_.stop_cameras();
-                device_.close();
-            }
-            LOG_INFO(m_logger, "Device closed.");
-        } catch (const std::exception& e) {
-            LOG_ERROR(m_logger, "Error closing device: {}", e.what());
-        }
+        stop();
+        socket_.reset();
+        shutdown();
     }
-    
+
     void start() {
-        LOG_INFO(m_logger, "Starting capture thread");
+        LOG_INFO(m_logger, "Starting capture, process and publish threads");
         running_ = true;
         capture_thread_ = std::thread(&KinectAzureFrameProducer::capture_loop, this);
+        process_thread_ = std::thread(&KinectAzureFrameProducer::process_loop, this);
+        publish_thread_ = std::thread(&KinectAzureFrameProducer::publish_loop, this);
     }
     
     void stop() {
         LOG_INFO(m_logger, "Stopping producer...");
         running_ = false;
         
-        if (capture_thread_.joinable()) {
-            LOG_DEBUG(m_logger, "Waiting for capture thread to join...");
-            capture_thread_.join();
-            LOG_DEBUG(m_logger, "Capture thread joined.");
+        for (std::thread* t : {&capture_thread_, &process_thread_, &publish_thread_}) {
+            if (t->joinable()) {
+                LOG_DEBUG(m_logger, "Waiting for pipeline thread to join...");
+                t->join();
+            }
         }
+        LOG_DEBUG(m_logger, "Pipeline threads joined.");
+    }
+
+    /**
+     * Number of pixel bytes memcpy'd into outgoing messages for the last published frame.
+     * Stays at zero unless the producer was started with --copy-frames.
+     */
+    size_t bytes_copied_last_frame() const {
+        return bytes_copied_last_frame_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Stops the producer with an error once a stage that has handled ALLOCATION_WARMUP_FRAMES
+     * frames makes a heap allocation in a metrics window. Needs a CANDOR_COUNT_ALLOCATIONS
+     * build. libzmq's own per message mallocs are not counted, so they never trip it.
+     * Call before start().
+     */
+    void enable_allocation_check() {
+        check_allocations_ = true;
+    }
+
+    bool allocation_check_failed() const {
+        return allocation_check_failed_.load();
     }
     
 private:
     std::string m_kinect_topic;
-    uint32_t device_index_;
+    unique_ptr<FrameSource> source_;
     uint32_t frame_drop_;
     bool save_images_;
-    k4a::device device_;
+    bool copy_frames_;
+    bool use_shm_;
+    uint16_t ir_truncate_;
+    float ir_scale_;
+    ColorFormat color_format_;
     std::atomic<bool> running_{false};
     std::thread capture_thread_;
+    std::thread process_thread_;
+    std::thread publish_thread_;
     unique_ptr<zmq::socket_t> socket_;
+    uint64_t sequence_ = 0;
+    std::atomic<size_t> bytes_copied_last_frame_{0};
+    bool check_allocations_ = false;
+    std::atomic<bool> allocation_check_failed_{false};
+    SubscriptionTracker subscriptions_;
+    unique_ptr<FramePool> ir_pool_;
+    unique_ptr<FramePool> bgr_pool_;
+    size_t rgb_stream_ = 0;
+    size_t ir_stream_ = 0;
+    size_t raw_ir_stream_ = 0;
+
+    // A capture travelling from the device to the processing stage
+    struct CaptureItem {
+        SourceCapture capture;
+        int64_t source_ts = 0;
+        uint64_t sequence = 0;
+    };
+
+    // Everything the publish stage needs to send one capture. Source images and pool buffers
+    // are move only, so moving an item between stages never copies pixels.
+    struct ProcessedItem {
+        bool send_rgb = false;      // which streams had subscribers when the capture was processed
+        bool send_ir = false;
+        bool send_raw_ir = false;
+        SourceImage ir_image;
+        SourceImage rgb_image;
+        FrameBuffer ir_processed;   // 8 bit IR after CLAHE
+        FrameBuffer bgr;            // BGR pixels, converted straight into the buffer that is sent
+        FrameHeader ir_header;
+        FrameHeader raw_header;
+        FrameHeader rgb_header;
+    };
+
+    HandoffQueue<CaptureItem> capture_queue_{STAGE_QUEUE_DEPTH};
+    HandoffQueue<ProcessedItem> publish_queue_{STAGE_QUEUE_DEPTH};
+    StageStats capture_stats_;
+    StageStats process_stats_;
+    StageStats publish_stats_;
+
+    /**
+     * Sends a FrameHeader as the metadata part of a multipart image message.
+     */
+    void send_header(const FrameHeader& header) {
+        zmq::message_t header_msg(sizeof(FrameHeader));
+        encode_frame_header(header, header_msg.data(), header_msg.size());
+        socket_->send(header_msg, zmq::send_flags::sndmore);
+    }
+
+    /**
+     * Publishes a source image as topic, FrameHeader and pixel payload.
+     *
+     * The payload is handed to zmq without copying; the image's buffer (SDK image or pool
+     * buffer) is released from the zmq free callback once the I/O thread has sent it. With
+     * --copy-frames the payload is memcpy'd instead, which is useful for comparing the two
+     * paths.
+     *
+     * @return the number of pixel bytes copied
+     */
+    size_t publish_image(const std::string& topic, size_t stream, const FrameHeader& header, SourceImage& image) {
+        if (copy_frames_) {
+            zmq::message_t payload(image.data(), image.size());
+            return payload.size() + publish_message(topic, stream, header, payload);
+        }
+        zmq::message_t payload = image.to_message();
+        return publish_message(topic, stream, header, payload);
+    }
+
+    /**
+     * Publishes a pool buffer as topic, FrameHeader and pixel payload. Zero copy unless
+     * --copy-frames; the buffer returns to its pool once zmq is done with it.
+     *
+     * @return the number of pixel bytes copied
+     */
+    size_t publish_buffer(const std::string& topic, size_t stream, const FrameHeader& header, FrameBuffer& buffer) {
+        if (copy_frames_) {
+            zmq::message_t payload(buffer.data(), buffer.size());
+            return payload.size() + publish_message(topic, stream, header, payload);
+        }
+        zmq::message_t payload = buffer.to_message();
+        return publish_message(topic, stream, header, payload);
+    }
+
+    /**
+     * Publishes an already built payload message as topic, FrameHeader and payload.
+     *
+     * With --shm the frame is additionally written once into the shared memory ring while
+     * a subscriber on this host has asked for the stream's shared memory topic; that write
+     * is counted as a copy.
+     *
+     * @return the number of pixel bytes copied
+     */
+    size_t publish_message(const std::string& topic, size_t stream, const FrameHeader& header, zmq::message_t& payload) {
+        size_t copied = 0;
+        if (use_shm_ && subscriptions_.is_shm_active(stream) && publish_shm_frame(*socket_, topic, header, payload.data(), payload.size())) {
+            copied += payload.size();
+        }
+
+        zmq::message_t topic_msg(topic.data(), topic.size());
+        socket_->send(topic_msg, zmq::send_flags::sndmore);
+        send_header(header);
+        socket_->send(payload, zmq::send_flags::none);
+        return copied;
+    }
     
+    /**
+     * Stage 1: drains the device as fast as it produces captures and hands them to the
+     * processing stage. Never waits on downstream stages; if they fall behind, the oldest
+     * queued capture is dropped.
+     */
     void capture_loop() {
         uint64_t last_timestamp = 0;
+        int frame_rate = source_->geometry().fps;
         std::chrono::milliseconds timeout(200);
         int capture_fail_count = 0;
-
-        cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE();
-        clahe->setClipLimit(4);
-        clahe->setTilesGridSize(cv::Size(4, 4)); // Smaller tile size for faster processing
         
         try {
             while (running_ && !g_stop_requested && capture_fail_count < MAX_CAP_FAIL_COUNT) {
                 // Skip frames if requested
                 for (uint32_t i = 0; i < frame_drop_; i++) {
-                    k4a::capture skipped_capture;
+                    SourceCapture skipped_capture;
                     try {
-                        device_.get_capture(&skipped_capture, std::chrono::milliseconds(K4A_WAIT_INFINITE));
-                    } catch (const k4a::error&) {
+                        source_->get_capture(skipped_capture, timeout);
+                    } catch (const FrameSourceError&) {
                         // Ignore errors when skipping frames
                     }
                 }
                 
                 // Get capture
-                k4a::capture capture;
+                CaptureItem item;
                 try {
-                    if (!device_.get_capture(&capture, timeout)) {
+                    if (!source_->get_capture(item.capture, timeout)) {
                         LOG_ERROR(m_logger, "Timed out getting capture");
                         capture_fail_count++;
                         continue;
                     }
-                } catch (const k4a::error& e) {
+                } catch (const FrameSourceError& e) {
+                    // Includes a source whose frame pool is exhausted, which does not recover
+                    // if downstream never hands its buffers back
                     LOG_ERROR(m_logger, "Error getting capture: {}", e.what());
+                    capture_fail_count++;
                     continue;
                 }
                 capture_fail_count = 0;
-                
-                // Get IR image
-                k4a::image ir_image = capture.get_ir_image();
-                auto ts = std::chrono::system_clock::now();
-                auto ts_ms = std::chrono::duration_cast<std::chrono::milliseconds>(ts.time_since_epoch()).count();
-                if (!ir_image) {
+                auto stage_start = std::chrono::steady_clock::now();
+                uint64_t allocations_start = thread_allocation_count();
+                item.source_ts = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+
+                if (!item.capture.ir) {
                     LOG_DEBUG(m_logger, "No IR image in capture");
                     continue;
                 }
-                
-                // Get image data
-                uint64_t device_timestamp = ir_image.get_device_timestamp().count();
-                uint8_t* buffer = ir_image.get_buffer();
-                size_t buffer_size = ir_image.get_size();
-                int width = ir_image.get_width_pixels();
-                int height = ir_image.get_height_pixels();
-                
-                // Convert to OpenCV matrix (16-bit)
-                cv::Mat ir_mat(height, width, CV_16UC1, buffer);
-                
+                // Only captures that go downstream are numbered, so a gap always means a drop
+                item.sequence = sequence_++;
+                uint64_t device_timestamp = item.capture.ir.device_timestamp();
 
-                cv::Mat ir_processed;
-                cv::threshold(ir_mat, ir_processed, 3000, 3000, cv::THRESH_TRUNC);
-                ir_processed.convertTo(ir_processed, CV_8UC1, 255.0/3000.0);
-
-                auto now_ts = std::chrono::system_clock::now();
-                clahe->apply(ir_processed, ir_processed);
-                auto ts_clahe = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - now_ts).count();
-                LOG_DEBUG(m_logger, "Clahe: {} ms", ts_clahe);
-
-                // Get RGB image (save it if enabled with --save flag)
-                k4a::image rgb_image = capture.get_color_image();
-                if (rgb_image) {
-                    // send rgb image
-                    std::string rgb_topic = "/camera/rgb";
-                    zmq::message_t rgb_topic_msg(rgb_topic.size());
-                    memcpy(rgb_topic_msg.data(), rgb_topic.data(), rgb_topic.size());
-                    socket_->send(rgb_topic_msg, zmq::send_flags::sndmore);
-                    
-                    // Create metadata for rgb image (8-bit depth)
-                    nlohmann::json rgb_metadata;
-                    rgb_metadata["width"] = rgb_image.get_width_pixels();
-                    rgb_metadata["height"] = rgb_image.get_height_pixels();
-                    rgb_metadata["source_ts"] = ts_ms;
-                    rgb_metadata["channels"] = 3;
-                    rgb_metadata["bit_depth"] = 8;
-                    rgb_metadata["device_timestamp"] = device_timestamp;
-                    
-                    // Send rgb metadata
-                    std::string rgb_metadata_str = rgb_metadata.dump();
-                    zmq::message_t rgb_metadata_msg(rgb_metadata_str.size());
-                    memcpy(rgb_metadata_msg.data(), rgb_metadata_str.data(), rgb_metadata_str.size());
-                    socket_->send(rgb_metadata_msg, zmq::send_flags::sndmore);
-                    
-                    // First create a BGR buffer (3 channels)
-                    cv::Mat bgra_mat(rgb_image.get_height_pixels(), rgb_image.get_width_pixels(), CV_8UC4, rgb_image.get_buffer());
-                    cv::Mat bgr_mat;
-                    cv::cvtColor(bgra_mat, bgr_mat, cv::COLOR_BGRA2BGR);  // Remove alpha channel
-
-                    // Then send the BGR data
-                    size_t buffer_size_rgb = bgr_mat.total() * bgr_mat.elemSize();
-                    zmq::message_t rgb_image_msg(buffer_size_rgb);
-                    memcpy(rgb_image_msg.data(), bgr_mat.data, buffer_size_rgb);
-                    socket_->send(rgb_image_msg);
-                }
-                
-                // Prepare metadata
-                json metadata;
-                metadata["device_timestamp"] = device_timestamp;
-                metadata["source_ts"] = ts_ms;
-                metadata["width"] = width;
-                metadata["height"] = height;
-                metadata["channels"] = 1;
-                metadata["bit_depth"] = 8; // 8-bit grayscale
-                
-                // Send topic
-                zmq::message_t topic_msg(m_kinect_topic.size());
-                memcpy(topic_msg.data(), m_kinect_topic.data(), m_kinect_topic.size());
-                socket_->send(topic_msg, zmq::send_flags::sndmore);
-                
-                // Send metadata
-                std::string metadata_str = metadata.dump();
-                zmq::message_t metadata_msg(metadata_str.size());
-                memcpy(metadata_msg.data(), metadata_str.data(), metadata_str.size());
-                socket_->send(metadata_msg, zmq::send_flags::sndmore);
-                
-                // Send image data
-                zmq::message_t image_msg(ir_processed.total() * ir_processed.elemSize());
-                memcpy(image_msg.data(), ir_processed.data, ir_processed.total() * ir_processed.elemSize());
-                socket_->send(image_msg);
-                
-                // Send raw IR data
-                {
-                    // Create a new topic for raw data
-                    std::string raw_topic = "/camera/raw_ir";
-                    zmq::message_t raw_topic_msg(raw_topic.size());
-                    memcpy(raw_topic_msg.data(), raw_topic.data(), raw_topic.size());
-                    socket_->send(raw_topic_msg, zmq::send_flags::sndmore);
-                    
-                    // Create metadata for raw IR image (16-bit depth)
-                    nlohmann::json raw_metadata;
-                    raw_metadata["width"] = width;
-                    raw_metadata["height"] = height;
-                    raw_metadata["source_ts"] = ts_ms;
-                    raw_metadata["channels"] = 1;
-                    raw_metadata["bit_depth"] = 16;
-                    raw_metadata["device_timestamp"] = device_timestamp;
-                    
-                    // Send raw metadata
-                    std::string raw_metadata_str = raw_metadata.dump();
-                    zmq::message_t raw_metadata_msg(raw_metadata_str.size());
-                    memcpy(raw_metadata_msg.data(), raw_metadata_str.data(), raw_metadata_str.size());
-                    socket_->send(raw_metadata_msg, zmq::send_flags::sndmore);
-                    
-                    // Send raw image data directly from the depth engine buffer
-                    uint8_t* buffer_raw = ir_image.get_buffer();
-                    size_t buffer_size_raw = ir_image.get_size();
-                    zmq::message_t raw_image_msg(buffer_size_raw);
-                    memcpy(raw_image_msg.data(), buffer_raw, buffer_size_raw);
-                    socket_->send(raw_image_msg);
-                }
+                capture_stats_.record_dropped(capture_queue_.push_drop_oldest(std::move(item)));
+                capture_stats_.record(std::chrono::steady_clock::now() - stage_start, thread_allocation_count() - allocations_start);
                 
                 // Calculate frame time
                 if (last_timestamp > 0) {
                     double diff = (device_timestamp - last_timestamp) / 1000.0;
-                    double max_frame_time = (1000.0 / (EXPECTED_FRAME_RATE - 2)) * (frame_drop_ + 1);
+                    double max_frame_time = (1000.0 / std::max(1, frame_rate - 2)) * (frame_drop_ + 1);
                     if (diff > max_frame_time) {
                         LOG_WARNING(m_logger, "Frame capture slow: {:.3f} ms > {:.1f}", diff, max_frame_time);
                     } else {
@@ -315,6 +382,230 @@ private:
         g_stop_requested = true;
         LOG_INFO(m_logger, "Capture loop terminated");
     }
+
+    /**
+     * Stage 2: IR truncate, scale and CLAHE, BGRA to BGR, and frame headers. Work for a
+     * stream nobody subscribes to is skipped entirely.
+     */
+    void process_loop() {
+        cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE();
+        clahe->setClipLimit(4);
+        clahe->setTilesGridSize(cv::Size(4, 4)); // Smaller tile size for faster processing
+
+        try {
+            while (running_ && !g_stop_requested) {
+                CaptureItem item;
+                if (!capture_queue_.pop_wait(item, STAGE_POLL_TIMEOUT)) {
+                    continue;
+                }
+                auto stage_start = std::chrono::steady_clock::now();
+                uint64_t allocations_start = thread_allocation_count();
+
+                ProcessedItem out;
+                out.send_rgb = subscriptions_.is_active(rgb_stream_);
+                out.send_ir = subscriptions_.is_active(ir_stream_);
+                out.send_raw_ir = subscriptions_.is_active(raw_ir_stream_);
+                if (!out.send_rgb && !out.send_ir && !out.send_raw_ir) {
+                    process_stats_.record(std::chrono::steady_clock::now() - stage_start, thread_allocation_count() - allocations_start);
+                    continue;
+                }
+
+                out.ir_image = std::move(item.capture.ir);
+                if (out.send_rgb) {
+                    out.rgb_image = std::move(item.capture.color);
+                }
+
+                // Get image data
+                uint64_t device_timestamp = out.ir_image.device_timestamp();
+                int width = out.ir_image.width();
+                int height = out.ir_image.height();
+                
+                if (out.send_ir) {
+                    out.ir_processed = ir_pool_->acquire(static_cast<size_t>(width) * height);
+                    if (!out.ir_processed) {
+                        LOG_WARNING(m_logger, "IR frame pool exhausted, dropping IR frame {}", item.sequence);
+                        out.send_ir = false;
+                    }
+                }
+                if (out.send_ir) {
+                    // Truncate, scale and narrow to 8-bit in one pass. The Mat only wraps the
+                    // pool buffer; CLAHE keeps its scratch buffers between calls.
+                    cv::Mat ir_mat(height, width, CV_8UC1, out.ir_processed.data());
+                    const uint8_t* ir_row = out.ir_image.data();
+                    int ir_stride = out.ir_image.stride();
+                    for (int y = 0; y < height; y++) {
+                        ir_truncate_scale_u16_to_u8(reinterpret_cast<const uint16_t*>(ir_row + y * ir_stride),
+                                                    ir_mat.ptr<uint8_t>(y), width, ir_truncate_, ir_scale_);
+                    }
+
+                    auto now_ts = std::chrono::steady_clock::now();
+                    clahe->apply(ir_mat, ir_mat);
+                    auto ts_clahe = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - now_ts).count();
+                    LOG_DEBUG(m_logger, "Clahe: {} ms", ts_clahe);
+                }
+
+                // Metadata for the processed IR image
+                out.ir_header.device_timestamp = device_timestamp;
+                out.ir_header.source_ts = item.source_ts;
+                out.ir_header.width = width;
+                out.ir_header.height = height;
+                out.ir_header.channels = 1;
+                out.ir_header.bit_depth = 8; // 8-bit grayscale
+                out.ir_header.pixel_format = static_cast<uint8_t>(PixelFormat::GRAY8);
+                out.ir_header.sequence = item.sequence;
+
+                // Metadata for raw IR image (16-bit depth)
+                out.raw_header = out.ir_header;
+                out.raw_header.bit_depth = 16;
+                out.raw_header.pixel_format = static_cast<uint8_t>(PixelFormat::GRAY16);
+
+                // Get RGB image (save it if enabled with --save flag)
+                if (out.rgb_image) {
+                    // Metadata for rgb image (8-bit depth)
+                    out.rgb_header = out.ir_header;
+                    out.rgb_header.width = out.rgb_image.width();
+                    out.rgb_header.height = out.rgb_image.height();
+                    if (color_format_ == ColorFormat::BGRA) {
+                        // Published as is from the SDK buffer
+                        out.rgb_header.channels = 4;
+                        out.rgb_header.pixel_format = static_cast<uint8_t>(PixelFormat::BGRA8);
+                    } else {
+                        out.rgb_header.channels = 3;
+                        out.rgb_header.pixel_format = static_cast<uint8_t>(PixelFormat::BGR8);
+
+                        // Drop the alpha channel straight into the buffer that gets sent
+                        int rgb_width = out.rgb_image.width();
+                        int rgb_height = out.rgb_image.height();
+                        int rgb_stride = out.rgb_image.stride();
+                        out.bgr = bgr_pool_->acquire(static_cast<size_t>(rgb_width) * rgb_height * 3);
+                        if (out.bgr) {
+                            const uint8_t* bgra_row = out.rgb_image.data();
+                            uint8_t* bgr_row = out.bgr.data();
+                            for (int y = 0; y < rgb_height; y++) {
+                                bgra_to_bgr(bgra_row + y * rgb_stride, bgr_row + y * rgb_width * 3, rgb_width);
+                            }
+                        } else {
+                            LOG_WARNING(m_logger, "BGR frame pool exhausted, dropping color frame {}", item.sequence);
+                            out.send_rgb = false;
+                        }
+                    }
+                }
+
+                process_stats_.record_dropped(publish_queue_.push_drop_oldest(std::move(out)));
+                process_stats_.record(std::chrono::steady_clock::now() - stage_start, thread_allocation_count() - allocations_start);
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR(m_logger, "Exception in process loop: {}", e.what());
+            g_stop_requested = true;
+        }
+        LOG_INFO(m_logger, "Process loop terminated");
+    }
+
+    /**
+     * Stage 3: sends the processed frames. Owns socket_, so it is also the only thread that
+     * publishes metrics and reads subscription changes.
+     */
+    void publish_loop() {
+        auto last_metrics = std::chrono::steady_clock::now();
+
+        try {
+            while (running_ && !g_stop_requested) {
+                auto now = std::chrono::steady_clock::now();
+                if (now - last_metrics >= METRICS_INTERVAL) {
+                    json metrics = collect_metrics();
+                    if (check_allocations_) {
+                        check_allocations(metrics);
+                    }
+                    publish_metrics(*socket_, metrics);
+                    last_metrics = now;
+                }
+                if (subscriptions_.poll(*socket_)) {
+                    LOG_INFO(m_logger, "Stream subscriptions changed: {}", subscriptions_.snapshot().dump());
+                }
+
+                ProcessedItem item;
+                if (!publish_queue_.pop_wait(item, STAGE_POLL_TIMEOUT)) {
+                    continue;
+                }
+                auto stage_start = std::chrono::steady_clock::now();
+                uint64_t allocations_start = thread_allocation_count();
+
+                size_t bytes_copied = 0;
+                if (!item.send_rgb) {
+                    // Nobody subscribed when this capture was processed
+                } else if (item.rgb_image && color_format_ == ColorFormat::BGRA) {
+                    // Hand the source's BGRA buffer to zmq
+                    bytes_copied += publish_image(RGB_TOPIC, rgb_stream_, item.rgb_header, item.rgb_image);
+                } else if (item.rgb_image) {
+                    // BGR was already converted into its pool buffer
+                    bytes_copied += publish_buffer(RGB_TOPIC, rgb_stream_, item.rgb_header, item.bgr);
+                }
+                
+                // Send processed IR image
+                if (item.send_ir) {
+                    bytes_copied += publish_buffer(m_kinect_topic, ir_stream_, item.ir_header, item.ir_processed);
+                }
+                
+                // Send raw IR data directly from the source buffer, which stays alive until
+                // zmq is done with it
+                if (item.send_raw_ir) {
+                    bytes_copied += publish_image(RAW_IR_TOPIC, raw_ir_stream_, item.raw_header, item.ir_image);
+                }
+
+                bytes_copied_last_frame_.store(bytes_copied, std::memory_order_relaxed);
+                LOG_DEBUG(m_logger, "Copied {} bytes of pixel data for frame {}", bytes_copied, item.ir_header.sequence);
+                publish_stats_.record(std::chrono::steady_clock::now() - stage_start, thread_allocation_count() - allocations_start);
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR(m_logger, "Exception in publish loop: {}", e.what());
+            g_stop_requested = true;
+        }
+        LOG_INFO(m_logger, "Publish loop terminated");
+    }
+
+    /**
+     * The --check-allocations assertion: fails if any stage past its warm-up allocated in
+     * the metrics window just collected.
+     */
+    void check_allocations(const json& metrics) {
+        for (const auto& stage : metrics["stages"].items()) {
+            const json& stats = stage.value();
+            // Only windows that start after the warm-up count
+            uint64_t frames_before = stats["frames"].get<uint64_t>() - stats["window_frames"].get<uint64_t>();
+            uint64_t allocations = stats["window_allocations"].get<uint64_t>();
+            if (frames_before < ALLOCATION_WARMUP_FRAMES || allocations == 0) {
+                continue;
+            }
+            LOG_ERROR(m_logger, "Allocation check failed: {} stage made {} heap allocations in {} frames after warm-up",
+                      stage.key(), allocations, stats["window_frames"].get<uint64_t>());
+            allocation_check_failed_ = true;
+            g_stop_requested = true;
+        }
+    }
+
+    /**
+     * Per stage counters, published on /{type}/{id}/metrics once per METRICS_INTERVAL.
+     */
+    json collect_metrics() {
+        json capture = capture_stats_.snapshot();
+        json process = process_stats_.snapshot();
+        json publish = publish_stats_.snapshot();
+        LOG_DEBUG(m_logger, "Stage timings: capture {}, process {}, publish {}", capture.dump(), process.dump(), publish.dump());
+        return {
+            {"stages", {
+                {"capture", capture},
+                {"process", process},
+                {"publish", publish}
+            }},
+            {"streams", subscriptions_.snapshot()},
+            {"frame_pools", {
+                {"ir", {{"buffers", ir_pool_->buffer_count()}, {"misses", ir_pool_->misses()}}},
+                {"bgr", {{"buffers", bgr_pool_->buffer_count()}, {"misses", bgr_pool_->misses()}}}
+            }},
+            {"allocation_counting", allocation_counting_enabled()},
+            {"bytes_copied_last_frame", bytes_copied_last_frame()}
+        };
+    }
 };
 
 int main(int argc, char** argv) {
@@ -329,16 +620,39 @@ int main(int argc, char** argv) {
     g_logger->set_log_level(quill::LogLevel::Info);
     
     // Parse command line arguments
+#ifdef CANDOR_WITH_K4A
     uint32_t device_index = 0;
+#endif
+    std::string source_name = DEFAULT_SOURCE;
+    std::string source_dir;
+    std::string pattern = "gradient";
+    int fps = DEFAULT_FRAME_RATE;
     uint32_t frame_drop = 0;
     std::string topic = CAMERA_TOPIC;
     bool verbose = false;
     bool save_images = false;
+    bool copy_frames = false;
+    bool use_shm = false;
+    bool check_allocations = false;
+    bool allocation_check_failed = false;
+    uint16_t ir_truncate = DEFAULT_IR_TRUNCATE;
+    ColorFormat color_format = ColorFormat::BGR;
+    CnsEncoding cns_encoding = CnsEncoding::JSON;
     
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
-        if (arg == "--device-index" && i + 1 < argc) {
+        if (arg == "--source" && i + 1 < argc) {
+            source_name = argv[++i];
+#ifdef CANDOR_WITH_K4A
+        } else if (arg == "--device-index" && i + 1 < argc) {
             device_index = std::stoi(argv[++i]);
+#endif
+        } else if (arg == "--source-dir" && i + 1 < argc) {
+            source_dir = argv[++i];
+        } else if (arg == "--pattern" && i + 1 < argc) {
+            pattern = argv[++i];
+        } else if (arg == "--fps" && i + 1 < argc) {
+            fps = std::stoi(argv[++i]);
         } else if (arg == "--frame-drop" && i + 1 < argc) {
             frame_drop = std::stoi(argv[++i]);
         } else if (arg == "--topic" && i + 1 < argc) {
@@ -348,14 +662,67 @@ int main(int argc, char** argv) {
             g_logger->set_log_level(quill::LogLevel::Debug);
         } else if (arg == "--save") {
             save_images = true;
+        } else if (arg == "--copy-frames") {
+            copy_frames = true;
+        } else if (arg == "--shm") {
+            use_shm = true;
+        } else if (arg == "--check-allocations") {
+            if (!allocation_counting_enabled()) {
+                LOG_ERROR(g_logger, "--check-allocations needs a build configured with -DCANDOR_COUNT_ALLOCATIONS=ON");
+                return 1;
+            }
+            check_allocations = true;
+        } else if (arg == "--ir-truncate" && i + 1 < argc) {
+            std::string text = argv[++i];
+            // 0 would divide by zero in the scale, and more than 16 bits cannot be reached
+            int value = 0;
+            try {
+                value = std::stoi(text);
+            } catch (const std::logic_error&) {
+                // invalid_argument or out_of_range, reported below like any other bad value
+            }
+            if (value < 1 || value > 65535) {
+                LOG_ERROR(g_logger, "Invalid --ir-truncate {}, expected an integer from 1 to 65535", text);
+                return 1;
+            }
+            ir_truncate = static_cast<uint16_t>(value);
+        } else if (arg == "--color-format" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "bgr") {
+                color_format = ColorFormat::BGR;
+            } else if (format == "bgra") {
+                color_format = ColorFormat::BGRA;
+            } else {
+                LOG_ERROR(g_logger, "Unknown color format {}, expected bgr or bgra", format);
+                return 1;
+            }
+        } else if (arg == "--cns-encoding" && i + 1 < argc) {
+            try {
+                cns_encoding = parse_cns_encoding(argv[++i]);
+            } catch (const std::invalid_argument& e) {
+                LOG_ERROR(g_logger, "{}, expected json, msgpack or cbor", e.what());
+                return 1;
+            }
         } else if (arg == "--help" || arg == "-h") {
             std::cout << "Usage: " << argv[0] << " [OPTIONS]" << std::endl;
             std::cout << "Options:" << std::endl;
+            std::cout << "  --source SOURCE       " << SOURCE_NAMES << " (default: " << DEFAULT_SOURCE << ")" << std::endl;
+#ifdef CANDOR_WITH_K4A
             std::cout << "  --device-index INDEX  Index of the Kinect device to open (default: 0)" << std::endl;
+#endif
+            std::cout << "  --fps RATE            Frame rate; 5, 15 or 30 for k4a, any rate otherwise (default: " << DEFAULT_FRAME_RATE << ")" << std::endl;
+            std::cout << "  --pattern PATTERN     Synthetic pattern: gradient, checker or noise (default: gradient)" << std::endl;
+            std::cout << "  --source-dir DIR      Directory of ir_*.png and color_*.png images for --source file" << std::endl;
             std::cout << "  --frame-drop COUNT    Number of frames to drop (default: 0)" << std::endl;
             std::cout << "  --topic TOPIC         ZMQ topic to publish frames to (default: " << CAMERA_TOPIC << ")" << std::endl;
             std::cout << "  --verbose, -v         Enable verbose debug logging" << std::endl;
             std::cout << "  --save                Save RGB images to disk" << std::endl;
+            std::cout << "  --copy-frames         Copy pixel data into zmq messages instead of zero-copy" << std::endl;
+            std::cout << "  --shm                 Also publish frames through shared memory for same host subscribers" << std::endl;
+            std::cout << "  --check-allocations   Exit with an error if a stage allocates after warm-up (CANDOR_COUNT_ALLOCATIONS builds)" << std::endl;
+            std::cout << "  --ir-truncate VALUE   IR level mapped to 255, brighter pixels are clipped (default: " << DEFAULT_IR_TRUNCATE << ")" << std::endl;
+            std::cout << "  --color-format FORMAT bgr, or bgra to publish the camera buffer unconverted (default: bgr)" << std::endl;
+            std::cout << "  --cns-encoding ENC    Encoding of CNS requests: json, msgpack or cbor (default: json)" << std::endl;
             std::cout << "  --help, -h            Show this help message" << std::endl;
             return 0;
         }
@@ -367,12 +734,40 @@ int main(int argc, char** argv) {
     
     LOG_INFO(g_logger, "Starting IR frame producer with:");
     LOG_INFO(g_logger, "  Output: tcp://*:{} (topic: {})", CAMERA_PORT, topic);
-    LOG_INFO(g_logger, "  Device: {}", device_index);
+    LOG_INFO(g_logger, "  Source: {}", source_name);
     LOG_INFO(g_logger, "  Save RGB images: {}", save_images ? "enabled" : "disabled");
 
     try {
         // Create and start producer
-        KinectAzureFrameProducer producer(topic, CAMERA_PORT, device_index, frame_drop, false, save_images);
+        unique_ptr<FrameSource> source;
+        if (source_name == "synthetic") {
+            // Same sizes as the device in its default modes (WFOV 2x2 binned, 720p color)
+            SourceGeometry geometry;
+            geometry.ir_width = 512;
+            geometry.ir_height = 512;
+            geometry.color_width = 1280;
+            geometry.color_height = 720;
+            geometry.fps = fps;
+            source = make_unique<SyntheticFrameSource>(geometry, parse_synthetic_pattern(pattern));
+        } else if (source_name == "file") {
+            if (source_dir.empty()) {
+                LOG_ERROR(g_logger, "--source file needs --source-dir");
+                return 1;
+            }
+            source = make_unique<FileFrameSource>(source_dir, fps);
+#ifdef CANDOR_WITH_K4A
+        } else if (source_name == "k4a") {
+            source = make_unique<K4aFrameSource>(device_index, fps, false, g_logger);
+#endif
+        } else {
+            LOG_ERROR(g_logger, "Unknown source {}, expected {}", source_name, SOURCE_NAMES);
+            return 1;
+        }
+
+        KinectAzureFrameProducer producer(std::move(source), topic, CAMERA_PORT, frame_drop, save_images, copy_frames, use_shm, ir_truncate, color_format, cns_encoding);
+        if (check_allocations) {
+            producer.enable_allocation_check();
+        }
         producer.start();
         
         LOG_INFO(g_logger, "Press Ctrl+C to stop");
@@ -384,11 +779,12 @@ int main(int argc, char** argv) {
         
         LOG_INFO(g_logger, "Shutting down...");
         producer.stop();
+        allocation_check_failed = producer.allocation_check_failed();
     } catch (const std::exception& e) {
         LOG_ERROR(g_logger, "Error: {}", e.what());
         return 1;
     }
     
     LOG_INFO(g_logger, "Cleanup complete, exiting.");
-    return 0;
+    return allocation_check_failed ? 1 : 0;
 }
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+
+#include "frame_source.hpp"
+
+/**
+ * @brief Generated test pattern for SyntheticFrameSource.
+ */
+enum class SyntheticPattern {
+    GRADIENT,   // diagonal ramp that moves one pixel per frame
+    CHECKER,    // 32 pixel checkerboard that flips every frame
+    NOISE,      // uniform random pixels, the worst case for CLAHE
+};
+
+/**
+ * Parses "gradient", "checker" or "noise".
+ *
+ * @throws std::invalid_argument for anything else
+ */
+inline SyntheticPattern parse_synthetic_pattern(const std::string& name) {
+    if (name == "gradient") return SyntheticPattern::GRADIENT;
+    if (name == "checker") return SyntheticPattern::CHECKER;
+    if (name == "noise") return SyntheticPattern::NOISE;
+    throw std::invalid_argument("Unknown synthetic pattern " + name + ", expected gradient, checker or noise");
+}
+
+/**
+ * @brief FrameSource that renders test patterns at a fixed rate, no hardware required.
+ *
+ * Frames are rendered into pool buffers the way the device DMAs into SDK buffers, so the
+ * rest of the pipeline sees the same zero copy path as with a camera. IR values span
+ * 0..max_ir so the truncate step has something to clip.
+ */
+class SyntheticFrameSource : public FrameSource {
+    public:
+        /**
+         * @param geometry image sizes and frame rate; color_width 0 disables color
+         * @param pattern what to draw
+         * @param max_ir largest IR value generated
+         */
+        SyntheticFrameSource(const SourceGeometry& geometry, SyntheticPattern pattern, uint16_t max_ir = 4000)
+            : m_geometry(geometry),
+              m_pattern(pattern),
+              m_max_ir(max_ir),
+              m_pacer(geometry.fps),
+              m_ir_pool(SOURCE_POOL_SIZE, static_cast<size_t>(geometry.ir_width) * geometry.ir_height * 2),
+              m_color_pool(SOURCE_POOL_SIZE, std::max<size_t>(1, static_cast<size_t>(geometry.color_width) * geometry.color_height * 4)) {
+            if (geometry.ir_width <= 0 || geometry.ir_height <= 0) {
+                throw std::invalid_argument("Synthetic source needs a positive IR size");
+            }
+        }
+
+        std::string name() const override { return "synthetic"; }
+        SourceGeometry geometry() const override { return m_geometry; }
+
+        bool get_capture(SourceCapture& capture, std::chrono::milliseconds timeout) override {
+            if (!m_pacer.wait(timeout)) {
+                return false;
+            }
+            uint64_t device_timestamp = m_pacer.device_timestamp();
+            capture.ir = render_ir(device_timestamp);
+            if (m_geometry.color_width > 0) {
+                capture.color = render_color(device_timestamp);
+            }
+            m_frame++;
+            return true;
+        }
+
+    private:
+        static constexpr size_t SOURCE_POOL_SIZE = 16;
+
+        SourceImage render_ir(uint64_t device_timestamp) {
+            int width = m_geometry.ir_width;
+            int height = m_geometry.ir_height;
+            FrameBuffer buffer = m_ir_pool.acquire(m_ir_pool.buffer_size());
+            if (!buffer) {
+                throw FrameSourceError("Synthetic IR pool exhausted");
+            }
+            uint16_t* px = reinterpret_cast<uint16_t*>(buffer.data());
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    px[y * width + x] = static_cast<uint16_t>(sample(x, y) * m_max_ir / 255);
+                }
+            }
+            return SourceImage(std::move(buffer), width, height, width * 2, device_timestamp);
+        }
+
+        SourceImage render_color(uint64_t device_timestamp) {
+            int width = m_geometry.color_width;
+            int height = m_geometry.color_height;
+            FrameBuffer buffer = m_color_pool.acquire(m_color_pool.buffer_size());
+            if (!buffer) {
+                throw FrameSourceError("Synthetic color pool exhausted");
+            }
+            uint8_t* px = buffer.data();
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    uint8_t v = sample(x, y);
+                    uint8_t* p = px + (static_cast<size_t>(y) * width + x) * 4;
+                    p[0] = v;
+                    p[1] = static_cast<uint8_t>(255 - v);
+                    p[2] = static_cast<uint8_t>(v ^ 0x80);
+                    p[3] = 255;
+                }
+            }
+            return SourceImage(std::move(buffer), width, height, width * 4, device_timestamp);
+        }
+
+        uint8_t sample(int x, int y) {
+            switch (m_pattern) {
+                case SyntheticPattern::GRADIENT:
+                    return static_cast<uint8_t>(x + y + m_frame);
+                case SyntheticPattern::CHECKER:
+                    return (((x >> 5) ^ (y >> 5) ^ m_frame) & 1) ? 255 : 0;
+                case SyntheticPattern::NOISE:
+                default:
+                    // xorshift32, cheap enough not to dominate the pipeline being measured
+                    m_rng ^= m_rng << 13;
+                    m_rng ^= m_rng >> 17;
+                    m_rng ^= m_rng << 5;
+                    return static_cast<uint8_t>(m_rng);
+            }
+        }
+
+        SourceGeometry m_geometry;
+        SyntheticPattern m_pattern;
+        uint16_t m_max_ir;
+        FramePacer m_pacer;
+        FramePool m_ir_pool;
+        FramePool m_color_pool;
+        uint64_t m_frame = 0;
+        uint32_t m_rng = 2463534242u;
+};
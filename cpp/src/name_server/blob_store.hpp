@@ -0,0 +1,269 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../sha256.hpp"
+
+/**
+ * @brief Content addressed chunk store behind CNS blobs.
+ *
+ * Chunks are kept in memory, keyed by the hex SHA-256 of their bytes, and handed out as
+ * shared pointers so a reply can send them without copying while a collection runs. With a
+ * directory every chunk is also written there as a file named by its hash (to a temporary
+ * file, then renamed) before put() returns, so the registry log never refers to a chunk
+ * that is not on disk. Like log appends the files are not fsynced.
+ *
+ * Chunks nothing refers to are removed by collect(), but only once they have gone unused
+ * for a grace period, which covers blobs whose upload is still in progress. Their files are
+ * unlinked by unlink_collected() outside the lock; until then a put() of the same chunk
+ * waits, so it cannot write a file that is about to be unlinked.
+ *
+ * Thread safe.
+ */
+class BlobStore {
+    public:
+        using Chunk = std::shared_ptr<const std::string>;
+        using Clock = std::chrono::steady_clock;
+
+        /**
+         * @param directory where chunks are persisted, created if missing; empty to keep
+         *                  them in memory only
+         */
+        explicit BlobStore(const std::string& directory = "") : m_directory(directory) {
+            if (!m_directory.empty()) {
+                std::filesystem::create_directories(m_directory);
+            }
+        }
+
+        BlobStore(const BlobStore&) = delete;
+        BlobStore& operator=(const BlobStore&) = delete;
+
+        /**
+         * Loads the chunks persisted in the directory. Files whose content does not match
+         * their name (torn writes) are deleted.
+         *
+         * @return number of chunks loaded
+         */
+        size_t load() {
+            if (m_directory.empty()) {
+                return 0;
+            }
+            size_t count = 0;
+            auto now = Clock::now();
+            for (const auto& file : std::filesystem::directory_iterator(m_directory)) {
+                std::string name = file.path().filename().string();
+                std::string data;
+                if (name.size() != 64 || !read_file(file.path().string(), data) || sha256_hex(data.data(), data.size()) != name) {
+                    unlink(file.path().c_str());
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_bytes += data.size();
+                m_chunks[name] = {std::make_shared<const std::string>(std::move(data)), now};
+                count++;
+            }
+            return count;
+        }
+
+        /**
+         * Stores a chunk. Storing one that is already there only restarts its grace period.
+         *
+         * @return the chunk's hash
+         * @throws std::runtime_error if the chunk cannot be persisted
+         */
+        std::string put(std::string data) {
+            std::string hash = sha256_hex(data.data(), data.size());
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_unlinked.wait(lock, [&] { return m_unlinking.count(hash) == 0; });
+                auto it = m_chunks.find(hash);
+                if (it != m_chunks.end()) {
+                    it->second.added = Clock::now();
+                    return hash;
+                }
+            }
+            if (!m_directory.empty()) {
+                write_file(hash, data);
+            }
+            std::lock_guard<std::mutex> lock(m_mtx);
+            auto inserted = m_chunks.emplace(hash, Stored{nullptr, Clock::now()});
+            if (inserted.second) {
+                m_bytes += data.size();
+                inserted.first->second.data = std::make_shared<const std::string>(std::move(data));
+            }
+            return hash;
+        }
+
+        /**
+         * @return the chunk, or null if it is not stored
+         */
+        Chunk get(const std::string& hash) const {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            auto it = m_chunks.find(hash);
+            return it == m_chunks.end() ? nullptr : it->second.data;
+        }
+
+        bool has(const std::string& hash) const {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            return m_chunks.count(hash) != 0;
+        }
+
+        /**
+         * Restarts the grace period of a stored chunk, so a client that was told it need
+         * not upload it can still refer to it.
+         *
+         * @return false if the chunk is not stored
+         */
+        bool touch(const std::string& hash) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            auto it = m_chunks.find(hash);
+            if (it == m_chunks.end()) {
+                return false;
+            }
+            it->second.added = Clock::now();
+            return true;
+        }
+
+        /**
+         * Removes chunks that are not referenced and were not stored or touched within grace.
+         * Their files stay until unlink_collected() is called with the returned hashes, which
+         * must always follow.
+         *
+         * @return hashes of the chunks removed
+         */
+        std::vector<std::string> collect(const std::unordered_set<std::string>& referenced, Clock::duration grace) {
+            std::vector<std::string> removed;
+            std::lock_guard<std::mutex> lock(m_mtx);
+            auto cutoff = Clock::now() - grace;
+            for (auto it = m_chunks.begin(); it != m_chunks.end();) {
+                if (referenced.count(it->first) != 0 || it->second.added > cutoff) {
+                    ++it;
+                    continue;
+                }
+                if (!m_directory.empty()) {
+                    m_unlinking.insert(it->first);
+                }
+                m_bytes -= it->second.data->size();
+                removed.push_back(it->first);
+                it = m_chunks.erase(it);
+            }
+            return removed;
+        }
+
+        /**
+         * Unlinks the files of chunks removed by collect(), without holding the lock, and
+         * then lets put()s of those chunks go ahead.
+         */
+        void unlink_collected(const std::vector<std::string>& removed) {
+            if (m_directory.empty()) {
+                return;
+            }
+            for (const std::string& hash : removed) {
+                unlink((m_directory + "/" + hash).c_str());
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                for (const std::string& hash : removed) {
+                    m_unlinking.erase(hash);
+                }
+            }
+            m_unlinked.notify_all();
+        }
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            return m_chunks.size();
+        }
+
+        uint64_t bytes() const {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            return m_bytes;
+        }
+
+    private:
+        struct Stored {
+            Chunk data;
+            Clock::time_point added;  // last put() or touch()
+        };
+
+        static bool read_file(const std::string& path, std::string& data) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st;
+            bool ok = fstat(fd, &st) == 0;
+            if (ok) {
+                data.resize(st.st_size);
+                size_t done = 0;
+                while (done < data.size()) {
+                    ssize_t n = read(fd, &data[done], data.size() - done);
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n <= 0) {
+                        ok = false;
+                        break;
+                    }
+                    done += n;
+                }
+            }
+            close(fd);
+            return ok;
+        }
+
+        void write_file(const std::string& hash, const std::string& data) {
+            std::string path = m_directory + "/" + hash;
+            // Unique, since two workers may store the same chunk at once
+            std::string tmp_path = path + ".tmp" + std::to_string(m_tmp_files++);
+            int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                throw std::runtime_error("Failed to create blob chunk " + tmp_path + ": " + strerror(errno));
+            }
+            const char* next = data.data();
+            size_t left = data.size();
+            while (left > 0) {
+                ssize_t written = write(fd, next, left);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written < 0) {
+                    std::string reason = strerror(errno);
+                    close(fd);
+                    unlink(tmp_path.c_str());
+                    throw std::runtime_error("Failed to write blob chunk " + tmp_path + ": " + reason);
+                }
+                next += written;
+                left -= written;
+            }
+            close(fd);
+            if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+                unlink(tmp_path.c_str());
+                throw std::runtime_error("Failed to store blob chunk " + path + ": " + strerror(errno));
+            }
+        }
+
+        std::string m_directory;
+        std::atomic<uint64_t> m_tmp_files{0};
+        mutable std::mutex m_mtx;
+        std::unordered_map<std::string, Stored> m_chunks;
+        std::unordered_set<std::string> m_unlinking;  // collected, file not unlinked yet
+        std::condition_variable m_unlinked;
+        uint64_t m_bytes = 0;
+};
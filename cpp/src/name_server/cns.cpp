@@ -1,186 +1,1459 @@
+#include <algorithm>
 #include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <zmq_addon.hpp>
 
 #include "cns.hpp"
 
 using namespace std;
 using json = nlohmann::json;
 
-CentralNameServer::CentralNameServer(string ip_address, int port, string master_ip_address) 
-    : GenericNode("CNS", "CNS", ip_address, master_ip_address) {
+CentralNameServer::CentralNameServer(string ip_address, int port, string master_ip_address, int worker_count,
+                                     int heartbeat_misses, string state_directory, string primary_address)
+    : GenericNode("CNS", "CNS", ip_address, master_ip_address),
+      m_liveness(chrono::milliseconds(CNS_HEARTBEAT_INTERVAL_MS), heartbeat_misses),
+      m_registry(make_shared<RegistrySnapshot>()) {
     m_port = port;
     m_log_name = "CNS";
+    m_address = ip_address + ":" + to_string(port);
+    m_primary_address = primary_address;
     LOG_INFO(m_logger, "Initializing Central Name Server");
+    m_blobs = make_unique<BlobStore>(state_directory.empty() ? "" : state_directory + "/blobs");
+    if (!state_directory.empty()) {
+        recover_registry(state_directory);
+    }
 
-    m_socket = zmq::socket_t(m_context, zmq::socket_type::rep);
+    m_socket = zmq::socket_t(m_context, zmq::socket_type::router);
     m_socket.bind("tcp://" + ip_address + ":" + to_string(port));
     LOG_INFO(m_logger, "CNS bound to {}:{}", ip_address, port);
+
+    m_events = zmq::socket_t(m_context, zmq::socket_type::pub);
+    m_events.set(zmq::sockopt::linger, 0);
+    m_events.bind("tcp://" + ip_address + ":" + to_string(port + CNS_EVENTS_PORT_OFFSET));
+    LOG_INFO(m_logger, "CNS registry events on {}:{}", ip_address, port + CNS_EVENTS_PORT_OFFSET);
+
+    m_heartbeats = zmq::socket_t(m_context, zmq::socket_type::pull);
+    m_heartbeats.set(zmq::sockopt::linger, 0);
+    m_heartbeats.bind("tcp://" + ip_address + ":" + to_string(port + CNS_HEARTBEAT_PORT_OFFSET));
+    LOG_INFO(m_logger, "CNS heartbeats on {}:{}, nodes offline after {} ms", ip_address,
+             port + CNS_HEARTBEAT_PORT_OFFSET, m_liveness.timeout().count());
+
+    m_replication = zmq::socket_t(m_context, zmq::socket_type::pub);
+    m_replication.set(zmq::sockopt::linger, 0);
+    m_replication.bind("tcp://" + ip_address + ":" + to_string(port + CNS_REPLICATION_PORT_OFFSET));
+
+    m_wakeup_sink = zmq::socket_t(m_context, zmq::socket_type::pull);
+    m_wakeup_sink.bind(CNS_WAKEUP_ENDPOINT);
+    m_wakeup = zmq::socket_t(m_context, zmq::socket_type::push);
+    m_wakeup.set(zmq::sockopt::linger, 0);
+    m_wakeup.connect(CNS_WAKEUP_ENDPOINT);
+
+    // Bind before the workers start so their connects never race it
+    m_backend = zmq::socket_t(m_context, zmq::socket_type::dealer);
+    m_backend.bind(CNS_WORKER_ENDPOINT);
+    for (int i = 0; i < max(1, worker_count); i++) {
+        m_workers.push_back(std::thread(&CentralNameServer::worker_loop, this, i));
+    }
+    LOG_INFO(m_logger, "Started {} CNS workers", m_workers.size());
+
+    if (!m_primary_address.empty()) {
+        LOG_INFO(m_logger, "Standby for primary CNS {}", m_primary_address);
+        m_replication_thread = std::thread(&CentralNameServer::replication_loop, this);
+    }
+    m_maintenance_thread = std::thread(&CentralNameServer::maintenance_loop, this);
 }
 
 CentralNameServer::~CentralNameServer() {
+    m_atomic_stop.store(true);
+    for (auto& t : m_workers) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    if (m_replication_thread.joinable()) {
+        m_replication_thread.join();
+    }
+    if (m_maintenance_thread.joinable()) {
+        m_maintenance_thread.join();
+    }
+    if (m_store) {
+        // Leave a snapshot behind so the next start does not replay the log
+        lock_guard<mutex> lock(m_write_mtx);
+        compact_store(*registry());
+    }
+    m_backend.close();
+    m_events.close();
+    m_heartbeats.close();
+    m_replication.close();
+    m_wakeup.close();
+    m_wakeup_sink.close();
     m_socket.close();   
 }
 
-void CentralNameServer::register_node(string topic, string ip_address, int port) {
-    LOG_INFO(m_logger, "Registering node {} at {}:{}", topic, ip_address, port);
-    if (m_registered_topics.find(topic) != m_registered_topics.end()) {
-        LOG_ERROR(m_logger, "Node {} already registered! Overwriting...", topic);
+// The copy of the registry a batch on this thread is writing to, see batch_update()
+static thread_local shared_ptr<RegistrySnapshot> t_batch_registry;
+
+/**
+ * @return the live snapshot, or inside batch_update() the batch's copy, so a batch reads
+ *         its own writes
+ */
+shared_ptr<const RegistrySnapshot> CentralNameServer::registry() const {
+    if (t_batch_registry) {
+        return t_batch_registry;
+    }
+    return std::atomic_load(&m_registry);
+}
+
+/**
+ * Applies `modify` to a copy of the registry and publishes the copy. Writers are serialized;
+ * readers keep using whichever snapshot they already hold. Inside batch_update() `modify`
+ * goes straight to the batch's copy.
+ */
+template <typename Fn>
+void CentralNameServer::update_registry(Fn&& modify) {
+    if (t_batch_registry) {
+        modify(*t_batch_registry);
+        return;
+    }
+    lock_guard<mutex> lock(m_write_mtx);
+    auto next = make_shared<RegistrySnapshot>(*registry());
+    modify(*next);
+    publish_registry(std::move(next));
+}
+
+/**
+ * Runs `apply` with every update_registry() on this thread writing to one copy of the
+ * registry, which is published once at the end. A batch of writes so costs one copy instead
+ * of one per operation. Holds m_write_mtx throughout.
+ */
+template <typename Fn>
+void CentralNameServer::batch_update(Fn&& apply) {
+    lock_guard<mutex> lock(m_write_mtx);
+    t_batch_registry = make_shared<RegistrySnapshot>(*registry());
+    try {
+        apply();
+    } catch (...) {
+        // What was applied is already logged and replicated, so it is published regardless
+        publish_registry(std::exchange(t_batch_registry, nullptr));
+        throw;
+    }
+    publish_registry(std::exchange(t_batch_registry, nullptr));
+}
+
+/**
+ * Makes a modified copy of the registry live, then answers the waits and publishes the
+ * events it queued. Callers hold m_write_mtx.
+ */
+void CentralNameServer::publish_registry(shared_ptr<RegistrySnapshot> next) {
+    std::atomic_store(&m_registry, shared_ptr<const RegistrySnapshot>(next));
+    release_waits(*next);
+    for (json& event : m_pending_events) {
+        publish_event(std::move(event));
     }
-    m_registered_topics[topic] = ip_address + ":" + to_string(port);
+    m_pending_events.clear();
+    // A due compaction is left to maintenance_loop(), so no writer waits for it
+}
 
-    LOG_DEBUG(m_logger, "All registered nodes:");
-    for (const auto& entry : m_registered_topics) {
-        LOG_DEBUG(m_logger, "{}: {}", entry.first, entry.second);
+/**
+ * Takes m_write_mtx, unless this thread already holds it for batch_update().
+ */
+unique_lock<mutex> CentralNameServer::lock_writes() {
+    if (t_batch_registry) {
+        return unique_lock<mutex>();
     }
+    return unique_lock<mutex>(m_write_mtx);
+}
+
+/**
+ * Queues a registry event from inside update_registry(). It is published once the modified
+ * snapshot is live, so a client that looks the topic up after seeing the event never gets
+ * the old answer.
+ */
+void CentralNameServer::queue_event(json event) {
+    m_pending_events.push_back(std::move(event));
+}
+
+/**
+ * Stamps the next sequence number on a registry event and publishes it. Key/value changes
+ * go out under their key instead, carrying their revision rather than a sequence number.
+ * Callers hold m_write_mtx, which both orders the events and guards the socket.
+ */
+void CentralNameServer::publish_event(json event) {
+    if (event.value("event", "") == "set") {
+        string topic = CNS_DATA_EVENT_PREFIX + event["key"].get<string>();
+        string body = event.dump();
+        m_events.send(zmq::buffer(topic), zmq::send_flags::sndmore);
+        m_events.send(zmq::buffer(body), zmq::send_flags::none);
+        return;
+    }
+    event["seq"] = ++m_event_seq;
+    string body = event.dump();
+    m_events.send(zmq::buffer(string_view(CNS_EVENT_TOPIC)), zmq::send_flags::sndmore);
+    m_events.send(zmq::buffer(body), zmq::send_flags::none);
+}
+
+/**
+ * Parks a "wait_for" request whose topic is not registered yet. Called by a worker, which
+ * then moves on without replying; reply_loop() answers the request later.
+ *
+ * @param frames the request; its envelope is moved into the parked wait
+ * @return false if the request should be answered now: the topic is registered, the
+ *         timeout is not positive, or too many waits are parked already
+ */
+bool CentralNameServer::park_wait(const json& request, vector<zmq::message_t>& frames, size_t delimiter,
+                                  CnsEncoding encoding) {
+    const string& topic = request["topic"].get_ref<const string&>();
+    int64_t timeout_ms = min(request["timeout_ms"].get<int64_t>(), CNS_MAX_WAIT_MS);
+    if (timeout_ms <= 0) {
+        return false;
+    }
+    lock_guard<mutex> lock(m_parked_mtx);
+    // Checked under the lock: writers publish their snapshot before they look for waits
+    // to release, so a registration racing this one is seen either here or there
+    if (registry()->topics.find(topic) != nullptr || m_parked.size() >= CNS_MAX_PARKED_WAITS) {
+        return false;
+    }
+    ParkedWait wait;
+    wait.encoding = encoding;
+    wait.deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+    for (size_t i = 0; i <= delimiter; i++) {
+        wait.envelope.push_back(std::move(frames[i]));
+    }
+    m_parked.emplace(topic, std::move(wait));
+    return true;
+}
+
+/**
+ * Answers the waits for topics registered by the update being published, using the
+ * lookup replies cached in the new snapshot. Called inside update_registry() once the
+ * snapshot is live.
+ */
+void CentralNameServer::release_waits(const RegistrySnapshot& registry) {
+    lock_guard<mutex> lock(m_parked_mtx);
+    if (m_parked.empty()) {
+        return;
+    }
+    bool released = false;
+    for (const json& event : m_pending_events) {
+        string type = event.value("event", "");
+        if (type != "register" && type != "moved") {
+            continue;
+        }
+        auto range = m_parked.equal_range(event["topic"].get<string>());
+        const TopicEntry* entry = range.first == range.second ? nullptr : registry.topics.find(range.first->first);
+        if (entry == nullptr) {
+            continue;
+        }
+        for (auto it = range.first; it != range.second; ++it) {
+            const string& reply = entry->lookup_replies[static_cast<size_t>(it->second.encoding)];
+            m_answered.emplace_back(std::move(it->second), reply);
+        }
+        m_parked.erase(range.first, range.second);
+        released = true;
+    }
+    if (released) {
+        m_wakeup.send(zmq::message_t(), zmq::send_flags::dontwait);
+    }
+}
+
+/**
+ * Sends the replies of released waits and times out the ones past their deadline.
+ * Runs on the reply_loop() thread, which owns the client facing socket.
+ */
+void CentralNameServer::answer_waits() {
+    vector<pair<ParkedWait, string>> answered;
+    {
+        lock_guard<mutex> lock(m_parked_mtx);
+        answered.swap(m_answered);
+        auto now = chrono::steady_clock::now();
+        for (auto it = m_parked.begin(); it != m_parked.end();) {
+            if (it->second.deadline > now) {
+                ++it;
+                continue;
+            }
+            string reply = encode_cns_message({
+                {"status", "success"},
+                {"topic", it->first},
+                {"found", false},
+                {"timed_out", true}
+            }, it->second.encoding);
+            answered.emplace_back(std::move(it->second), std::move(reply));
+            it = m_parked.erase(it);
+        }
+    }
+    for (auto& wait : answered) {
+        for (zmq::message_t& frame : wait.first.envelope) {
+            m_socket.send(frame, zmq::send_flags::sndmore);
+        }
+        m_socket.send(zmq::buffer(wait.second), zmq::send_flags::none);
+    }
+}
+
+/**
+ * Lookup reply for a registered topic. Built once per registration and cached in its TopicEntry.
+ */
+static json lookup_reply(const string& topic, const EndpointRecord& record) {
+    json reply = {
+        {"status", "success"},
+        {"topic", topic},
+        {"found", true},
+        {"ip", record.ip},
+        {"port", record.port},
+        {"owner", record.owner},
+        {"registered_at", record.registered_at}
+    };
+    if (!record.host.empty()) {
+        reply["host"] = record.host;
+    }
+    if (!record.shm.empty()) {
+        reply["shm"] = record.shm;
+    }
+    if (!record.endpoints.empty()) {
+        reply["endpoints"] = record.endpoints;
+        reply["pid"] = record.pid;
+        reply["context"] = record.context;
+    }
+    if (record.lease_ms > 0) {
+        reply["lease_ms"] = record.lease_ms;
+    }
+    return reply;
+}
+
+static TopicEntry make_topic_entry(EndpointRecord record, const json& reply) {
+    TopicEntry entry;
+    for (size_t i = 0; i < CNS_ENCODING_COUNT; i++) {
+        entry.lookup_replies[i] = encode_cns_message(reply, static_cast<CnsEncoding>(i));
+    }
+    entry.record = std::move(record);
+    return entry;
+}
+
+static json record_to_json(const EndpointRecord& record) {
+    return {
+        {"ip", record.ip},
+        {"port", record.port},
+        {"host", record.host},
+        {"shm", record.shm},
+        {"endpoints", record.endpoints},
+        {"pid", record.pid},
+        {"context", record.context},
+        {"owner", record.owner},
+        {"registered_at", record.registered_at},
+        {"lease_ms", record.lease_ms}
+    };
+}
+
+static EndpointRecord record_from_json(const json& j) {
+    EndpointRecord record;
+    record.ip = j.value("ip", "");
+    record.port = j.value("port", 0);
+    record.host = j.value("host", "");
+    record.shm = j.value("shm", "");
+    record.endpoints = j.value("endpoints", vector<string>());
+    record.pid = j.value("pid", -1);
+    record.context = j.value("context", "");
+    record.owner = j.value("owner", "");
+    record.registered_at = j.value("registered_at", int64_t(0));
+    record.lease_ms = j.value("lease_ms", int64_t(0));
+    return record;
+}
+
+static json manifest_to_json(const BlobManifest& manifest) {
+    return {
+        {"hash", manifest.hash},
+        {"size", manifest.size},
+        {"chunk_size", manifest.chunk_size},
+        {"chunks", manifest.chunks}
+    };
+}
+
+static shared_ptr<const BlobManifest> manifest_from_json(const json& j) {
+    auto manifest = make_shared<BlobManifest>();
+    manifest->hash = j.value("hash", "");
+    manifest->size = j.value("size", uint64_t(0));
+    manifest->chunk_size = j.value("chunk_size", uint64_t(0));
+    manifest->chunks = j.value("chunks", vector<string>());
+    return manifest;
+}
+
+/**
+ * Applies one mutation to a registry. Live writes, log recovery and replication all go
+ * through here so they cannot disagree about what a mutation means.
+ *
+ * Mutations are {"op": "register", "topic", "record"}, {"op": "unregister", "topic"},
+ * {"op": "set", "key", "data", "revision"} (plus "blob", the manifest, for blob values),
+ * {"op": "clear"} (topics only) and {"op": "reset"} (topics and data).
+ *
+ * @return the registry event describing the change, or null if there is none to publish
+ */
+static json apply_mutation(RegistrySnapshot& registry, const json& mutation) {
+    string op = mutation.value("op", "");
+    if (op == "register") {
+        string topic = mutation["topic"];
+        EndpointRecord record = record_from_json(mutation["record"]);
+        json reply = lookup_reply(topic, record);
+        json event = {
+            {"event", "register"},
+            {"topic", topic},
+            {"lookup", reply}
+        };
+        const TopicEntry* previous = registry.topics.find(topic);
+        if (previous != nullptr) {
+            const EndpointRecord& old = previous->record;
+            if (old.ip != record.ip || old.port != record.port || old.endpoints != record.endpoints || old.shm != record.shm) {
+                event["event"] = "moved";
+            }
+        }
+        registry.topics.insert_or_assign(topic, make_topic_entry(std::move(record), reply));
+        registry.topic_index.insert(topic);
+        return event;
+    } else if (op == "unregister") {
+        string topic = mutation["topic"];
+        if (!registry.topics.erase(topic)) {
+            return nullptr;
+        }
+        registry.topic_index.erase(topic);
+        return {
+            {"event", mutation.value("reason", "unregister")},
+            {"topic", topic}
+        };
+    } else if (op == "set") {
+        // Sets logged before revisions existed take the next one
+        uint64_t revision = mutation.value("revision", registry.data_revision + 1);
+        string key = mutation["key"];
+        DataEntry& entry = registry.data[key];
+        entry.value = mutation["data"].get<string>();
+        entry.revision = revision;
+        entry.blob = mutation.contains("blob") ? manifest_from_json(mutation["blob"]) : nullptr;
+        registry.data_revision = max(registry.data_revision, revision);
+        json event = {
+            {"event", "set"},
+            {"key", key},
+            {"data", entry.value},
+            {"revision", revision}
+        };
+        if (entry.blob) {
+            event["blob"] = mutation["blob"];
+        }
+        return event;
+    } else if (op == "clear" || op == "reset") {
+        registry.topics.clear();
+        registry.topic_index.clear();
+        if (op == "reset") {
+            registry.data.clear();
+        }
+        return {{"event", "reset"}};
+    }
+    return nullptr;
+}
+
+/**
+ * Logs, replicates and applies one mutation inside update_registry().
+ *
+ * @return the event queued for it, or null
+ */
+json CentralNameServer::commit_mutation(RegistrySnapshot& registry, const json& mutation) {
+    log_mutation(mutation);
+    json event = apply_mutation(registry, mutation);
+    if (!event.is_null()) {
+        queue_event(event);
+    }
+    return event;
+}
+
+/**
+ * Starts the lease of every node that owns a topic, so the topics of nodes that are
+ * already gone expire even though they will never send a heartbeat here.
+ */
+void CentralNameServer::track_owners() {
+    auto snapshot = registry();
+    auto now = LivenessTracker::Clock::now();
+    lock_guard<mutex> lock(m_liveness_mtx);
+    snapshot->topics.for_each([&](const string&, const TopicEntry& entry) {
+        if (!entry.record.owner.empty()) {
+            m_liveness.grant(entry.record.owner, chrono::milliseconds(entry.record.lease_ms), now);
+        }
+    });
+}
+
+/**
+ * Rebuilds the registry from the state directory before any request is served. Owners of
+ * recovered topics are tracked from now on, so topics of nodes that died while the CNS
+ * was down still expire.
+ */
+void CentralNameServer::recover_registry(const string& state_directory) {
+    auto start = chrono::steady_clock::now();
+    m_store = make_unique<RegistryStore>(state_directory);
+    auto recovered = make_shared<RegistrySnapshot>();
+    size_t chunks = m_blobs->load();
+    size_t count = m_store->recover([&](const json& mutation) {
+        apply_mutation(*recovered, mutation);
+    });
+    m_registry = recovered;
+    track_owners();
+    LOG_INFO(m_logger, "Recovered {} topics, {} keys and {} blob chunks from {} ({} log records) in {:.1f} ms",
+             recovered->topics.size(), recovered->data.size(), chunks, state_directory, count,
+             chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+
+    for (const auto& entry : recovered->data) {
+        if (!entry.second.blob) {
+            continue;
+        }
+        size_t missing = count_if(entry.second.blob->chunks.begin(), entry.second.blob->chunks.end(),
+                                  [&](const string& chunk) { return !m_blobs->has(chunk); });
+        if (missing > 0) {
+            LOG_WARNING(m_logger, "Blob of key {} lost {} of its {} chunks, reads of it will fail", entry.first, missing,
+                        entry.second.blob->chunks.size());
+        }
+    }
+}
+
+/**
+ * Appends a mutation to the write-ahead log and streams it to standbys. Called with
+ * m_write_mtx held, before the mutated snapshot is published. A failed write is logged and
+ * the CNS keeps serving.
+ */
+void CentralNameServer::log_mutation(const json& mutation) {
+    json message = {
+        {"seq", ++m_replication_seq},
+        {"mutation", mutation}
+    };
+    string body = encode_cns_message(message, CnsEncoding::MSGPACK);
+    m_replication.send(zmq::buffer(body), zmq::send_flags::none);
+
+    if (!m_store) {
+        return;
+    }
+    try {
+        m_store->append(mutation);
+    } catch (const std::runtime_error& e) {
+        LOG_ERROR(m_logger, "Failed to persist registry change, compacting instead: {}", e.what());
+    }
+}
+
+/**
+ * Calls emit with mutations that rebuild the given registry from empty.
+ */
+template <typename Emit>
+static void emit_registry_state(const RegistrySnapshot& registry, Emit&& emit) {
+    registry.topics.for_each([&](const string& topic, const TopicEntry& entry) {
+        emit({
+            {"op", "register"},
+            {"topic", topic},
+            {"record", record_to_json(entry.record)}
+        });
+    });
+    for (const auto& entry : registry.data) {
+        json mutation = {
+            {"op", "set"},
+            {"key", entry.first},
+            {"data", entry.second.value},
+            {"revision", entry.second.revision}
+        };
+        if (entry.second.blob) {
+            mutation["blob"] = manifest_to_json(*entry.second.blob);
+        }
+        emit(std::move(mutation));
+    }
+}
+
+/**
+ * Replaces the snapshot with the given registry and empties the log. Called with
+ * m_write_mtx held.
+ */
+void CentralNameServer::compact_store(const RegistrySnapshot& registry) {
+    try {
+        m_store->compact([&](const RegistryStore::Apply& emit) {
+            emit_registry_state(registry, emit);
+        });
+        LOG_DEBUG(m_logger, "Compacted registry log into a snapshot of {} topics", registry.topics.size());
+    } catch (const std::runtime_error& e) {
+        LOG_ERROR(m_logger, "Failed to write registry snapshot: {}", e.what());
+    }
+}
+
+/**
+ * Answers a standby's "sync" request: the whole registry as mutations (starting with a
+ * reset) and the replication sequence number it is current as of. Streamed mutations with
+ * a higher number apply on top of it.
+ *
+ * @param standby "ip:port" of the standby, advertised to clients in sync events
+ */
+json CentralNameServer::sync_state(const string& standby) {
+    auto lock = lock_writes();
+    if (!standby.empty() && standby != m_advertised_standby) {
+        LOG_INFO(m_logger, "Standby CNS {} is following this one", standby);
+        m_advertised_standby = standby;
+    }
+    json mutations = json::array();
+    mutations.push_back({{"op", "reset"}});
+    emit_registry_state(*registry(), [&](json mutation) {
+        mutations.push_back(std::move(mutation));
+    });
+    return {
+        {"status", "success"},
+        {"seq", m_replication_seq},
+        {"mutations", std::move(mutations)}
+    };
+}
+
+/**
+ * Makes this standby the primary: it starts accepting writes and expiring nodes. Nodes
+ * that owned topics on the old primary get a full liveness timeout to move their
+ * heartbeats here.
+ */
+void CentralNameServer::promote() {
+    if (m_promoted.exchange(true)) {
+        return;
+    }
+    track_owners();
+    LOG_WARNING(m_logger, "Primary CNS {} is gone, this CNS is now the primary", m_primary_address);
+}
+
+/**
+ * Follows the primary as a standby. Subscribes to its mutation stream first, then asks for
+ * a full copy of the registry; stream messages that arrive in the meantime are held back
+ * and the ones newer than the copy applied on top of it. A gap in the sequence numbers
+ * means messages were lost, and the copy is fetched again.
+ *
+ * Blob chunks are not part of the stream: a replicated blob "set" is applied right away
+ * and its chunks are copied from the primary afterwards, one get_chunks batch per pass.
+ *
+ * Returns once promoted, which happens when nothing (not even the once a second ping) has
+ * come from the primary for CNS_FAILOVER_TIMEOUT_MS. A standby that never reached its
+ * primary does not promote itself, so starting it first cannot leave two primaries.
+ */
+void CentralNameServer::replication_loop() {
+    size_t colon = m_primary_address.rfind(':');
+    string primary_ip = m_primary_address.substr(0, colon);
+    int primary_port = stoi(m_primary_address.substr(colon + 1));
+
+    zmq::socket_t stream(m_context, zmq::socket_type::sub);
+    stream.set(zmq::sockopt::linger, 0);
+    stream.set(zmq::sockopt::subscribe, "");
+    stream.connect("tcp://" + primary_ip + ":" + to_string(primary_port + CNS_REPLICATION_PORT_OFFSET));
+
+    // REQ sockets cannot resend after a lost reply, so each sync attempt gets a fresh one
+    zmq::socket_t sync_socket;
+    bool sync_pending = false;
+    auto sync_sent = chrono::steady_clock::now();
+    auto request_sync = [&]() {
+        sync_socket = zmq::socket_t(m_context, zmq::socket_type::req);
+        sync_socket.set(zmq::sockopt::linger, 0);
+        sync_socket.connect("tcp://" + m_primary_address);
+        string body = encode_cns_message({
+            {"self", m_topic},
+            {"action", "sync"},
+            {"standby", m_address}
+        }, CnsEncoding::MSGPACK);
+        sync_socket.send(zmq::buffer(body), zmq::send_flags::none);
+        sync_pending = true;
+        sync_sent = chrono::steady_clock::now();
+    };
+
+    const auto failover_timeout = chrono::milliseconds(CNS_FAILOVER_TIMEOUT_MS);
+    uint64_t applied = 0;
+    bool synced = false;
+    bool ever_synced = false;
+    vector<json> held_back;
+    auto last_heard = chrono::steady_clock::now();
+    request_sync();
+
+    vector<string> wanted_chunks;  // of replicated blobs, still to be copied from the primary
+    auto next_fetch = chrono::steady_clock::now();
+    auto replicate = [&](RegistrySnapshot& registry, const json& mutation) {
+        commit_mutation(registry, mutation);
+        if (mutation.contains("blob")) {
+            for (const json& chunk : mutation["blob"]["chunks"]) {
+                if (!m_blobs->has(chunk.get_ref<const string&>())) {
+                    wanted_chunks.push_back(chunk);
+                }
+            }
+        }
+    };
+
+    while (!m_atomic_stop.load(std::memory_order_relaxed)) {
+        try {
+            zmq::pollitem_t items[] = {
+                { stream, 0, ZMQ_POLLIN, 0 },
+                { sync_socket, 0, ZMQ_POLLIN, 0 }
+            };
+            bool fetch_due = !wanted_chunks.empty() && chrono::steady_clock::now() >= next_fetch;
+            zmq::poll(items, sync_pending ? 2 : 1, std::chrono::milliseconds(fetch_due ? 0 : 100));
+            auto now = chrono::steady_clock::now();
+
+            if (items[0].revents & ZMQ_POLLIN) {
+                zmq::message_t msg;
+                while (stream.recv(msg, zmq::recv_flags::dontwait)) {
+                    last_heard = now;
+                    json message = decode_cns_message(msg.data(), msg.size());
+                    uint64_t seq = message.value("seq", uint64_t(0));
+                    if (!synced) {
+                        if (message.contains("mutation")) {
+                            held_back.push_back(std::move(message));
+                        }
+                    } else if (seq <= applied && (message.contains("mutation") || seq == applied)) {
+                        continue;
+                    } else if (seq == applied + 1 && message.contains("mutation")) {
+                        update_registry([&](RegistrySnapshot& registry) {
+                            replicate(registry, message["mutation"]);
+                        });
+                        applied = seq;
+                    } else if (!sync_pending) {
+                        // Ahead of us we missed something, behind us the primary restarted
+                        LOG_WARNING(m_logger, "Replication stream at {} but standby at {}, resyncing", seq, applied);
+                        synced = false;
+                        held_back.clear();
+                        if (message.contains("mutation")) {
+                            held_back.push_back(std::move(message));
+                        }
+                        request_sync();
+                    }
+                }
+            }
+
+            if (sync_pending && (items[1].revents & ZMQ_POLLIN)) {
+                zmq::message_t msg;
+                if (sync_socket.recv(msg, zmq::recv_flags::dontwait)) {
+                    sync_pending = false;
+                    last_heard = now;
+                    json reply = decode_cns_message(msg.data(), msg.size());
+                    applied = reply.value("seq", uint64_t(0));
+                    sort(held_back.begin(), held_back.end(), [](const json& a, const json& b) {
+                        return a["seq"].get<uint64_t>() < b["seq"].get<uint64_t>();
+                    });
+                    bool gap = false;
+                    update_registry([&](RegistrySnapshot& registry) {
+                        for (const json& mutation : reply["mutations"]) {
+                            replicate(registry, mutation);
+                        }
+                        for (const json& message : held_back) {
+                            uint64_t seq = message["seq"].get<uint64_t>();
+                            if (seq <= applied) {
+                                continue;
+                            }
+                            if (seq != applied + 1) {
+                                gap = true;
+                                break;
+                            }
+                            replicate(registry, message["mutation"]);
+                            applied = seq;
+                        }
+                    });
+                    held_back.clear();
+                    if (gap) {
+                        request_sync();
+                    } else {
+                        synced = true;
+                        if (!ever_synced) {
+                            LOG_INFO(m_logger, "Synced {} topics from primary CNS {} at mutation {}",
+                                     registry()->topics.size(), m_primary_address, applied);
+                        }
+                        ever_synced = true;
+                    }
+                }
+            } else if (sync_pending && now - sync_sent > failover_timeout) {
+                request_sync();
+            }
+
+            if (fetch_due && !fetch_chunks(wanted_chunks)) {
+                next_fetch = now + chrono::milliseconds(CNS_HEARTBEAT_INTERVAL_MS);
+            }
+
+            if (ever_synced && now - last_heard > failover_timeout) {
+                if (!wanted_chunks.empty()) {
+                    LOG_WARNING(m_logger, "Promoting with {} blob chunks not copied yet, reads of their blobs will fail",
+                                wanted_chunks.size());
+                }
+                promote();
+                return;
+            }
+        } catch (const zmq::error_t& err) {
+            if (err.num() == ETERM) {
+                return;
+            }
+            LOG_ERROR(m_logger, "ZMQ error while following primary CNS: {}", err.what());
+        } catch (const json::exception& e) {
+            LOG_ERROR(m_logger, "Bad message from primary CNS: {}", e.what());
+        }
+    }
+}
+
+/**
+ * Copies one get_chunks batch of wanted chunks from the primary, on a fresh REQ socket so
+ * a primary that does not answer leaves nothing stuck. Chunks the primary no longer has
+ * were dropped with the blobs that used them and are not asked for again.
+ *
+ * @param wanted chunk hashes to copy; the ones dealt with are removed
+ * @return false if the primary did not answer
+ */
+bool CentralNameServer::fetch_chunks(vector<string>& wanted) {
+    wanted.erase(remove_if(wanted.begin(), wanted.end(), [&](const string& chunk) { return m_blobs->has(chunk); }),
+                 wanted.end());
+    if (wanted.empty()) {
+        return true;
+    }
+    size_t batch = min(wanted.size(), max<size_t>(1, CNS_MAX_BLOB_READ / CNS_BLOB_CHUNK_SIZE));
+    vector<string> chunks(wanted.begin(), wanted.begin() + batch);
+
+    zmq::socket_t socket(m_context, zmq::socket_type::req);
+    socket.set(zmq::sockopt::linger, 0);
+    socket.set(zmq::sockopt::rcvtimeo, CNS_HEARTBEAT_INTERVAL_MS);
+    socket.connect("tcp://" + m_primary_address);
+    string body = encode_cns_message({
+        {"self", m_topic},
+        {"action", "get_chunks"},
+        {"chunks", chunks}
+    }, CnsEncoding::MSGPACK);
+    socket.send(zmq::buffer(body), zmq::send_flags::none);
+    vector<zmq::message_t> reply;
+    if (!zmq::recv_multipart(socket, std::back_inserter(reply)) || reply.empty()) {
+        return false;
+    }
+
+    json served = decode_cns_message(reply[0].data(), reply[0].size()).value("chunks", json::array());
+    for (size_t i = 0; i < served.size() && i + 1 < reply.size(); i++) {
+        try {
+            string hash = m_blobs->put(reply[i + 1].to_string());
+            if (hash != served[i].get<string>()) {
+                LOG_WARNING(m_logger, "Primary CNS sent chunk {} for {}", hash, served[i].get<string>());
+            }
+        } catch (const std::runtime_error& e) {
+            LOG_ERROR(m_logger, "Failed to store replicated blob chunk: {}", e.what());
+            return false;
+        }
+    }
+    if (served.size() < chunks.size()) {
+        LOG_WARNING(m_logger, "Primary CNS no longer has {} blob chunks", chunks.size() - served.size());
+    }
+    wanted.erase(wanted.begin(), wanted.begin() + batch);
+    return true;
+}
+
+void CentralNameServer::register_node(string topic, EndpointRecord record) {
+    LOG_INFO(m_logger, "Registering node {} at {}:{}", topic, record.ip, record.port);
+    // The lease starts now rather than at the owner's first heartbeat, so a node that dies
+    // right after registering, or never sends heartbeats, does not keep its topics forever
+    if (!record.owner.empty()) {
+        grant_lease(record.owner, record.lease_ms);
+    }
+    json mutation = {
+        {"op", "register"},
+        {"topic", topic},
+        {"record", record_to_json(record)}
+    };
+    update_registry([&](RegistrySnapshot& registry) {
+        if (registry.topics.find(topic) != nullptr) {
+            LOG_ERROR(m_logger, "Node {} already registered! Overwriting...", topic);
+        }
+        commit_mutation(registry, mutation);
+
+        LOG_DEBUG(m_logger, "All registered nodes:");
+        registry.topics.for_each([&](const string& name, const TopicEntry& registered) {
+            LOG_DEBUG(m_logger, "{}: {}:{} {}", name, registered.record.ip, registered.record.port, registered.record.shm);
+        });
+    });
 }
 
 void CentralNameServer::unregister_node(string topic) {
     LOG_INFO(m_logger, "Unregistering node {}", topic);
-    if (m_registered_topics.find(topic) == m_registered_topics.end()) {
-        LOG_ERROR(m_logger, "Node {} not registered", topic);
+    update_registry([&](RegistrySnapshot& registry) {
+        if (registry.topics.find(topic) == nullptr) {
+            LOG_ERROR(m_logger, "Node {} not registered", topic);
+            return;
+        }
+        commit_mutation(registry, {
+            {"op", "unregister"},
+            {"topic", topic}
+        });
+    });
+}
+
+void CentralNameServer::record_heartbeat(const string& node) {
+    bool came_online;
+    {
+        lock_guard<mutex> lock(m_liveness_mtx);
+        came_online = m_liveness.beat(node, LivenessTracker::Clock::now());
+    }
+    if (came_online) {
+        LOG_INFO(m_logger, "Node {} is online", node);
+    }
+}
+
+void CentralNameServer::grant_lease(const string& node, int64_t lease_ms) {
+    bool came_online;
+    {
+        lock_guard<mutex> lock(m_liveness_mtx);
+        came_online = m_liveness.grant(node, chrono::milliseconds(lease_ms), LivenessTracker::Clock::now());
+    }
+    if (came_online) {
+        LOG_INFO(m_logger, "Node {} is online", node);
+    }
+}
+
+/**
+ * Drains the heartbeat socket. Malformed heartbeats are dropped; nothing is logged per
+ * heartbeat so thousands of nodes do not flood the log.
+ */
+void CentralNameServer::receive_heartbeats() {
+    zmq::message_t msg;
+    while (m_heartbeats.recv(msg, zmq::recv_flags::dontwait)) {
+        try {
+            json heartbeat = decode_cns_message(msg.data(), msg.size());
+            if (heartbeat.contains("self") && heartbeat["self"].is_string()) {
+                record_heartbeat(heartbeat["self"].get_ref<const string&>());
+            }
+        } catch (const json::exception&) {
+            continue;
+        }
+    }
+}
+
+/**
+ * Marks nodes whose lease ran out offline and expires the topics they own. Each expiry is
+ * published as an "expired" event, so subscribers stop using the endpoint right away. The
+ * nodes are then forgotten, so the tracker and the "nodes" reply only hold live nodes.
+ */
+void CentralNameServer::expire_offline_nodes() {
+    vector<string> offline;
+    {
+        lock_guard<mutex> lock(m_liveness_mtx);
+        offline = m_liveness.advance(LivenessTracker::Clock::now());
+    }
+    if (offline.empty()) {
         return;
     }
-    m_registered_topics.erase(topic);
+    for (const string& node : offline) {
+        LOG_WARNING(m_logger, "Lease of node {} ran out without a heartbeat, marking it offline", node);
+    }
+
+    unordered_set<string> owners(offline.begin(), offline.end());
+    update_registry([&](RegistrySnapshot& registry) {
+        vector<string> expired;
+        registry.topics.for_each([&](const string& topic, const TopicEntry& entry) {
+            if (owners.count(entry.record.owner) != 0) {
+                expired.push_back(topic);
+            }
+        });
+        for (const string& topic : expired) {
+            LOG_INFO(m_logger, "Expiring topic {}", topic);
+            commit_mutation(registry, {
+                {"op", "unregister"},
+                {"topic", topic},
+                {"reason", "expired"}
+            });
+        }
+    });
+
+    // They own nothing now, so unless one came back meanwhile they need not be kept around
+    lock_guard<mutex> lock(m_liveness_mtx);
+    for (const string& node : offline) {
+        if (!m_liveness.is_online(node)) {
+            m_liveness.forget(node);
+        }
+    }
+}
+
+vector<NodeInfo> CentralNameServer::registered_nodes() {
+    vector<NodeInfo> nodes;
+    auto now = LivenessTracker::Clock::now();
+    {
+        lock_guard<mutex> lock(m_liveness_mtx);
+        m_liveness.for_each([&](const string& node, bool online, LivenessTracker::Clock::time_point last_beat) {
+            NodeInfo info;
+            info.name = node;
+            info.online = online;
+            info.secondsSinceLastHeartbeat = static_cast<int>(chrono::duration_cast<chrono::seconds>(now - last_beat).count());
+            nodes.push_back(std::move(info));
+        });
+    }
+
+    unordered_map<string, size_t> index;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        index[nodes[i].name] = i;
+    }
+    auto snapshot = registry();
+    snapshot->topics.for_each([&](const string& topic, const TopicEntry& entry) {
+        auto owner = index.find(entry.record.owner);
+        if (owner != index.end()) {
+            nodes[owner->second].topics.push_back(topic);
+        }
+    });
+    return nodes;
+}
+
+/**
+ * Moves one complete multipart message from one socket to the other.
+ */
+static void forward_message(zmq::socket_t& from, zmq::socket_t& to) {
+    zmq::message_t part;
+    while (from.recv(part, zmq::recv_flags::dontwait)) {
+        bool more = part.more();
+        to.send(part, more ? zmq::send_flags::sndmore : zmq::send_flags::none);
+        if (!more) {
+            return;
+        }
+    }
 }
 
 void CentralNameServer::reply_loop() {
     while (!m_atomic_stop.load(std::memory_order_relaxed)) {
         zmq::pollitem_t items[] = {
-            { m_socket, 0, ZMQ_POLLIN, 0 }
+            { m_socket, 0, ZMQ_POLLIN, 0 },
+            { m_backend, 0, ZMQ_POLLIN, 0 },
+            { m_heartbeats, 0, ZMQ_POLLIN, 0 },
+            { m_wakeup_sink, 0, ZMQ_POLLIN, 0 }
         };
         
-        // Poll with 100ms timeout
         try {
-            zmq::poll(items, 1, std::chrono::milliseconds(500));
+            // Short timeout so parked waits time out within a wheel tick or so
+            zmq::poll(items, 4, std::chrono::milliseconds(100));
+            if (items[0].revents & ZMQ_POLLIN) {
+                forward_message(m_socket, m_backend);
+            }
+            if (items[1].revents & ZMQ_POLLIN) {
+                forward_message(m_backend, m_socket);
+            }
+            if (items[2].revents & ZMQ_POLLIN) {
+                receive_heartbeats();
+            }
+            if (items[3].revents & ZMQ_POLLIN) {
+                zmq::message_t wakeup;
+                while (m_wakeup_sink.recv(wakeup, zmq::recv_flags::dontwait)) {
+                }
+            }
+            answer_waits();
         } catch (const zmq::error_t& err) {
             if (err.num() == ETERM) {
                 LOG_INFO(m_logger, "ZMQ context shutdown");
                 return;
             }
+            if (err.num() == EINTR) {
+                continue;  // a signal, maybe the one that stops us
+            }
             LOG_ERROR(m_logger, "ZMQ error not due to context shutting down");
             continue;
         }
-        
-        if (items[0].revents & ZMQ_POLLIN) {
-            try {
-                zmq::message_t message;
-                auto result = m_socket.recv(message);
-                if (!result.has_value()) {
-                    continue;
+    }
+}
+
+/**
+ * Everything that takes m_write_mtx on a timer: expiring offline nodes, the sync event and
+ * replication ping, compacting the registry log once it is due and collecting unused blob
+ * chunks. Kept off reply_loop(), so a compaction, which writes and fsyncs a whole snapshot,
+ * only holds up writers and never the forwarding of requests.
+ */
+void CentralNameServer::maintenance_loop() {
+    auto last_sync = chrono::steady_clock::now();
+    auto last_blob_gc = last_sync;
+    while (!m_atomic_stop.load(std::memory_order_relaxed)) {
+        this_thread::sleep_for(chrono::milliseconds(MAINTENANCE_INTERVAL_MS));
+        try {
+            if (!is_standby()) {
+                expire_offline_nodes();
+            }
+            auto now = chrono::steady_clock::now();
+            {
+                lock_guard<mutex> lock(m_write_mtx);
+                if (now - last_sync >= chrono::milliseconds(CNS_EVENT_SYNC_INTERVAL_MS)) {
+                    json sync = {{"event", "sync"}};
+                    if (!m_advertised_standby.empty()) {
+                        sync["standby"] = m_advertised_standby;
+                    }
+                    publish_event(std::move(sync));
+                    // Lets standbys tell a quiet primary from a dead one
+                    string ping = encode_cns_message({{"seq", m_replication_seq}}, CnsEncoding::MSGPACK);
+                    m_replication.send(zmq::buffer(ping), zmq::send_flags::none);
+                    last_sync = now;
+                }
+                if (m_store && m_store->needs_compaction()) {
+                    compact_store(*registry());
                 }
+            }
+            if (now - last_blob_gc >= chrono::milliseconds(BLOB_GC_INTERVAL_MS)) {
+                collect_blobs();
+                last_blob_gc = now;
+            }
+        } catch (const zmq::error_t& err) {
+            if (err.num() == ETERM) {
+                break;
+            }
+            LOG_ERROR(m_logger, "ZMQ error in CNS maintenance: {}", err.what());
+        }
+    }
+}
+
+/**
+ * One worker. Requests arrive as the routing envelope (identity frames up to and including
+ * the empty delimiter) followed by the request body and, for put_chunk, the chunk; the
+ * reply goes back behind the same envelope, followed by any chunk frames it carries.
+ */
+void CentralNameServer::worker_loop(int worker_id) {
+    zmq::socket_t socket(m_context, zmq::socket_type::dealer);
+    socket.set(zmq::sockopt::linger, 0);
+    socket.connect(CNS_WORKER_ENDPOINT);
+    LOG_DEBUG(m_logger, "CNS worker {} started", worker_id);
+
+    vector<zmq::message_t> frames;
+    vector<zmq::message_t> reply_frames;
+    while (!m_atomic_stop.load(std::memory_order_relaxed)) {
+        zmq::pollitem_t items[] = {
+            { socket, 0, ZMQ_POLLIN, 0 }
+        };
 
-                json request = json::parse(message.to_string());
+        try {
+            zmq::poll(items, 1, std::chrono::milliseconds(500));
+            if (!(items[0].revents & ZMQ_POLLIN)) {
+                continue;
+            }
 
-                // validate the request
-                if (!validate_request(request)) {
-                    LOG_ERROR(m_logger, "Invalid request: {}", message.to_string());
+            frames.clear();
+            if (!zmq::recv_multipart(socket, std::back_inserter(frames))) {
+                continue;
+            }
+            size_t delimiter = 0;
+            while (delimiter < frames.size() && frames[delimiter].size() != 0) {
+                delimiter++;
+            }
+            if (delimiter + 1 >= frames.size()) {
+                LOG_ERROR(m_logger, "Dropping request without envelope or body ({} frames)", frames.size());
+                continue;
+            }
+
+            // Requests may be JSON text or a binary encoding marked by a leading type byte;
+            // the reply uses the same encoding. Lookups of registered topics are answered
+            // straight from the cached reply, the snapshot is held until the send so the
+            // cached string stays alive.
+            CnsEncoding encoding = CnsEncoding::JSON;
+            shared_ptr<const RegistrySnapshot> snapshot;
+            const string* reply = nullptr;
+            string response_str;
+            reply_frames.clear();
+            try {
+                const zmq::message_t& body = frames[delimiter + 1];
+                json request = decode_cns_message(body.data(), body.size(), &encoding);
+                string action = request.value("action", "");
+                if (action == "wait_for" && validate_request(request)
+                        && park_wait(request, frames, delimiter, encoding)) {
                     continue;
                 }
-
-                string action = request["action"];
-                json response_data;
-                
-                if (action != "heartbeat") {
-                    LOG_INFO(m_logger, "Received request: {}", message.to_string());
-                }
-
-                if (action == "heartbeat") {
-                    response_data = {
-                        {"status", "success"}
-                    };
-                    string self = request["self"];
-                    LOG_INFO(m_logger, "Received heartbeat from {}", self);
-                } else if (action == "register") {
-                    string topic = request["topic"];
-                    string ip_address = request["ip"];
-                    int port = request["port"];
-                    register_node(topic, ip_address, port);
-                    response_data = {
-                        {"status", "success"},
-                        {"topic", topic},
-                        {"ip", ip_address},
-                        {"port", port}
-                    };
-                } else if (action == "unregister") {
-                    string topic = request["topic"];
-                    unregister_node(topic);
-                    response_data = {
-                        {"status", "success"},
-                        {"topic", topic}
-                    };
-                } else if (action == "lookup") {
-                    string topic = request["topic"];
-                    string node_info;
-                    m_registered_topics.find(topic) != m_registered_topics.end() ? node_info = m_registered_topics[topic] : node_info = "";
-                    if (!node_info.empty()) {
-                        size_t colon_pos = node_info.find(':');
-                        string ip = node_info.substr(0, colon_pos);
-                        int port = stoi(node_info.substr(colon_pos + 1));
-                        response_data = {
-                            {"status", "success"},
-                            {"topic", topic},
-                            {"found", true},
-                            {"ip", ip},
-                            {"port", port}
-                        };
-                    } else {
-                        response_data = {
-                            {"status", "success"},
-                            {"topic", topic},
-                            {"found", false}
-                        };
-                    }
-                } else if (action == "get") {
-                    string key = request["key"];
-                    string data;
-                    m_data_storage.find(key) != m_data_storage.end() ? data = m_data_storage[key] : data = "";
-                    if (!data.empty()) {
-                        response_data = {
-                            {"status", "success"},
-                            {"key", key},
-                            {"found", true},
-                            {"data", data}
-                        };
-                    } else {
-                        response_data = {
-                            {"status", "success"},
-                            {"topic", key},
-                            {"found", false}
-                        };
+                if ((action == "put_chunk" || action == "get_chunks" || action == "read_blob") && validate_request(request)) {
+                    const zmq::message_t* chunk = frames.size() > delimiter + 2 ? &frames[delimiter + 2] : nullptr;
+                    response_str = encode_cns_message(handle_blob_request(request, chunk, reply_frames), encoding);
+                    reply = &response_str;
+                }
+                if (reply == nullptr && action == "lookup" && request.contains("self")
+                        && request.contains("topic") && request["topic"].is_string()) {
+                    snapshot = registry();
+                    const TopicEntry* entry = snapshot->topics.find(request["topic"].get_ref<const string&>());
+                    if (entry != nullptr) {
+                        reply = &entry->lookup_replies[static_cast<size_t>(encoding)];
                     }
-                } else if (action == "set") {
-                    string key = request["key"];
-                    m_data_storage[key] = request["data"];
-                    response_data = {
-                        {"status", "success"},
-                        {"key", key}
-                    };
-                } else {
-                    response_data = {
-                        {"status", "error"},
-                        {"message", "Invalid action"}
-                    };
                 }
-
-                // send reply
-                zmq::message_t response_msg(response_data.dump().c_str(), response_data.dump().size());
-                if (!m_socket.send(response_msg, zmq::send_flags::none).has_value()) {
-                    string action_str = action;
-                    string topic_str = request["topic"];
-                    LOG_ERROR(m_logger, "Failed to send response to for action {} to topic {}", action_str, topic_str);
+                if (reply == nullptr) {
+                    response_str = encode_cns_message(handle_request(request), encoding);
                 }
-
             } catch (const json::exception& e) {
-                LOG_ERROR(m_logger, "JSON parsing error: {}", e.what());
-            } catch (const zmq::error_t& err) {
-                if (err.num() == ETERM) {
-                    LOG_INFO(m_logger, "ZMQ context shutdown");
-                    return;
+                LOG_ERROR(m_logger, "Request parsing error ({}): {}", cns_encoding_name(encoding), e.what());
+                reply = nullptr;
+                reply_frames.clear();
+                response_str = encode_cns_message({
+                    {"status", "error"},
+                    {"message", e.what()}
+                }, encoding);
+            }
+            if (reply == nullptr) {
+                reply = &response_str;
+            }
+
+            // send reply behind the original envelope
+            for (size_t i = 0; i <= delimiter; i++) {
+                socket.send(frames[i], zmq::send_flags::sndmore);
+            }
+            socket.send(zmq::buffer(*reply), reply_frames.empty() ? zmq::send_flags::none : zmq::send_flags::sndmore);
+            for (size_t i = 0; i < reply_frames.size(); i++) {
+                socket.send(reply_frames[i], i + 1 < reply_frames.size() ? zmq::send_flags::sndmore : zmq::send_flags::none);
+            }
+        } catch (const zmq::error_t& err) {
+            if (err.num() == ETERM) {
+                break;
+            }
+            LOG_ERROR(m_logger, "ZMQ error in CNS worker {}: {}", worker_id, err.what());
+        }
+    }
+    LOG_DEBUG(m_logger, "CNS worker {} stopped", worker_id);
+}
+
+json CentralNameServer::handle_request(const json& request) {
+    // validate the request
+    if (!validate_request(request)) {
+        return {
+            {"status", "error"},
+            {"message", "Invalid request"}
+        };
+    }
+
+    string action = request["action"];
+    json response_data;
+
+    if (is_standby() && (action == "register" || action == "unregister" || action == "set")) {
+        return {
+            {"status", "error"},
+            {"message", "Standby CNS, send writes to the primary " + m_primary_address}
+        };
+    }
+    
+    if (action == "heartbeat") {
+        // Nodes that still send heartbeats as requests count the same as pushed ones
+        record_heartbeat(request["self"].get<string>());
+        response_data = {
+            {"status", "success"}
+        };
+    } else if (action == "register") {
+        LOG_DEBUG(m_logger, "Received request: {}", request.dump());
+        string topic = request["topic"];
+        string ip_address = request["ip"];
+        int port = request["port"];
+        EndpointRecord record;
+        record.ip = ip_address;
+        record.port = port;
+        record.host = request.value("host", "");
+        record.shm = request.value("shm", "");
+        record.endpoints = request.value("endpoints", vector<string>());
+        record.pid = request.value("pid", -1);
+        record.context = request.value("context", "");
+        record.owner = request["self"].get<string>();
+        record.registered_at = chrono::duration_cast<chrono::milliseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        // Never shorter than the heartbeat timeout, which is what renews it
+        record.lease_ms = clamp<int64_t>(request.value("lease_ms", int64_t(0)), m_liveness.timeout().count(),
+                                         max<int64_t>(CNS_MAX_LEASE_MS, m_liveness.timeout().count()));
+        int64_t lease_ms = record.lease_ms;
+        register_node(topic, std::move(record));
+        response_data = {
+            {"status", "success"},
+            {"topic", topic},
+            {"ip", ip_address},
+            {"port", port},
+            {"lease_ms", lease_ms}
+        };
+    } else if (action == "unregister") {
+        string topic = request["topic"];
+        unregister_node(topic);
+        response_data = {
+            {"status", "success"},
+            {"topic", topic}
+        };
+    } else if (action == "lookup" || action == "wait_for") {
+        // A wait_for that reaches here was not parked, so it is answered like a lookup
+        string topic = request["topic"];
+        auto snapshot = registry();
+        const TopicEntry* entry = snapshot->topics.find(topic);
+        if (entry != nullptr) {
+            response_data = lookup_reply(topic, entry->record);
+        } else {
+            response_data = {
+                {"status", "success"},
+                {"topic", topic},
+                {"found", false}
+            };
+        }
+    } else if (action == "query") {
+        // A prefix is the glob pattern prefix + "**"
+        string pattern = request.contains("prefix") ? request["prefix"].get<string>() + "**" : request["pattern"].get<string>();
+        size_t limit = clamp<size_t>(request.value("limit", CNS_DEFAULT_QUERY_LIMIT), 1, CNS_MAX_QUERY_LIMIT);
+        string after = request.value("after", "");
+        string last;
+        auto snapshot = registry();
+        json topics = json::array();
+        bool more = snapshot->topic_index.match(pattern, after, limit, [&](const string& topic) {
+            last = topic;
+            const TopicEntry* entry = snapshot->topics.find(topic);
+            if (entry != nullptr) {
+                topics.push_back(lookup_reply(topic, entry->record));
+            }
+        });
+        response_data = {
+            {"status", "success"},
+            {"pattern", pattern},
+            {"topics", std::move(topics)}
+        };
+        if (more) {
+            // Cursor for the next page
+            response_data["next"] = last;
+        }
+    } else if (action == "get") {
+        string key = request["key"];
+        auto snapshot = registry();
+        auto entry = snapshot->data.find(key);
+        if (entry != snapshot->data.end() && !entry->second.value.empty()) {
+            response_data = {
+                {"status", "success"},
+                {"key", key},
+                {"found", true},
+                {"data", entry->second.value},
+                {"revision", entry->second.revision}
+            };
+            if (entry->second.blob) {
+                response_data["blob"] = manifest_to_json(*entry->second.blob);
+            }
+        } else {
+            response_data = {
+                {"status", "success"},
+                {"topic", key},
+                {"found", false}
+            };
+        }
+    } else if (action == "mget") {
+        // Every entry comes from the same snapshot, so they are consistent with each other
+        // and with the store revision returned alongside
+        auto snapshot = registry();
+        json entries = json::array();
+        auto add_entry = [&](const string& key, const DataEntry* entry) {
+            if (entry != nullptr && !entry->value.empty()) {
+                entries.push_back({
+                    {"key", key},
+                    {"found", true},
+                    {"data", entry->value},
+                    {"revision", entry->revision}
+                });
+                if (entry->blob) {
+                    entries.back()["blob"] = manifest_to_json(*entry->blob);
                 }
-                LOG_ERROR(m_logger, "ZMQ error not due to context shutting down");
-                continue;
+            } else {
+                entries.push_back({
+                    {"key", key},
+                    {"found", false}
+                });
+            }
+        };
+        if (request.contains("prefix")) {
+            const string& prefix = request["prefix"].get_ref<const string&>();
+            for (auto it = snapshot->data.lower_bound(prefix);
+                 it != snapshot->data.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+                if (!it->second.value.empty()) {
+                    add_entry(it->first, &it->second);
+                }
+            }
+        } else {
+            for (const json& key : request["keys"]) {
+                auto entry = snapshot->data.find(key.get_ref<const string&>());
+                add_entry(key, entry != snapshot->data.end() ? &entry->second : nullptr);
+            }
+        }
+        response_data = {
+            {"status", "success"},
+            {"revision", snapshot->data_revision},
+            {"entries", std::move(entries)}
+        };
+    } else if (action == "set" && request.contains("blob")) {
+        // The chunks were uploaded with put_chunk, this ties them to the key
+        json error;
+        auto blob = make_blob_manifest(request["blob"], error);
+        if (blob) {
+            response_data = set_data(request["key"], CNS_BLOB_REF_PREFIX + blob->hash,
+                                     request.value("expected_revision", int64_t(-1)), blob);
+        } else {
+            response_data = std::move(error);
+        }
+    } else if (action == "set") {
+        response_data = set_data(request["key"], request["data"], request.value("expected_revision", int64_t(-1)));
+    } else if (action == "blob_missing") {
+        // Chunks found are kept for another grace period, the client is about to use them
+        json missing = json::array();
+        for (const json& chunk : request["chunks"]) {
+            if (!m_blobs->touch(chunk.get_ref<const string&>())) {
+                missing.push_back(chunk);
             }
         }
+        response_data = {
+            {"status", "success"},
+            {"missing", std::move(missing)}
+        };
+    } else if (action == "put_chunk" || action == "get_chunks" || action == "read_blob") {
+        // Only reachable from a batch, which has no frames to carry chunks in
+        response_data = {
+            {"status", "error"},
+            {"message", action + " cannot be batched"}
+        };
+    } else if (action == "nodes") {
+        json nodes = json::array();
+        for (const NodeInfo& info : registered_nodes()) {
+            nodes.push_back({
+                {"node", info.name},
+                {"online", info.online},
+                {"seconds_since_heartbeat", info.secondsSinceLastHeartbeat},
+                {"topics", info.topics}
+            });
+        }
+        response_data = {
+            {"status", "success"},
+            {"nodes", std::move(nodes)}
+        };
+    } else if (action == "sync") {
+        response_data = sync_state(request.value("standby", ""));
+    } else if (action == "status") {
+        auto lock = lock_writes();
+        response_data = {
+            {"status", "success"},
+            {"role", is_standby() ? "standby" : "primary"},
+            {"seq", m_replication_seq},
+            {"topics", registry()->topics.size()}
+        };
+        if (!m_advertised_standby.empty()) {
+            response_data["standby"] = m_advertised_standby;
+        }
+    } else if (action == "batch") {
+        // Operations are applied in order, each as if it had been sent on its own
+        json results = json::array();
+        auto handle_operations = [&]() {
+            for (const json& operation : request["requests"]) {
+                if (!operation.is_object() || operation.value("action", "") == "batch") {
+                    results.push_back({
+                        {"status", "error"},
+                        {"message", "Invalid batch operation"}
+                    });
+                    continue;
+                }
+                json op = operation;
+                if (!op.contains("self")) {
+                    op["self"] = request["self"];
+                }
+                try {
+                    results.push_back(handle_request(op));
+                } catch (const json::exception& e) {
+                    // e.g. a field of the wrong type; the other operations still go ahead
+                    results.push_back({
+                        {"status", "error"},
+                        {"message", e.what()}
+                    });
+                }
+            }
+        };
+        bool writes = std::any_of(request["requests"].begin(), request["requests"].end(), [](const json& op) {
+            string op_action = op.is_object() ? op.value("action", "") : "";
+            return op_action == "register" || op_action == "unregister" || op_action == "set";
+        });
+        if (writes) {
+            // All writes go to one copy of the registry, which is swapped in once
+            batch_update(handle_operations);
+        } else {
+            handle_operations();
+        }
+        LOG_DEBUG(m_logger, "Handled batch of {} operations from {}", results.size(), request["self"].get<string>());
+        response_data = {
+            {"status", "success"},
+            {"results", std::move(results)}
+        };
+    } else {
+        response_data = {
+            {"status", "error"},
+            {"message", "Invalid action"}
+        };
     }
+    return response_data;
 }
 
 
@@ -199,7 +1472,22 @@ string topic_to_node(string topic) {
     return node;
 }
 
-bool CentralNameServer::validate_request(json request) {
+/**
+ * @return true if j is an array of 1 to max_size hex SHA-256 strings
+ */
+static bool is_hash_list(const json& j, size_t max_size) {
+    return j.is_array() && !j.empty() && j.size() <= max_size && all_of(j.begin(), j.end(), [](const json& hash) {
+        return hash.is_string() && hash.get_ref<const string&>().size() == 64;
+    });
+}
+
+static bool valid_blob(const json& blob) {
+    return blob.is_object() && blob.contains("size") && blob["size"].is_number_unsigned()
+        && blob.contains("chunks") && is_hash_list(blob["chunks"], CNS_MAX_BLOB_SIZE / CNS_BLOB_CHUNK_SIZE)
+        && (!blob.contains("hash") || blob["hash"].is_string());
+}
+
+bool CentralNameServer::validate_request(const json& request) {
     /** Expected format:
     * {
     *     "action": "register" | "unregister" | "lookup",
@@ -226,19 +1514,81 @@ bool CentralNameServer::validate_request(json request) {
             LOG_ERROR(m_logger, "Missing topic, ip, or port field. Request: {}", request.dump());
             return false;
         }
+        if (request.contains("lease_ms") && !request["lease_ms"].is_number_integer()) {
+            LOG_ERROR(m_logger, "lease_ms must be an integer. Request: {}", request.dump());
+            return false;
+        }
+    } else if (request["action"] == "wait_for") {
+        if (!request.contains("topic") || !request["topic"].is_string()
+                || !request.contains("timeout_ms") || !request["timeout_ms"].is_number_integer()) {
+            LOG_ERROR(m_logger, "Missing topic or timeout_ms field. Request: {}", request.dump());
+            return false;
+        }
     } else if (request["action"] == "unregister" || request["action"] == "lookup") {
         if (!request.contains("topic")) {
             LOG_ERROR(m_logger, "Missing topic field. Request: {}", request.dump());
             return false;
         }
+    } else if (request["action"] == "query") {
+        bool has_pattern = request.contains("pattern") && request["pattern"].is_string();
+        bool has_prefix = request.contains("prefix") && request["prefix"].is_string()
+            && request["prefix"].get_ref<const string&>().find('*') == string::npos;
+        if (has_pattern == has_prefix || (request.contains("limit") && !request["limit"].is_number_unsigned())
+                || (request.contains("after") && !request["after"].is_string())) {
+            LOG_ERROR(m_logger, "Query needs either a pattern or a prefix without wildcards. Request: {}", request.dump());
+            return false;
+        }
     } else if (request["action"] == "get") {
         if (!request.contains("key")) {
             LOG_ERROR(m_logger, "Missing key field. Request: {}", request.dump());
             return false;
         }
     } else if (request["action"] == "set") {
-        if (!request.contains("key") || !request.contains("data")) {
-            LOG_ERROR(m_logger, "Missing key or data field. Request: {}", request.dump());
+        if (!request.contains("key") || request.contains("data") == request.contains("blob")) {
+            LOG_ERROR(m_logger, "Set needs a key and either data or a blob. Request: {}", request.dump());
+            return false;
+        }
+        if (request.contains("blob") && !valid_blob(request["blob"])) {
+            LOG_ERROR(m_logger, "A blob needs its size and between 1 and {} chunk hashes", CNS_MAX_BLOB_SIZE / CNS_BLOB_CHUNK_SIZE);
+            return false;
+        }
+        if (request.contains("expected_revision") && !request["expected_revision"].is_number_unsigned()) {
+            LOG_ERROR(m_logger, "expected_revision must be a revision, or 0 for a new key. Request: {}", request.dump());
+            return false;
+        }
+    } else if (request["action"] == "mget") {
+        bool has_keys = request.contains("keys") && request["keys"].is_array()
+            && all_of(request["keys"].begin(), request["keys"].end(), [](const json& key) { return key.is_string(); });
+        bool has_prefix = request.contains("prefix") && request["prefix"].is_string();
+        if (has_keys == has_prefix) {
+            LOG_ERROR(m_logger, "mget needs either a keys array or a prefix. Request: {}", request.dump());
+            return false;
+        }
+    } else if (request["action"] == "blob_missing" || request["action"] == "get_chunks") {
+        size_t max_chunks = request["action"] == "get_chunks" ? CNS_MAX_BLOB_READ / CNS_BLOB_CHUNK_SIZE
+                                                               : CNS_MAX_BLOB_SIZE / CNS_BLOB_CHUNK_SIZE;
+        if (!request.contains("chunks") || !is_hash_list(request["chunks"], max_chunks)) {
+            LOG_ERROR(m_logger, "{} needs a list of at most {} chunk hashes", request["action"].get<string>(), max_chunks);
+            return false;
+        }
+    } else if (request["action"] == "put_chunk") {
+        if (request.contains("hash") && !request["hash"].is_string()) {
+            LOG_ERROR(m_logger, "put_chunk hash must be a string. Request: {}", request.dump());
+            return false;
+        }
+    } else if (request["action"] == "read_blob") {
+        if (!request.contains("key") || !request["key"].is_string()
+                || (request.contains("offset") && !request["offset"].is_number_unsigned())
+                || (request.contains("length") && !request["length"].is_number_unsigned())
+                || (request.contains("hash") && !request["hash"].is_string())) {
+            LOG_ERROR(m_logger, "read_blob needs a key, and offset and length must be unsigned. Request: {}", request.dump());
+            return false;
+        }
+    } else if (request["action"] == "nodes" || request["action"] == "sync" || request["action"] == "status") {
+        return true;
+    } else if (request["action"] == "batch") {
+        if (!request.contains("requests") || !request["requests"].is_array() || request["requests"].size() > CNS_MAX_BATCH) {
+            LOG_ERROR(m_logger, "Batch needs a requests array of at most {} operations", CNS_MAX_BATCH);
             return false;
         }
     } else {
@@ -247,6 +1597,277 @@ bool CentralNameServer::validate_request(json request) {
     return true;
 }
 
+json CentralNameServer::set_data(const string& key, const string& value, int64_t expected_revision,
+                                 shared_ptr<const BlobManifest> blob) {
+    json reply;
+    update_registry([&](RegistrySnapshot& registry) {
+        // collect_blobs() also runs under m_write_mtx, so the chunks stay once checked here
+        if (blob) {
+            json missing = json::array();
+            for (const string& chunk : blob->chunks) {
+                if (!m_blobs->has(chunk)) {
+                    missing.push_back(chunk);
+                }
+            }
+            if (!missing.empty()) {
+                reply = {
+                    {"status", "error"},
+                    {"message", "Missing blob chunks"},
+                    {"key", key},
+                    {"missing", std::move(missing)}
+                };
+                return;
+            }
+        }
+        // Checked under m_write_mtx, so nothing can set the key in between
+        auto entry = registry.data.find(key);
+        uint64_t current = entry != registry.data.end() && !entry->second.value.empty() ? entry->second.revision : 0;
+        if (expected_revision >= 0 && current != static_cast<uint64_t>(expected_revision)) {
+            reply = {
+                {"status", "error"},
+                {"message", "Revision mismatch"},
+                {"conflict", true},
+                {"key", key},
+                {"revision", current}
+            };
+            return;
+        }
+        uint64_t revision = registry.data_revision + 1;
+        json mutation = {
+            {"op", "set"},
+            {"key", key},
+            {"data", value},
+            {"revision", revision}
+        };
+        if (blob) {
+            mutation["blob"] = manifest_to_json(*blob);
+        }
+        commit_mutation(registry, mutation);
+        reply = {
+            {"status", "success"},
+            {"key", key},
+            {"revision", revision}
+        };
+        if (blob) {
+            reply["hash"] = blob->hash;
+        }
+    });
+    return reply;
+}
+
+/**
+ * Builds the manifest of a blob a client is about to set from its stored chunks. Every
+ * chunk must be stored already, all but the last of the same size, and together exactly
+ * the size the client gave.
+ *
+ * @param error receives the reply for the client if the blob is rejected
+ * @return the manifest, or null if the blob is rejected
+ */
+shared_ptr<const BlobManifest> CentralNameServer::make_blob_manifest(const json& blob, json& error) {
+    auto manifest = make_shared<BlobManifest>();
+    manifest->size = blob["size"].get<uint64_t>();
+    manifest->chunks = blob["chunks"].get<vector<string>>();
+    manifest->hash = cns_blob_hash(manifest->chunks);
+    if (blob.contains("hash") && blob["hash"].get<string>() != manifest->hash) {
+        error = {
+            {"status", "error"},
+            {"message", "Blob hash does not match its chunks"},
+            {"hash", manifest->hash}
+        };
+        return nullptr;
+    }
+
+    json missing = json::array();
+    uint64_t total = 0;
+    bool uneven = false;
+    for (size_t i = 0; i < manifest->chunks.size(); i++) {
+        BlobStore::Chunk chunk = m_blobs->get(manifest->chunks[i]);
+        if (!chunk) {
+            missing.push_back(manifest->chunks[i]);
+            continue;
+        }
+        if (i == 0) {
+            manifest->chunk_size = chunk->size();
+        } else if (i + 1 < manifest->chunks.size() ? chunk->size() != manifest->chunk_size : chunk->size() > manifest->chunk_size) {
+            uneven = true;
+        }
+        total += chunk->size();
+    }
+    if (!missing.empty()) {
+        error = {
+            {"status", "error"},
+            {"message", "Missing blob chunks"},
+            {"missing", std::move(missing)}
+        };
+        return nullptr;
+    }
+    if (uneven || total != manifest->size) {
+        error = {
+            {"status", "error"},
+            {"message", uneven ? "Blob chunks must all be the size of the first, except the last"
+                               : "Blob size does not match its chunks"}
+        };
+        return nullptr;
+    }
+    return manifest;
+}
+
+/**
+ * Answers the requests whose chunks travel as frames next to the body:
+ *  - put_chunk stores the chunk frame and returns its hash
+ *  - get_chunks returns the stored chunks of a list, one frame each, in order
+ *  - read_blob returns bytes [offset, offset + length) of a key's blob, capped at
+ *    CNS_MAX_BLOB_READ, as one frame per chunk it touches
+ * Chunks are sent straight from the BlobStore without copying.
+ *
+ * @param chunk the frame after the request body, or null
+ * @param frames receives the frames to send after the reply body
+ */
+json CentralNameServer::handle_blob_request(const json& request, const zmq::message_t* chunk, vector<zmq::message_t>& frames) {
+    string action = request["action"];
+    if (action == "put_chunk") {
+        if (is_standby()) {
+            return {
+                {"status", "error"},
+                {"message", "Standby CNS, send writes to the primary " + m_primary_address}
+            };
+        }
+        if (chunk == nullptr || chunk->size() == 0 || chunk->size() > CNS_BLOB_CHUNK_SIZE) {
+            return {
+                {"status", "error"},
+                {"message", "put_chunk needs one chunk of 1 to " + to_string(CNS_BLOB_CHUNK_SIZE) + " bytes after the body"}
+            };
+        }
+        string hash;
+        try {
+            hash = m_blobs->put(chunk->to_string());
+        } catch (const std::runtime_error& e) {
+            LOG_ERROR(m_logger, "Failed to store blob chunk: {}", e.what());
+            return {
+                {"status", "error"},
+                {"message", "Failed to store chunk"}
+            };
+        }
+        if (request.contains("hash") && request["hash"].get<string>() != hash) {
+            return {
+                {"status", "error"},
+                {"message", "Chunk does not match its hash"},
+                {"hash", hash}
+            };
+        }
+        return {
+            {"status", "success"},
+            {"hash", hash},
+            {"size", chunk->size()}
+        };
+    }
+
+    if (action == "get_chunks") {
+        json served = json::array();
+        json missing = json::array();
+        for (const json& hash : request["chunks"]) {
+            BlobStore::Chunk data = m_blobs->get(hash.get_ref<const string&>());
+            if (!data) {
+                missing.push_back(hash);
+                continue;
+            }
+            frames.push_back(make_zero_copy_message(const_cast<char*>(data->data()), data->size(), data));
+            served.push_back(hash);
+        }
+        return {
+            {"status", "success"},
+            {"chunks", std::move(served)},
+            {"missing", std::move(missing)}
+        };
+    }
+
+    // read_blob
+    string key = request["key"];
+    auto snapshot = registry();
+    auto entry = snapshot->data.find(key);
+    if (entry == snapshot->data.end() || !entry->second.blob) {
+        return {
+            {"status", "success"},
+            {"key", key},
+            {"found", false}
+        };
+    }
+    const BlobManifest& blob = *entry->second.blob;
+    if (request.contains("hash") && request["hash"].get<string>() != blob.hash) {
+        // The key was set again since the client read its manifest
+        return {
+            {"status", "error"},
+            {"message", "Blob changed"},
+            {"conflict", true},
+            {"key", key},
+            {"hash", blob.hash},
+            {"revision", entry->second.revision}
+        };
+    }
+    uint64_t offset = request.value("offset", uint64_t(0));
+    if (offset > blob.size) {
+        return {
+            {"status", "error"},
+            {"message", "Offset past the end of the blob"},
+            {"size", blob.size}
+        };
+    }
+    uint64_t length = min({request.value("length", uint64_t(CNS_MAX_BLOB_READ)), uint64_t(CNS_MAX_BLOB_READ), blob.size - offset});
+    for (uint64_t position = offset; position < offset + length;) {
+        BlobStore::Chunk data = m_blobs->get(blob.chunks[position / blob.chunk_size]);
+        if (!data) {
+            // A standby that is still copying the blob from its primary
+            frames.clear();
+            return {
+                {"status", "error"},
+                {"message", "Blob chunk not available"},
+                {"key", key}
+            };
+        }
+        uint64_t within = position % blob.chunk_size;
+        uint64_t size = min<uint64_t>(data->size() - within, offset + length - position);
+        frames.push_back(make_zero_copy_message(const_cast<char*>(data->data()) + within, size, data));
+        position += size;
+    }
+    return {
+        {"status", "success"},
+        {"key", key},
+        {"found", true},
+        {"hash", blob.hash},
+        {"revision", entry->second.revision},
+        {"size", blob.size},
+        {"offset", offset},
+        {"length", length}
+    };
+}
+
+/**
+ * Removes chunks no blob in the registry refers to, once their upload grace period is over.
+ * The chunks are picked under m_write_mtx so no set can start referring to one while it is
+ * removed, but their files are unlinked after it is released.
+ */
+void CentralNameServer::collect_blobs() {
+    vector<string> removed;
+    {
+        lock_guard<mutex> lock(m_write_mtx);
+        unordered_set<string> referenced;
+        for (const auto& entry : registry()->data) {
+            if (entry.second.blob) {
+                referenced.insert(entry.second.blob->chunks.begin(), entry.second.blob->chunks.end());
+            }
+        }
+        removed = m_blobs->collect(referenced, chrono::milliseconds(BLOB_UPLOAD_GRACE_MS));
+    }
+    if (removed.empty()) {
+        return;
+    }
+    m_blobs->unlink_collected(removed);
+    LOG_INFO(m_logger, "Removed {} unused blob chunks, {} chunks ({} bytes) stored", removed.size(), m_blobs->size(),
+             m_blobs->bytes());
+}
+
 void CentralNameServer::clear_registry() {
-    m_registered_topics.clear();
+    update_registry([&](RegistrySnapshot& registry) {
+        commit_mutation(registry, {{"op", "clear"}});
+    });
 }
\ No newline at end of file
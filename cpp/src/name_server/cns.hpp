@@ -1,8 +1,13 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <string>
 #include <map>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <zmq.hpp>
 #include <nlohmann/json.hpp>
 #include <quill/Backend.h>
@@ -12,33 +17,251 @@
 #include <quill/sinks/ConsoleSink.h>
 #include <quill/sinks/FileSink.h>
 #include "../node.hpp"
+#include "../cns_protocol.hpp"
+#include "blob_store.hpp"
+#include "liveness.hpp"
+#include "radix_tree.hpp"
+#include "registry_store.hpp"
+#include "topic_table.hpp"
 
 using json = nlohmann::json;
 using namespace std;
 
+/**
+ * @brief What the CNS knows about a node that sends heartbeats.
+ */
 struct NodeInfo {
+    string name;
     vector<string> topics;
     int secondsSinceLastHeartbeat;
+    bool online;
 };
 
+/**
+ * @brief Where a topic can be reached and who registered it.
+ *
+ * `endpoints` lists every transport the publisher is bound to (tcp, ipc, inproc);
+ * subscribers use `host`, `pid` and `context` to decide which of them they can reach.
+ * `shm` is only filled in by publishers that offer a shared memory ring.
+ */
+struct EndpointRecord {
+    string ip;
+    int port = 0;
+    string host;
+    string shm;
+    vector<string> endpoints;
+    int pid = -1;
+    string context;
+    string owner;               // node that registered the topic
+    int64_t registered_at = 0;  // unix time, milliseconds
+    int64_t lease_ms = 0;       // renewed by the owner's heartbeats; 0 in records from before leases
+};
+
+/**
+ * @brief A registered topic together with its lookup reply, serialized once at registration
+ * in every CnsEncoding so answering a lookup is a single table probe and a send.
+ */
+struct TopicEntry {
+    EndpointRecord record;
+    array<string, CNS_ENCODING_COUNT> lookup_replies;
+};
+
+/**
+ * @brief A large value stored as chunks in the BlobStore. Every chunk but the last is
+ * chunk_size bytes long.
+ */
+struct BlobManifest {
+    string hash;            // cns_blob_hash() of the chunks
+    uint64_t size = 0;
+    uint64_t chunk_size = 0;
+    vector<string> chunks;  // chunk hashes, in order
+};
+
+/**
+ * @brief A key/value entry and the store revision it was last set at.
+ *
+ * A blob entry's value is the blob's reference (CNS_BLOB_REF_PREFIX + its hash), so
+ * everything that compares or watches values works unchanged.
+ */
+struct DataEntry {
+    string value;
+    uint64_t revision = 0;
+    shared_ptr<const BlobManifest> blob;  // null unless the value is a blob
+};
+
+/**
+ * @brief Immutable view of everything the CNS stores.
+ *
+ * Workers read the current snapshot without locking; writers copy it, modify the copy and
+ * swap it in (see CentralNameServer::update_registry).
+ */
+struct RegistrySnapshot {
+    TopicTable<TopicEntry> topics;
+    RadixTree topic_index;  // the same topic names, for prefix and glob queries
+    map<string, DataEntry> data;
+    uint64_t data_revision = 0;  // revision of the latest set; never goes back, not even on reset
+};
+
+/**
+ * @brief A "wait_for" request parked until its topic is registered or its deadline passes.
+ */
+struct ParkedWait {
+    vector<zmq::message_t> envelope;   // routing frames, up to and including the delimiter
+    CnsEncoding encoding;
+    chrono::steady_clock::time_point deadline;
+};
+
+// Workers receive requests from the frontend on this endpoint
+#define CNS_WORKER_ENDPOINT "inproc://cns_workers"
+// Writers wake reply_loop() on this endpoint when parked waits can be answered
+#define CNS_WAKEUP_ENDPOINT "inproc://cns_wakeup"
+
+/**
+ * @brief Central Name Server: topic registry and key/value store for every node.
+ *
+ * Clients talk to a ROUTER frontend. reply_loop() forwards requests over an inproc DEALER
+ * to a pool of worker threads and the replies back, so a slow request never holds up the
+ * others; it never takes m_write_mtx. Requests are answered by handle_request(), which only
+ * reads the registry snapshot and serializes writes through m_write_mtx. Timed work that
+ * writes (node expiry, sync events, log compaction) runs on maintenance_loop(). Every change
+ * to the topic registry is also published on m_events so clients can keep their lookup
+ * caches current.
+ *
+ * A CNS started with a primary address is a hot standby: replication_loop() copies the
+ * primary's registry and then applies its mutation stream, and the standby takes over if
+ * the primary goes quiet for CNS_FAILOVER_TIMEOUT_MS.
+ */
 class CentralNameServer : public GenericNode {
     private:
         int m_port;
-        zmq::socket_t m_socket;
+        zmq::socket_t m_socket;     // ROUTER, client facing
+        zmq::socket_t m_backend;    // DEALER, fans requests out to the workers
+        zmq::socket_t m_events;     // PUB, registry change events, guarded by m_write_mtx
+        zmq::socket_t m_heartbeats; // PULL, one way heartbeats from every node
+        zmq::socket_t m_replication;    // PUB, mutation stream for standbys, guarded by m_write_mtx
+        zmq::socket_t m_wakeup;         // PUSH, guarded by m_write_mtx
+        zmq::socket_t m_wakeup_sink;    // PULL, read by reply_loop()
+        uint64_t m_event_seq = 0;
+        vector<json> m_pending_events;   // queued by a writer, sent once its snapshot is live
+        uint64_t m_replication_seq = 0;  // last mutation streamed, guarded by m_write_mtx
+        string m_advertised_standby;     // "ip:port" of our standby, guarded by m_write_mtx
+        string m_address;                // "ip:port" clients reach this CNS on
+        string m_primary_address;        // "ip:port" of the primary, empty unless a standby
+        std::atomic<bool> m_promoted{false};
+        thread m_replication_thread;
+        thread m_maintenance_thread;
+
+        multimap<string, ParkedWait> m_parked;        // by topic
+        vector<pair<ParkedWait, string>> m_answered;  // waits and their encoded replies, sent by reply_loop()
+        std::mutex m_parked_mtx;
         string m_log_name;
-        vector<NodeInfo> m_registered_nodes;
-        map<string, string> m_registered_topics;
-        map<string, string> m_data_storage;
+        LivenessTracker m_liveness;
+        std::mutex m_liveness_mtx;
+        vector<thread> m_workers;
+
+        shared_ptr<const RegistrySnapshot> m_registry;
+        std::mutex m_write_mtx;
+        unique_ptr<RegistryStore> m_store;  // null when running in memory only
+        unique_ptr<BlobStore> m_blobs;      // chunks of blob values, persisted next to m_store
+
+        // Unreferenced chunks are collected this often, once they have gone unused for the
+        // grace period, which gives uploads that long to finish with their "set"
+        static constexpr int BLOB_GC_INTERVAL_MS = 60000;
+        static constexpr int BLOB_UPLOAD_GRACE_MS = 600000;
+        // How often maintenance_loop() expires nodes and checks for a due compaction
+        static constexpr int MAINTENANCE_INTERVAL_MS = 100;
+
+        shared_ptr<const RegistrySnapshot> registry() const;
+        template <typename Fn> void update_registry(Fn&& modify);
+        template <typename Fn> void batch_update(Fn&& apply);
+        void publish_registry(shared_ptr<RegistrySnapshot> next);
+        unique_lock<std::mutex> lock_writes();
+
+        void worker_loop(int worker_id);
+        void maintenance_loop();
+        void record_heartbeat(const string& node);
+        void grant_lease(const string& node, int64_t lease_ms);
+        void receive_heartbeats();
+        void expire_offline_nodes();
+        void recover_registry(const string& state_directory);
+        void log_mutation(const json& mutation);
+        json commit_mutation(RegistrySnapshot& registry, const json& mutation);
+        void track_owners();
+        void replication_loop();
+        void promote();
+        json sync_state(const string& standby);
+        bool park_wait(const json& request, vector<zmq::message_t>& frames, size_t delimiter, CnsEncoding encoding);
+        void release_waits(const RegistrySnapshot& registry);
+        void answer_waits();
+        void compact_store(const RegistrySnapshot& registry);
+        json handle_blob_request(const json& request, const zmq::message_t* chunk, vector<zmq::message_t>& frames);
+        shared_ptr<const BlobManifest> make_blob_manifest(const json& blob, json& error);
+        void collect_blobs();
+        bool fetch_chunks(vector<string>& wanted);
+        void queue_event(json event);
+        void publish_event(json event);
 
     public:
-        CentralNameServer(string ip_address, int port, string master_ip_address);
+        /**
+         * @param worker_count number of threads answering requests
+         * @param heartbeat_misses heartbeat intervals a node may miss before it is marked
+         *                         offline and its topics expire
+         * @param state_directory where the registry is persisted (see RegistryStore) and
+         *                        recovered from on start; empty to keep it in memory only
+         * @param primary_address "ip:port" of the CNS to follow as a hot standby; empty to
+         *                        run as the primary
+         */
+        CentralNameServer(string ip_address, int port, string master_ip_address, int worker_count = 4,
+                          int heartbeat_misses = CNS_DEFAULT_HEARTBEAT_MISSES, string state_directory = "",
+                          string primary_address = "");
         ~CentralNameServer();
 
-        void register_node(string topic, string ip_address, int port);
+        void register_node(string topic, EndpointRecord record);
         void unregister_node(string topic);
+
+        /**
+         * Every node that has sent a heartbeat, with the topics it owns.
+         */
+        vector<NodeInfo> registered_nodes();
+
+        /**
+         * Forwards requests between clients and workers until the node is stopped.
+         */
         void reply_loop();
 
-        bool validate_request(nlohmann::json request);
+        /**
+         * Makes reply_loop() return. Only stores an atomic flag, so it may be called from a
+         * signal handler; the server is shut down by its destructor afterwards.
+         */
+        void request_stop() { m_atomic_stop.store(true); }
+
+        /**
+         * Answers one decoded request. Safe to call from any number of threads. Requests
+         * that carry chunks in extra frames (put_chunk, get_chunks, read_blob) go through
+         * handle_blob_request() instead.
+         */
+        json handle_request(const json& request);
+
+        bool validate_request(const nlohmann::json& request);
+
+        /**
+         * Sets a key, if its revision is still expected_revision when that is given.
+         *
+         * @param expected_revision revision the key must be at, 0 if it must not exist; -1
+         *                          to set it unconditionally
+         * @param blob the blob the key refers to, value being its reference; every chunk must
+         *             be stored already
+         * @return the set reply: the new revision, or a conflict with the current one
+         */
+        json set_data(const string& key, const string& value, int64_t expected_revision = -1,
+                      shared_ptr<const BlobManifest> blob = nullptr);
+
+        /**
+         * True while this CNS follows a primary. A standby answers reads but rejects writes
+         * until it is promoted.
+         */
+        bool is_standby() const { return !m_primary_address.empty() && !m_promoted.load(); }
+
         void clear_registry();
         
 };
\ No newline at end of file
@@ -8,24 +8,18 @@
 
 using namespace std;
 
-// Global pointer to allow signal handler to access the server
-static unique_ptr<CentralNameServer> g_server;
-static bool g_running = true;
+// The running server, for the signal handler to stop
+static CentralNameServer* volatile g_server = nullptr;
 
 void signal_handler(int signum) {
+    // Only stores an atomic flag: the server is shut down once reply_loop() returns, by
+    // main(), since the handler may interrupt a thread holding one of its locks
     if (g_server) {
-        cout << "\nReceived signal " << signum << ". Shutting down gracefully..." << endl;
-        g_running = false;
-        g_server.reset(); // This will call the destructor which logs the shutdown
+        g_server->request_stop();
     }
-    exit(signum);
 }
 
 int main(int argc, char* argv[]) {
-    // Set up signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    
     quill::Backend::start();
     argparse::ArgumentParser program("cns");
     
@@ -42,6 +36,35 @@ int main(int argc, char* argv[]) {
         .default_value(5555)
         .scan<'i', int>();
 
+    program.add_argument("--master-port")
+        .help("Port of the primary CNS, with --standby")
+        .default_value(5555)
+        .scan<'i', int>();
+
+    program.add_argument("--standby")
+        .help("Run as a hot standby of the CNS at the master IP address and port")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("-w", "--workers")
+        .help("Number of worker threads answering requests")
+        .default_value(4)
+        .scan<'i', int>();
+
+    program.add_argument("-m", "--heartbeat-misses")
+        .help("Heartbeats a node may miss before it is marked offline and its topics expire")
+        .default_value(CNS_DEFAULT_HEARTBEAT_MISSES)
+        .scan<'i', int>();
+
+    program.add_argument("-s", "--state-dir")
+        .help("Directory the registry is persisted to and recovered from")
+        .default_value(std::string(CNS_STATE_DIRECTORY));
+
+    program.add_argument("--in-memory")
+        .help("Do not persist the registry")
+        .default_value(false)
+        .implicit_value(true);
+
     program.add_argument("-d", "--debug")
         .help("Debug mode")
         .default_value(false)
@@ -58,25 +81,35 @@ int main(int argc, char* argv[]) {
     auto ip = program.get<std::string>("ip-address");
     auto mip = program.get<std::string>("master-ip-address");
     auto port = program.get<int>("port");
+    auto workers = program.get<int>("workers");
+    auto heartbeat_misses = program.get<int>("heartbeat-misses");
+    auto state_dir = program.get<bool>("in-memory") ? std::string() : program.get<std::string>("state-dir");
     auto debug = program.get<bool>("debug");
+    auto primary = program.get<bool>("standby") ? mip + ":" + to_string(program.get<int>("master-port")) : std::string();
 
+    unique_ptr<CentralNameServer> server;
     try {
-        g_server = make_unique<CentralNameServer>(ip, port, mip);
+        server = make_unique<CentralNameServer>(ip, port, mip, workers, heartbeat_misses, state_dir, primary);
         if (debug) {
-            g_server->set_debug(true); // Set debug mode
-        }
-        while (g_running) {
-            try {
-                g_server->reply_loop();
-                return 0; // only gets here if reply_loop() returns
-            } catch (const std::exception& e) {
-                std::cerr << "Error in reply loop: " << e.what() << std::endl;
-                break;
-            }
+            server->set_debug(true); // Set debug mode
         }
-        return 0;
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
-}
\ No newline at end of file
+
+    g_server = server.get();
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    int status = 0;
+    try {
+        server->reply_loop();  // returns once a signal stopped it
+    } catch (const std::exception& e) {
+        std::cerr << "Error in reply loop: " << e.what() << std::endl;
+        status = 1;
+    }
+    g_server = nullptr;
+    cout << "Shutting down gracefully..." << endl;
+    server.reset();  // joins the workers and leaves a snapshot behind
+    return status;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Tracks which nodes are alive from their heartbeats.
+ *
+ * A node is offline once it has missed `miss_count` heartbeat intervals in a row. Deadlines
+ * are kept in a hashed timer wheel: a heartbeat only updates the node's deadline, and a node
+ * is looked at again when the wheel reaches the slot it was scheduled in, at which point it
+ * either expires or is rescheduled for its current deadline. Heartbeats are O(1) and
+ * advance() only touches nodes whose slot came up, so thousands of nodes cost next to nothing.
+ *
+ * A node may also hold a lease longer than the heartbeat timeout (see grant()); it is then
+ * offline once its lease has gone unrenewed for that long instead.
+ *
+ * Not thread safe.
+ */
+class LivenessTracker {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        /**
+         * @param interval expected time between heartbeats
+         * @param miss_count heartbeats a node may miss before it is offline
+         * @param tick resolution of the wheel; expiry is at most one tick late
+         */
+        LivenessTracker(std::chrono::milliseconds interval, int miss_count,
+                        std::chrono::milliseconds tick = std::chrono::milliseconds(100))
+            : m_timeout(interval * std::max(1, miss_count)), m_tick(std::max<int64_t>(1, tick.count())) {
+            size_t slots = 1;
+            while (slots < static_cast<size_t>(m_timeout.count() / m_tick) + 2) {
+                slots *= 2;
+            }
+            m_wheel.resize(slots);
+        }
+
+        /**
+         * Records a heartbeat.
+         *
+         * @return true if the node was unknown or offline before this heartbeat
+         */
+        bool beat(const std::string& node, Clock::time_point now) {
+            if (!m_started) {
+                m_origin = now;
+                m_current = 0;
+                m_started = true;
+            }
+            NodeState& state = m_nodes[node];
+            bool came_online = !state.online;
+            state.online = true;
+            state.last_beat = now;
+            state.deadline = ticks(now + std::max(m_timeout, state.lease));
+            if (!state.scheduled) {
+                schedule(node, state);
+            }
+            return came_online;
+        }
+
+        /**
+         * Grants a node a lease and renews it, as a heartbeat would. Every later heartbeat
+         * renews it for the longest lease the node was ever granted, never for less than the
+         * heartbeat timeout.
+         *
+         * @return true if the node was unknown or offline before
+         */
+        bool grant(const std::string& node, std::chrono::milliseconds lease, Clock::time_point now) {
+            NodeState& state = m_nodes[node];
+            state.lease = std::max(state.lease, lease);
+            return beat(node, now);
+        }
+
+        /**
+         * Moves the wheel up to `now`.
+         *
+         * @return nodes that went offline since the last call
+         */
+        std::vector<std::string> advance(Clock::time_point now) {
+            std::vector<std::string> expired;
+            if (!m_started) {
+                return expired;
+            }
+            int64_t target = ticks(now);
+            while (m_current < target) {
+                m_current++;
+                std::vector<WheelEntry> due;
+                due.swap(m_wheel[m_current & (m_wheel.size() - 1)]);
+                for (WheelEntry& entry : due) {
+                    auto it = m_nodes.find(entry.node);
+                    if (it == m_nodes.end() || it->second.token != entry.token) {
+                        continue;
+                    }
+                    NodeState& state = it->second;
+                    state.scheduled = false;
+                    if (state.deadline <= m_current) {
+                        state.online = false;
+                        expired.push_back(std::move(entry.node));
+                    } else {
+                        schedule(it->first, state);
+                    }
+                }
+            }
+            return expired;
+        }
+
+        /**
+         * Stops tracking a node, e.g. once everything it owned has been cleaned up.
+         */
+        void forget(const std::string& node) {
+            // Its wheel entry no longer matches any node's token and is skipped when it comes up
+            m_nodes.erase(node);
+        }
+
+        bool is_online(const std::string& node) const {
+            auto it = m_nodes.find(node);
+            return it != m_nodes.end() && it->second.online;
+        }
+
+        /**
+         * Calls fn(node, online, last_beat) for every known node.
+         */
+        template <typename Fn>
+        void for_each(Fn&& fn) const {
+            for (const auto& entry : m_nodes) {
+                fn(entry.first, entry.second.online, entry.second.last_beat);
+            }
+        }
+
+        size_t size() const { return m_nodes.size(); }
+        std::chrono::milliseconds timeout() const { return m_timeout; }
+
+    private:
+        struct NodeState {
+            Clock::time_point last_beat;
+            int64_t deadline = 0;   // wheel tick at which the node expires
+            bool online = false;
+            bool scheduled = false;
+            uint64_t token = 0;     // matches the node's live wheel entry
+            std::chrono::milliseconds lease{0};
+        };
+
+        struct WheelEntry {
+            std::string node;
+            uint64_t token;
+        };
+
+        int64_t ticks(Clock::time_point t) const {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(t - m_origin).count() / m_tick;
+        }
+
+        void schedule(const std::string& node, NodeState& state) {
+            // Deadlines beyond one revolution land in an earlier slot and get rescheduled
+            int64_t slot = std::max(state.deadline, m_current + 1);
+            state.token = ++m_next_token;
+            state.scheduled = true;
+            m_wheel[slot & (m_wheel.size() - 1)].push_back({node, state.token});
+        }
+
+        std::chrono::milliseconds m_timeout;
+        int64_t m_tick;
+        std::vector<std::vector<WheelEntry>> m_wheel;
+        std::unordered_map<std::string, NodeState> m_nodes;
+        Clock::time_point m_origin;
+        int64_t m_current = 0;
+        uint64_t m_next_token = 0;
+        bool m_started = false;
+};
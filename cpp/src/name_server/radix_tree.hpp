@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Compressed radix tree of topic names, for prefix and glob queries.
+ *
+ * Each edge carries a run of characters and no node has a single child unless it ends a
+ * topic, so the depth is bounded by the number of places topic names diverge rather than
+ * by their length. Children are kept sorted by their first character, which makes a depth
+ * first walk visit topics in lexicographic order; queries use that order for pagination.
+ *
+ * Nodes live in one vector and refer to each other by index, so copying the tree (as the
+ * CNS does for every registry snapshot) is a single vector copy.
+ */
+class RadixTree {
+    public:
+        RadixTree() : m_nodes(1) {}
+
+        /**
+         * @return true if key was not present before
+         */
+        bool insert(std::string_view key) {
+            uint32_t node = ROOT;
+            size_t i = 0;
+            while (true) {
+                if (i == key.size()) {
+                    if (m_nodes[node].terminal) {
+                        return false;
+                    }
+                    m_nodes[node].terminal = true;
+                    m_size++;
+                    return true;
+                }
+
+                size_t slot = child_slot(node, key[i]);
+                if (slot == m_nodes[node].children.size() || first_char(m_nodes[node].children[slot]) != key[i]) {
+                    uint32_t leaf = allocate();
+                    m_nodes[leaf].label = std::string(key.substr(i));
+                    m_nodes[leaf].terminal = true;
+                    m_nodes[node].children.insert(m_nodes[node].children.begin() + slot, leaf);
+                    m_size++;
+                    return true;
+                }
+
+                uint32_t child = m_nodes[node].children[slot];
+                const std::string& label = m_nodes[child].label;
+                size_t common = 0;
+                while (common < label.size() && i + common < key.size() && label[common] == key[i + common]) {
+                    common++;
+                }
+                if (common < label.size()) {
+                    // key diverges inside the edge: split it
+                    uint32_t middle = allocate();
+                    m_nodes[middle].label = m_nodes[child].label.substr(0, common);
+                    m_nodes[child].label.erase(0, common);
+                    m_nodes[middle].children.push_back(child);
+                    m_nodes[node].children[slot] = middle;
+                    child = middle;
+                }
+                node = child;
+                i += common;
+            }
+        }
+
+        /**
+         * @return true if key was present
+         */
+        bool erase(std::string_view key) {
+            std::vector<uint32_t> path{ROOT};
+            uint32_t node = ROOT;
+            size_t i = 0;
+            while (i < key.size()) {
+                size_t slot = child_slot(node, key[i]);
+                if (slot == m_nodes[node].children.size()) {
+                    return false;
+                }
+                uint32_t child = m_nodes[node].children[slot];
+                const std::string& label = m_nodes[child].label;
+                if (first_char(child) != key[i] || key.substr(i, label.size()) != label) {
+                    return false;
+                }
+                node = child;
+                i += label.size();
+                path.push_back(node);
+            }
+            if (!m_nodes[node].terminal) {
+                return false;
+            }
+            m_nodes[node].terminal = false;
+            m_size--;
+
+            if (node == ROOT) {
+                return true;
+            }
+            if (m_nodes[node].children.empty()) {
+                uint32_t parent = path[path.size() - 2];
+                auto& siblings = m_nodes[parent].children;
+                siblings.erase(std::find(siblings.begin(), siblings.end(), node));
+                release(node);
+                if (parent != ROOT && !m_nodes[parent].terminal && m_nodes[parent].children.size() == 1) {
+                    merge_with_child(parent);
+                }
+            } else if (m_nodes[node].children.size() == 1) {
+                merge_with_child(node);
+            }
+            return true;
+        }
+
+        bool contains(std::string_view key) const {
+            uint32_t node = ROOT;
+            size_t i = 0;
+            while (i < key.size()) {
+                size_t slot = child_slot(node, key[i]);
+                if (slot == m_nodes[node].children.size()) {
+                    return false;
+                }
+                uint32_t child = m_nodes[node].children[slot];
+                const std::string& label = m_nodes[child].label;
+                if (first_char(child) != key[i] || key.substr(i, label.size()) != label) {
+                    return false;
+                }
+                node = child;
+                i += label.size();
+            }
+            return m_nodes[node].terminal;
+        }
+
+        void clear() {
+            m_nodes.assign(1, Node());
+            m_free.clear();
+            m_size = 0;
+        }
+
+        size_t size() const { return m_size; }
+
+        /**
+         * Calls fn(key) for keys matching a glob pattern, in lexicographic order.
+         *
+         * In the pattern `*` matches any run of characters other than `/`, so it stands for
+         * (part of) one level of a topic name, and `**` matches any run of characters at all.
+         * Every other character matches itself. Subtrees that cannot match are never visited.
+         *
+         * @param after only keys greater than this are reported; empty for the first page
+         * @param limit most keys to report
+         * @return true if more keys match beyond the ones reported
+         */
+        template <typename Fn>
+        bool match(std::string_view pattern, std::string_view after, size_t limit, Fn&& fn) const {
+            Matcher matcher(pattern);
+            std::vector<uint32_t> states{0};
+            matcher.close(states);
+            std::string path;
+            size_t reported = 0;
+            bool more = false;
+            visit(ROOT, path, states, after, !after.empty(), matcher, limit, reported, more, fn);
+            return more;
+        }
+
+    private:
+        static constexpr uint32_t ROOT = 0;
+
+        struct Node {
+            std::string label;               // characters on the edge into this node
+            std::vector<uint32_t> children;  // sorted by first character of their label
+            bool terminal = false;           // a key ends here
+        };
+
+        /**
+         * Glob pattern as a small NFA. A state is the index of the next token to match.
+         */
+        class Matcher {
+            public:
+                explicit Matcher(std::string_view pattern) {
+                    for (size_t i = 0; i < pattern.size(); i++) {
+                        if (pattern[i] == '*' && i + 1 < pattern.size() && pattern[i + 1] == '*') {
+                            m_tokens.push_back({ANY, 0});
+                            i++;
+                        } else if (pattern[i] == '*') {
+                            m_tokens.push_back({SEGMENT, 0});
+                        } else {
+                            m_tokens.push_back({LITERAL, pattern[i]});
+                        }
+                    }
+                }
+
+                /**
+                 * Adds the states reachable without consuming a character, i.e. past wildcards
+                 * that match nothing.
+                 */
+                void close(std::vector<uint32_t>& states) const {
+                    for (size_t i = 0; i < states.size(); i++) {
+                        uint32_t s = states[i];
+                        if (s < m_tokens.size() && m_tokens[s].kind != LITERAL && !has(states, s + 1)) {
+                            states.push_back(s + 1);
+                        }
+                    }
+                }
+
+                void step(const std::vector<uint32_t>& states, char c, std::vector<uint32_t>& next) const {
+                    next.clear();
+                    for (uint32_t s : states) {
+                        if (s == m_tokens.size()) {
+                            continue;
+                        }
+                        const Token& token = m_tokens[s];
+                        uint32_t target;
+                        if (token.kind == ANY || (token.kind == SEGMENT && c != '/')) {
+                            target = s;
+                        } else if (token.kind == LITERAL && token.c == c) {
+                            target = s + 1;
+                        } else {
+                            continue;
+                        }
+                        if (!has(next, target)) {
+                            next.push_back(target);
+                        }
+                    }
+                    close(next);
+                }
+
+                bool accepts(const std::vector<uint32_t>& states) const {
+                    return has(states, static_cast<uint32_t>(m_tokens.size()));
+                }
+
+            private:
+                enum Kind : uint8_t { LITERAL, SEGMENT, ANY };
+                struct Token {
+                    Kind kind;
+                    char c;
+                };
+
+                static bool has(const std::vector<uint32_t>& states, uint32_t s) {
+                    return std::find(states.begin(), states.end(), s) != states.end();
+                }
+
+                std::vector<Token> m_tokens;
+        };
+
+        char first_char(uint32_t node) const { return m_nodes[node].label[0]; }
+
+        /**
+         * Position of the child starting with c, or where it would be inserted.
+         */
+        size_t child_slot(uint32_t node, char c) const {
+            const auto& children = m_nodes[node].children;
+            auto it = std::lower_bound(children.begin(), children.end(), c, [&](uint32_t child, char value) {
+                return first_char(child) < value;
+            });
+            return it - children.begin();
+        }
+
+        uint32_t allocate() {
+            if (!m_free.empty()) {
+                uint32_t node = m_free.back();
+                m_free.pop_back();
+                return node;
+            }
+            m_nodes.emplace_back();
+            return static_cast<uint32_t>(m_nodes.size() - 1);
+        }
+
+        void release(uint32_t node) {
+            m_nodes[node] = Node();
+            m_free.push_back(node);
+        }
+
+        /**
+         * Folds a node's only child into it, keeping the tree compressed.
+         */
+        void merge_with_child(uint32_t node) {
+            uint32_t child = m_nodes[node].children[0];
+            m_nodes[node].label += m_nodes[child].label;
+            m_nodes[node].terminal = m_nodes[child].terminal;
+            m_nodes[node].children = std::move(m_nodes[child].children);
+            release(child);
+        }
+
+        /**
+         * Depth first walk. `bounded` means path is still a prefix of `after`, so children
+         * sorting before it are skipped; once path passes `after` everything below is new.
+         *
+         * @return false to stop the walk
+         */
+        template <typename Fn>
+        bool visit(uint32_t node, std::string& path, const std::vector<uint32_t>& states, std::string_view after,
+                   bool bounded, const Matcher& matcher, size_t limit, size_t& reported, bool& more, Fn& fn) const {
+            if (!bounded && m_nodes[node].terminal && matcher.accepts(states)) {
+                if (reported == limit) {
+                    more = true;
+                    return false;
+                }
+                fn(path);
+                reported++;
+            }
+
+            std::vector<uint32_t> current, next;
+            for (uint32_t child : m_nodes[node].children) {
+                const std::string& label = m_nodes[child].label;
+                bool child_bounded = bounded;
+                if (bounded) {
+                    size_t n = std::min(label.size(), after.size() - std::min(after.size(), path.size()));
+                    int order = label.compare(0, n, after.substr(path.size(), n));
+                    if (order < 0) {
+                        continue;
+                    }
+                    // Equal so far and no longer than after: still a prefix of it
+                    child_bounded = order == 0 && path.size() + label.size() <= after.size();
+                }
+
+                current = states;
+                for (char c : label) {
+                    matcher.step(current, c, next);
+                    current.swap(next);
+                    if (current.empty()) {
+                        break;
+                    }
+                }
+                if (current.empty()) {
+                    continue;
+                }
+
+                path += label;
+                bool keep_going = visit(child, path, current, after, child_bounded, matcher, limit, reported, more, fn);
+                path.resize(path.size() - label.size());
+                if (!keep_going) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        std::vector<Node> m_nodes;     // m_nodes[ROOT] has an empty label
+        std::vector<uint32_t> m_free;  // released node slots
+        size_t m_size = 0;
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Durable copy of the CNS registry: a write-ahead log plus a compact snapshot.
+ *
+ * Every registry mutation is appended to `cns.wal` before it becomes visible. When the log
+ * grows past `compact_bytes` the whole registry is written to `cns.snapshot` (to a temporary
+ * file, then renamed over the old one) and the log is truncated, so disk use stays bounded
+ * by roughly one snapshot plus one log.
+ *
+ * Both files are a sequence of records: a little endian u32 payload size, a u32 CRC-32 of
+ * the payload, then the payload, which is one MessagePack encoded mutation. The snapshot
+ * starts with a 16 byte header. Recovery maps each file and decodes records in place; a
+ * torn record at the end of the log (from a crash mid-append) is cut off.
+ *
+ * Mutations must be idempotent when replayed in order, since the log can still hold
+ * records that are already in the snapshot if the CNS dies between the two steps of a
+ * compaction.
+ *
+ * Appends are written but not fsynced, which survives the CNS process dying but not the
+ * machine. Snapshots are fsynced before they replace the old one.
+ *
+ * Not thread safe; the CNS calls it with its write lock held.
+ */
+class RegistryStore {
+    public:
+        using Apply = std::function<void(const nlohmann::json&)>;
+
+        /**
+         * @param directory created if missing
+         * @param compact_bytes log size at which needs_compaction() becomes true
+         * @throws std::runtime_error if the log cannot be opened
+         */
+        explicit RegistryStore(const std::string& directory, size_t compact_bytes = 4 * 1024 * 1024)
+            : m_directory(directory), m_compact_bytes(compact_bytes) {
+            std::filesystem::create_directories(directory);
+            m_wal_path = directory + "/cns.wal";
+            m_snapshot_path = directory + "/cns.snapshot";
+            m_wal_fd = open(m_wal_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (m_wal_fd < 0) {
+                throw std::runtime_error("Failed to open CNS log " + m_wal_path + ": " + strerror(errno));
+            }
+        }
+
+        ~RegistryStore() {
+            if (m_wal_fd >= 0) {
+                close(m_wal_fd);
+            }
+        }
+
+        RegistryStore(const RegistryStore&) = delete;
+        RegistryStore& operator=(const RegistryStore&) = delete;
+
+        /**
+         * Replays the snapshot and then the log, calling apply for every mutation in order.
+         *
+         * @return number of mutations replayed
+         * @throws std::runtime_error if the snapshot is unreadable or corrupt
+         */
+        size_t recover(const Apply& apply) {
+            size_t count = 0;
+            struct stat st;
+            if (stat(m_snapshot_path.c_str(), &st) == 0) {
+                count += replay(m_snapshot_path, true, apply);
+            }
+            size_t good = 0;
+            count += replay(m_wal_path, false, apply, &good);
+            if (static_cast<off_t>(good) != file_size(m_wal_fd)) {
+                // Torn final record, drop it so new appends follow the last good one
+                if (ftruncate(m_wal_fd, good) != 0) {
+                    throw std::runtime_error("Failed to truncate CNS log " + m_wal_path + ": " + strerror(errno));
+                }
+            }
+            m_wal_bytes = good;
+            return count;
+        }
+
+        /**
+         * Appends one mutation to the log.
+         *
+         * A failed write is cut back off the log, since recovery stops at the first bad
+         * record and would drop everything appended after it. Either way the mutation is
+         * missing from the log, so needs_compaction() is true until a snapshot has captured
+         * it. If the cut fails too, appends are refused until then.
+         *
+         * @throws std::runtime_error if the write fails or the log is broken
+         */
+        void append(const nlohmann::json& mutation) {
+            if (m_broken) {
+                throw std::runtime_error("CNS log " + m_wal_path + " has a torn record, waiting for a compaction");
+            }
+            std::vector<uint8_t> record = encode_record(mutation);
+            try {
+                write_all(m_wal_fd, record.data(), record.size(), m_wal_path);
+            } catch (const std::runtime_error&) {
+                m_missing = true;
+                m_broken = ftruncate(m_wal_fd, m_wal_bytes) != 0;
+                throw;
+            }
+            m_wal_bytes += record.size();
+        }
+
+        bool needs_compaction() const { return m_missing || m_wal_bytes >= m_compact_bytes; }
+        size_t wal_bytes() const { return m_wal_bytes; }
+
+        /**
+         * Writes a new snapshot and empties the log.
+         *
+         * @param write_state called with a function that takes one mutation; must emit
+         *                    mutations that rebuild the current registry from empty
+         * @throws std::runtime_error if the snapshot cannot be written; the log is kept
+         */
+        void compact(const std::function<void(const Apply&)>& write_state) {
+            std::string tmp_path = m_snapshot_path + ".tmp";
+            int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                throw std::runtime_error("Failed to create CNS snapshot " + tmp_path + ": " + strerror(errno));
+            }
+            try {
+                std::vector<uint8_t> buffer(HEADER_SIZE);
+                uint64_t count = 0;
+                write_state([&](const nlohmann::json& mutation) {
+                    std::vector<uint8_t> record = encode_record(mutation);
+                    buffer.insert(buffer.end(), record.begin(), record.end());
+                    count++;
+                });
+                std::memcpy(buffer.data(), SNAPSHOT_MAGIC, 4);
+                std::memcpy(buffer.data() + 4, &SNAPSHOT_VERSION, 4);
+                std::memcpy(buffer.data() + 8, &count, 8);
+                write_all(fd, buffer.data(), buffer.size(), tmp_path);
+                if (fsync(fd) != 0) {
+                    throw std::runtime_error("Failed to sync CNS snapshot " + tmp_path + ": " + strerror(errno));
+                }
+            } catch (...) {
+                close(fd);
+                unlink(tmp_path.c_str());
+                throw;
+            }
+            close(fd);
+
+            if (rename(tmp_path.c_str(), m_snapshot_path.c_str()) != 0) {
+                unlink(tmp_path.c_str());
+                throw std::runtime_error("Failed to replace CNS snapshot " + m_snapshot_path + ": " + strerror(errno));
+            }
+            int dir_fd = open(m_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dir_fd >= 0) {
+                fsync(dir_fd);
+                close(dir_fd);
+            }
+
+            // Replaying the old log over the new snapshot is harmless, so a crash before
+            // this point loses nothing
+            if (ftruncate(m_wal_fd, 0) != 0) {
+                throw std::runtime_error("Failed to truncate CNS log " + m_wal_path + ": " + strerror(errno));
+            }
+            m_wal_bytes = 0;
+            m_missing = false;
+            m_broken = false;
+        }
+
+    private:
+        static constexpr char SNAPSHOT_MAGIC[4] = {'C', 'N', 'S', 'S'};
+        static constexpr uint32_t SNAPSHOT_VERSION = 1;
+        static constexpr size_t HEADER_SIZE = 16;
+        static constexpr size_t RECORD_HEADER_SIZE = 8;
+
+        static uint32_t crc32(const uint8_t* data, size_t size) {
+            static const auto table = [] {
+                std::array<uint32_t, 256> t{};
+                for (uint32_t i = 0; i < 256; i++) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++) {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    t[i] = c;
+                }
+                return t;
+            }();
+            uint32_t crc = 0xFFFFFFFFu;
+            for (size_t i = 0; i < size; i++) {
+                crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return crc ^ 0xFFFFFFFFu;
+        }
+
+        static std::vector<uint8_t> encode_record(const nlohmann::json& mutation) {
+            std::vector<uint8_t> record(RECORD_HEADER_SIZE);
+            nlohmann::json::to_msgpack(mutation, record);
+            uint32_t size = static_cast<uint32_t>(record.size() - RECORD_HEADER_SIZE);
+            uint32_t crc = crc32(record.data() + RECORD_HEADER_SIZE, size);
+            std::memcpy(record.data(), &size, 4);
+            std::memcpy(record.data() + 4, &crc, 4);
+            return record;
+        }
+
+        static off_t file_size(int fd) {
+            struct stat st;
+            return fstat(fd, &st) == 0 ? st.st_size : 0;
+        }
+
+        static void write_all(int fd, const uint8_t* data, size_t size, const std::string& path) {
+            while (size > 0) {
+                ssize_t written = write(fd, data, size);
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error("Failed to write " + path + ": " + strerror(errno));
+                }
+                data += written;
+                size -= written;
+            }
+        }
+
+        /**
+         * Maps a file and applies every intact record in it.
+         *
+         * @param good if not null, receives the offset just past the last intact record
+         */
+        static size_t replay(const std::string& path, bool snapshot, const Apply& apply, size_t* good = nullptr) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                if (snapshot) {
+                    throw std::runtime_error("Failed to open CNS snapshot " + path + ": " + strerror(errno));
+                }
+                return 0;
+            }
+            size_t size = file_size(fd);
+            if (size == 0) {
+                close(fd);
+                if (snapshot) {
+                    throw std::runtime_error("Corrupt CNS snapshot " + path);
+                }
+                if (good != nullptr) *good = 0;
+                return 0;
+            }
+            void* base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (base == MAP_FAILED) {
+                throw std::runtime_error("Failed to map " + path + ": " + strerror(errno));
+            }
+            const uint8_t* data = static_cast<const uint8_t*>(base);
+
+            size_t offset = 0;
+            uint64_t expected = UINT64_MAX;
+            if (snapshot) {
+                uint32_t version = 0;
+                if (size < HEADER_SIZE || std::memcmp(data, SNAPSHOT_MAGIC, 4) != 0) {
+                    munmap(base, size);
+                    throw std::runtime_error("Not a CNS snapshot: " + path);
+                }
+                std::memcpy(&version, data + 4, 4);
+                std::memcpy(&expected, data + 8, 8);
+                if (version != SNAPSHOT_VERSION) {
+                    munmap(base, size);
+                    throw std::runtime_error("Unsupported CNS snapshot version in " + path);
+                }
+                offset = HEADER_SIZE;
+            }
+
+            size_t count = 0;
+            while (offset + RECORD_HEADER_SIZE <= size && count < expected) {
+                uint32_t record_size, crc;
+                std::memcpy(&record_size, data + offset, 4);
+                std::memcpy(&crc, data + offset + 4, 4);
+                const uint8_t* payload = data + offset + RECORD_HEADER_SIZE;
+                if (record_size > size - offset - RECORD_HEADER_SIZE || crc32(payload, record_size) != crc) {
+                    break;
+                }
+                nlohmann::json mutation = nlohmann::json::from_msgpack(payload, payload + record_size, true, false);
+                if (mutation.is_discarded()) {
+                    break;
+                }
+                apply(mutation);
+                offset += RECORD_HEADER_SIZE + record_size;
+                count++;
+            }
+            munmap(base, size);
+
+            if (snapshot && count != expected) {
+                throw std::runtime_error("Corrupt CNS snapshot " + path);
+            }
+            if (good != nullptr) {
+                *good = offset;
+            }
+            return count;
+        }
+
+        std::string m_directory;
+        std::string m_wal_path;
+        std::string m_snapshot_path;
+        size_t m_compact_bytes;
+        size_t m_wal_bytes = 0;   // end of the last good record
+        int m_wal_fd = -1;
+        bool m_missing = false;   // a mutation failed to append, only a snapshot has it
+        bool m_broken = false;    // and its torn bytes could not be cut off either
+};
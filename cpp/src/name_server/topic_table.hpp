@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Open addressing hash table keyed by topic name.
+ *
+ * Linear probing over a power of two number of slots, kept at most half full so a lookup
+ * is usually a single probe. Each slot caches the key's hash so probes only compare strings
+ * on a hash match. Erased slots become tombstones and are cleaned up on the next rehash.
+ *
+ * @tparam Value mapped type, must be default constructible and copyable
+ */
+template <typename Value>
+class TopicTable {
+    public:
+        TopicTable() : m_slots(INITIAL_CAPACITY) {}
+
+        /**
+         * @return the value stored for key, or nullptr
+         */
+        const Value* find(std::string_view key) const {
+            size_t index = find_index(key, hash(key));
+            return index == NOT_FOUND ? nullptr : &m_slots[index].value;
+        }
+
+        /**
+         * Inserts or overwrites the value for key.
+         *
+         * @return true if key was not present before
+         */
+        bool insert_or_assign(const std::string& key, Value value) {
+            if ((m_size + m_tombstones + 1) * 2 > m_slots.size()) {
+                // Grow when live entries alone fill a quarter, otherwise just drop tombstones
+                bool grow = (m_size + 1) * 4 > m_slots.size();
+                rehash(grow ? m_slots.size() * 2 : m_slots.size());
+            }
+
+            size_t h = hash(key);
+            size_t index = find_index(key, h);
+            if (index != NOT_FOUND) {
+                m_slots[index].value = std::move(value);
+                return false;
+            }
+
+            size_t mask = m_slots.size() - 1;
+            for (size_t i = h & mask;; i = (i + 1) & mask) {
+                Slot& slot = m_slots[i];
+                if (slot.state != FULL) {
+                    if (slot.state == TOMBSTONE) {
+                        m_tombstones--;
+                    }
+                    slot.state = FULL;
+                    slot.hash = h;
+                    slot.key = key;
+                    slot.value = std::move(value);
+                    m_size++;
+                    return true;
+                }
+            }
+        }
+
+        /**
+         * @return true if key was present
+         */
+        bool erase(std::string_view key) {
+            size_t index = find_index(key, hash(key));
+            if (index == NOT_FOUND) {
+                return false;
+            }
+            Slot& slot = m_slots[index];
+            slot.state = TOMBSTONE;
+            slot.key.clear();
+            slot.value = Value();
+            m_size--;
+            m_tombstones++;
+            return true;
+        }
+
+        void clear() {
+            m_slots.assign(INITIAL_CAPACITY, Slot());
+            m_size = 0;
+            m_tombstones = 0;
+        }
+
+        size_t size() const { return m_size; }
+
+        /**
+         * Calls fn(key, value) for every entry, in no particular order.
+         */
+        template <typename Fn>
+        void for_each(Fn&& fn) const {
+            for (const Slot& slot : m_slots) {
+                if (slot.state == FULL) {
+                    fn(slot.key, slot.value);
+                }
+            }
+        }
+
+    private:
+        static constexpr size_t INITIAL_CAPACITY = 64;
+        static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+        enum SlotState : uint8_t { EMPTY, FULL, TOMBSTONE };
+
+        struct Slot {
+            SlotState state = EMPTY;
+            size_t hash = 0;
+            std::string key;
+            Value value;
+        };
+
+        static size_t hash(std::string_view key) {
+            return std::hash<std::string_view>()(key);
+        }
+
+        size_t find_index(std::string_view key, size_t h) const {
+            size_t mask = m_slots.size() - 1;
+            for (size_t i = h & mask;; i = (i + 1) & mask) {
+                const Slot& slot = m_slots[i];
+                if (slot.state == EMPTY) {
+                    return NOT_FOUND;
+                }
+                if (slot.state == FULL && slot.hash == h && slot.key == key) {
+                    return i;
+                }
+            }
+        }
+
+        void rehash(size_t capacity) {
+            std::vector<Slot> old(capacity);
+            old.swap(m_slots);
+            m_size = 0;
+            m_tombstones = 0;
+            size_t mask = capacity - 1;
+            for (Slot& slot : old) {
+                if (slot.state != FULL) {
+                    continue;
+                }
+                size_t i = slot.hash & mask;
+                while (m_slots[i].state == FULL) {
+                    i = (i + 1) & mask;
+                }
+                m_slots[i] = std::move(slot);
+                m_size++;
+            }
+        }
+
+        std::vector<Slot> m_slots;
+        size_t m_size = 0;
+        size_t m_tombstones = 0;
+};
@@ -2,12 +2,21 @@
 
 #include <string>
 #include <zmq.hpp>
+#include <zmq_addon.hpp>
 #include <nlohmann/json.hpp>
 #include <atomic>
 #include <thread>
 #include <functional>
 #include <iostream>
 #include <mutex>
+#include <memory>
+#include <map>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <unordered_set>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "quill/Frontend.h"
 #include "quill/LogMacros.h"
@@ -15,12 +24,56 @@
 #include "quill/sinks/ConsoleSink.h"
 #include "quill/sinks/FileSink.h"
 
+#include "cns_client.hpp"
+#include "cns_protocol.hpp"
 #include "constants.hpp"
+#include "frame_header.hpp"
+#include "shm_ring.hpp"
+#include "subscription.hpp"
 
 using namespace std;
 
 using json = nlohmann::json;
 
+template <typename Owner>
+void release_zero_copy_owner(void* /*data*/, void* hint) {
+    delete static_cast<Owner*>(hint);
+}
+
+/**
+ * @brief Wraps an existing buffer in a zmq message without copying it.
+ *
+ * `owner` is anything that keeps `data` alive while it exists (a k4a::image, a cv::Mat,
+ * a shared_ptr, ...). It is moved onto the heap and destroyed from the zmq free callback,
+ * i.e. only after the I/O thread has finished sending the message.
+ */
+template <typename Owner>
+zmq::message_t make_zero_copy_message(void* data, size_t size, Owner owner) {
+    auto keep_alive = make_unique<Owner>(std::move(owner));
+    zmq::message_t msg(data, size, &release_zero_copy_owner<Owner>, keep_alive.get());
+    keep_alive.release();
+    return msg;
+}
+
+/**
+ * @brief One image frame as returned by GenericNode::recv_frame.
+ *
+ * `data` points either into `payload` (frames that travelled over tcp) or straight into a
+ * publisher's shared memory ring. A shared memory slot can be overwritten once the publisher
+ * laps the ring, so callers should check is_valid() after they are done reading `data`.
+ */
+struct ReceivedFrame {
+    string topic;
+    FrameHeader header;
+    zmq::message_t payload;
+    const void* data = nullptr;
+    size_t size = 0;
+    const ShmRingReader* shm = nullptr;
+    ShmSlotDescriptor shm_desc;
+
+    bool is_valid() const { return shm == nullptr || shm->is_valid(shm_desc); }
+};
+
 /**
  * @brief GenericNode Test description for a git push as well!!!
  * Every Generic node has the following IO
@@ -41,20 +94,65 @@ class GenericNode {
         string m_node_id;            // unique identifier
 
         zmq::context_t m_context;
-        zmq::socket_t m_cns_socket;   // REQ socket for talking with the CNS
+        unique_ptr<CnsClient> m_cns_client;  // requests to the CNS, from any thread
         string m_topic;              // e.g. /kinect/0
 
         // CNS (Parameter server)
         string m_cns_ip = "127.0.0.1";
         int m_cns_port = 5555;
-        vector<string> m_registered_topics;
+        // Standby CNS to fail over to, advertised in the primary's sync events or set with
+        // set_cns_standby(). The endpoint fields are guarded by m_cns_endpoint_mtx; every
+        // failover bumps m_cns_generation so the event and heartbeat threads reconnect.
+        string m_cns_standby_ip;
+        int m_cns_standby_port = 0;
+        std::mutex m_cns_endpoint_mtx;
+        std::atomic<uint64_t> m_cns_generation{0};
+        CnsEncoding m_cns_encoding = CnsEncoding::JSON;
+        // Register request of every topic this node registered, to send again if the CNS
+        // loses it (see restore_registrations()). Changed from any thread.
+        map<string, json> m_registered_topics;
+        std::mutex m_registered_topics_mtx;
+
+        // Lookup replies by topic. Only used while the CNS event stream is live, which keeps
+        // the entries current; every change event bumps the generation so a lookup that raced
+        // it is not cached.
+        map<string, json, less<>> m_lookup_cache;
+        std::mutex m_lookup_cache_mtx;
+        uint64_t m_lookup_cache_generation = 0;
+        bool m_lookup_cache_live = false;
+        bool m_enable_lookup_cache = true;
+
+        // Managed subscriptions by topic, retargeted from the CNS event thread. The counter
+        // goes up with every register or moved event, so subscribe() can tell whether one
+        // raced its lookup.
+        map<string, vector<weak_ptr<Subscription>>, less<>> m_subscriptions;
+        std::mutex m_subscriptions_mtx;
+        uint64_t m_subscription_events = 0;
+
+        // Parameter watches, see watch_parameters(). Only ever appended to; the CNS event
+        // thread subscribes to the ones past m_watches_subscribed.
+        using ParameterCallback = std::function<void(const string& key, const string& value, uint64_t revision)>;
+        vector<pair<string, ParameterCallback>> m_watches;
+        std::mutex m_watches_mtx;
+        size_t m_watches_subscribed = 0;          // CNS event thread only
+        map<string, uint64_t> m_watch_revisions;  // latest revision delivered per key, CNS event thread only
+
+        // Blob chunks read from the CNS, one file per chunk named by its hash; see get_blob().
+        // Empty to not cache.
+        string m_blob_cache_directory = BLOB_CACHE_DIRECTORY;
 
         // Heartbeat
-        const int HEARTBEAT_INTERVAL_MS = 1000;  // Send heartbeat every second
+        const int HEARTBEAT_INTERVAL_MS = CNS_HEARTBEAT_INTERVAL_MS;  // Send heartbeat every second
+
+        // How long one wait_for request in setup_subscriber() may be parked on the CNS
+        const int64_t SUBSCRIBER_WAIT_MS = 30000;
+        const int SHUTDOWN_UNREGISTER_MS = 500;  // How long shutdown waits for the CNS to drop our topics
+        const int WATCH_POLL_MS = 100;           // Longest a new parameter watch waits to take effect
+        const size_t BLOB_REQUESTS_IN_FLIGHT = 4;  // Blob transfers pipeline this many CNS_MAX_BLOB_READ requests
 
         // Threaded stop variables
         std::atomic<bool> m_atomic_stop{false}; // This will stop everyone, everywhere
-        std::mutex mtx;
+        std::atomic<bool> m_shut_down{false};
         
         vector<thread> m_threads;
         quill::Logger* m_logger;
@@ -63,6 +161,16 @@ class GenericNode {
         string m_log_name;
         string m_alignment_log_name;
         string m_ip_address;
+        string m_hostname;
+
+        // Shared memory transport for same host subscribers
+        unique_ptr<ShmRingWriter> m_shm_writer;
+        map<string, unique_ptr<ShmRingReader>, less<>> m_shm_readers;
+        std::mutex m_shm_mtx;
+
+        // Locality aware transports
+        bool m_enable_inproc = false;
+        int m_publisher_count = 0;
 
 
         /*
@@ -90,29 +198,140 @@ class GenericNode {
             LOG_ERROR(this->m_logger, "{}", message_view);
         }
 
-        void setup_cns_socket() {
-            this->m_cns_socket = zmq::socket_t(m_context, ZMQ_REQ);
-            this->m_cns_socket.set(zmq::sockopt::linger, 0);
-            this->m_cns_socket.set(zmq::sockopt::rcvtimeo, 500);
-            this->m_cns_socket.connect("tcp://" + m_cns_ip + ":" + to_string(m_cns_port));
+        /**
+         * "ip:port" of the current CNS plus a port offset.
+         */
+        string cns_endpoint(int port_offset) {
+            lock_guard<mutex> lock(m_cns_endpoint_mtx);
+            return m_cns_ip + ":" + to_string(m_cns_port + port_offset);
         }
 
         /**
-         * Sends a request/reply message to the cns.
+         * Swaps the CNS and its standby, unless someone else already failed over since
+         * `seen_generation` was read.
+         *
+         * @return true if this node now talks to a different CNS
          */
-        auto send_req_cns(zmq::message_t &reply, string request_str) {
-            lock_guard<mutex> lock(mtx);
-            this->m_cns_socket.send(zmq::buffer(request_str), zmq::send_flags::none);
-            LOG_INFO(m_logger, "Sent to cns socket: {}", request_str);
-            auto success = this->m_cns_socket.recv(reply, zmq::recv_flags::none);
-            while (!success) {
-                LOG_ERROR(m_logger, "Failed to receive reply from cns socket - message was {}", request_str);
-                success = this->m_cns_socket.recv(reply, zmq::recv_flags::none);
+        bool fail_over_cns(uint64_t seen_generation) {
+            lock_guard<mutex> lock(m_cns_endpoint_mtx);
+            if (m_cns_standby_ip.empty() || m_cns_generation.load() != seen_generation) {
+                return false;
             }
+            LOG_WARNING(m_logger, "CNS {}:{} stopped answering, failing over to standby {}:{}", m_cns_ip, m_cns_port,
+                        m_cns_standby_ip, m_cns_standby_port);
+            std::swap(m_cns_ip, m_cns_standby_ip);
+            std::swap(m_cns_port, m_cns_standby_port);
+            m_cns_generation++;
+            m_cns_client->reconnect("tcp://" + m_cns_ip + ":" + to_string(m_cns_port));
+            return true;
+        }
 
-            return success;
-        }    
+        /**
+         * Whether sending a request twice has the same effect as sending it once, so that it
+         * can be sent again when its reply does not come. A compare-and-set is not: if the
+         * first one went through, the second fails with a conflict. A batch is if all its
+         * operations are.
+         */
+        static bool is_idempotent(const json& request) {
+            string action = request.value("action", "");
+            if (action == "set") {
+                return !request.contains("expected_revision");
+            }
+            if (action == "batch" && request.contains("requests")) {
+                for (const json& operation : request["requests"]) {
+                    if (!is_idempotent(operation)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Sends a request to the cns in this node's CnsEncoding and waits for the reply.
+         * Other threads keep talking to the CNS meanwhile. If no reply comes for
+         * CNS_FAILOVER_TIMEOUT_MS the request is sent again, to the standby if one is known,
+         * provided it is_idempotent().
+         *
+         * @throws nlohmann::json::exception if the reply cannot be decoded
+         * @throws CnsTimeout if a request that is not idempotent got no reply; it may or may
+         *         not have been applied
+         * @throws std::runtime_error if the node is stopped before a reply arrives
+         */
+        json cns_request(const json& request) {
+            if (m_cns_encoding == CnsEncoding::JSON) {
+                LOG_INFO(m_logger, "Sent to cns: {}", request.dump());
+            }
+            bool retry = is_idempotent(request);
+            while (true) {
+                uint64_t generation = m_cns_generation.load();
+                try {
+                    return m_cns_client->call(request, std::chrono::milliseconds(CNS_FAILOVER_TIMEOUT_MS));
+                } catch (const CnsTimeout&) {
+                    if (m_atomic_stop.load(std::memory_order_relaxed)) {
+                        throw std::runtime_error("Node stopped while waiting for the CNS");
+                    }
+                    bool failed_over = fail_over_cns(generation);
+                    if (!retry) {
+                        throw;
+                    }
+                    if (!failed_over) {
+                        LOG_ERROR(m_logger, "No reply from the CNS in {} ms, retrying", CNS_FAILOVER_TIMEOUT_MS);
+                    }
+                }
+            }
+        }
+
+        /**
+         * Sends a request to the cns without waiting for the reply. Any number may be in
+         * flight at once, from any thread; there is no retry or failover.
+         *
+         * @return the decoded reply, or CnsTimeout if none arrives within timeout
+         */
+        std::future<json> cns_request_async(const json& request,
+                                            std::chrono::milliseconds timeout = std::chrono::milliseconds(CNS_FAILOVER_TIMEOUT_MS)) {
+            return m_cns_client->request(request, timeout);
+        }
         
+        /**
+         * Sends several requests to the cns in one round trip.
+         *
+         * @return one reply per request, in order
+         * @throws std::runtime_error if the cns rejected the batch as a whole
+         */
+        vector<json> cns_batch(const vector<json>& requests) {
+            json reply = cns_request({
+                {"self", m_topic},
+                {"action", "batch"},
+                {"requests", requests}
+            });
+            if (reply.value("status", "") != "success" || !reply.contains("results") || reply["results"].size() != requests.size()) {
+                LOG_ERROR(m_logger, "Batch of {} requests failed: {}", requests.size(), reply.value("message", ""));
+                throw std::runtime_error("CNS batch request failed");
+            }
+            return reply["results"].get<vector<json>>();
+        }
+
+        json register_request(const string& topic, int port, const vector<string>& endpoints) {
+            json request = {
+                {"self", m_topic},
+                {"action", "register"},
+                {"topic", topic},
+                {"ip", m_ip_address},
+                {"port", port},
+                {"host", m_hostname},
+                {"pid", getpid()},
+                {"context", context_token()}
+            };
+            if (!endpoints.empty()) {
+                request["endpoints"] = endpoints;
+            }
+            if (m_shm_writer) {
+                request["shm"] = m_shm_writer->name();
+            }
+            return request;
+        }
+
         /**
          * Registers a topic with the central name server (CNS).
          * The CNS will store the IP address and port number of the topic
@@ -120,88 +339,1096 @@ class GenericNode {
          *
          * @param topic a string identifying the topic
          * @param port the port number for the service
+         * @param endpoints every zmq endpoint the publisher is bound to (tcp, ipc, inproc)
          * @return true if the registration was successful, false if not
          */
-        bool register_service(const string& topic, int port) {
+        bool register_service(const string& topic, int port, const vector<string>& endpoints = {}) {
+            json request = register_request(topic, port, endpoints);
+            json reply_json = cns_request(request);
+            if (reply_json["status"] != "success") {
+                LOG_ERROR(m_logger, "Registration failed: {}", to_string(reply_json["error"]));
+                return false;
+            }
+            lock_guard<mutex> lock(m_registered_topics_mtx);
+            m_registered_topics[topic] = std::move(request);
+            
+            return true;
+        }
+
+        /**
+         * Registers several topics with the CNS in one round trip.
+         *
+         * @param services topic and port of each service
+         * @param endpoints every zmq endpoint the publishers are bound to, shared by all services
+         * @return true if every registration was successful; failures, including the CNS
+         *         rejecting or never answering the batch, are logged rather than thrown
+         */
+        bool register_services(const vector<pair<string, int>>& services, const vector<string>& endpoints = {}) {
+            if (services.empty()) {
+                return true;
+            }
+            vector<json> requests;
+            for (const auto& service : services) {
+                requests.push_back(register_request(service.first, service.second, endpoints));
+            }
+
+            vector<json> results;
+            try {
+                results = cns_batch(requests);
+            } catch (const std::runtime_error& e) {
+                LOG_ERROR(m_logger, "Registration of {} topics failed: {}", services.size(), e.what());
+                return false;
+            }
+            bool success = true;
+            lock_guard<mutex> lock(m_registered_topics_mtx);
+            for (size_t i = 0; i < results.size(); i++) {
+                if (results[i].value("status", "") != "success") {
+                    LOG_ERROR(m_logger, "Registration of {} failed: {}", services[i].first, results[i].value("message", ""));
+                    success = false;
+                    continue;
+                }
+                m_registered_topics[services[i].first] = std::move(requests[i]);
+            }
+            return success;
+        }
+
+        /**
+         * unregisters a service from the Central Name Server (CNS).
+         * 
+         * This function constructs a deregistration request for the given topic 
+         * and sends it to the CNS. It waits for a reply and checks if the 
+         * deregistration was successful.
+         * 
+         * @param topic The topic of the service to be unregistered.
+         * @return true if the deregistration was successful, false otherwise.
+         */
+        bool unregister_service(const string& topic) {
             json request = {
                 {"self", m_topic},
-                {"action", "register"},
-                {"topic", topic},
-                {"ip", m_ip_address},
-                {"port", port}
+                {"action", "unregister"},
+                {"topic", topic}
             };
+
+            // Forgotten first, so its unregister event is not taken for the CNS losing it
+            json registration = forget_registration(topic);
+            json reply_json = cns_request(request);
+            if (reply_json["status"] != "success") {
+                LOG_ERROR(m_logger, "Deregistration failed: {}", to_string(reply_json["error"]));
+                if (!registration.is_null()) {
+                    lock_guard<mutex> lock(m_registered_topics_mtx);
+                    m_registered_topics.emplace(topic, std::move(registration));
+                }
+                return false;
+            }
             
-            string request_str = request.dump();
-            zmq::message_t reply;
-            send_req_cns(reply, request_str);
+            return true;
+        }
 
-            string reply_str(static_cast<char*>(reply.data()), reply.size());
-            LOG_DEBUG(m_logger, "Received reply: {}", reply_str);
+        /**
+         * Removes a topic from m_registered_topics.
+         *
+         * @return its register request, or null if it was not registered
+         */
+        json forget_registration(const string& topic) {
+            lock_guard<mutex> lock(m_registered_topics_mtx);
+            auto it = m_registered_topics.find(topic);
+            if (it == m_registered_topics.end()) {
+                return nullptr;
+            }
+            json registration = std::move(it->second);
+            m_registered_topics.erase(it);
+            return registration;
+        }
 
-            // parse the reply
-            json reply_json = json::parse(reply_str);
-            if (reply_json["status"] != "success") {
-                LOG_ERROR(m_logger, "Registration failed: {}", to_string(reply_json["error"]));
+        /**
+         * Empties m_registered_topics.
+         *
+         * @return the topics it held
+         */
+        vector<string> forget_registrations() {
+            lock_guard<mutex> lock(m_registered_topics_mtx);
+            vector<string> topics;
+            for (const auto& entry : m_registered_topics) {
+                topics.push_back(entry.first);
+            }
+            m_registered_topics.clear();
+            return topics;
+        }
+
+        /**
+         * unregisters all currently registered services from
+         * the Central Name Server (CNS).
+         *
+         * This function iterates over all topics stored in m_registered_topics
+         * and attempts to unregister each one. If any service fails to unregister,
+         * the function returns false immediately. If all services are successfully
+         * unregistered, the function returns true.
+         *
+         * @return true if all services are successfully unregistered, false otherwise.
+         */
+        bool unregister_all_services() {
+            vector<string> topics = forget_registrations();
+            if (topics.empty()) {
+                return true;
+            }
+            vector<json> requests;
+            for (const auto& topic : topics) {
+                LOG_INFO(m_logger, "unregistering service: {}", topic);
+                requests.push_back({
+                    {"self", m_topic},
+                    {"action", "unregister"},
+                    {"topic", topic}
+                });
+            }
+            vector<json> results = cns_batch(requests);
+            for (size_t i = 0; i < results.size(); i++) {
+                if (results[i].value("status", "") != "success") {
+                    LOG_ERROR(m_logger, "Deregistration failed for {}", topics[i]);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Unregisters every topic this node registered, in one request that waits at most
+         * timeout for the CNS and never retries or fails over. Meant for shutdown, when a
+         * slow CNS must not hold the node up: topics it does not hear about here expire with
+         * their lease once the heartbeats stop.
+         *
+         * @return true if the CNS unregistered all of them
+         */
+        bool release_registrations(std::chrono::milliseconds timeout) {
+            vector<string> topics = forget_registrations();
+            if (!m_cns_client || topics.empty()) {
+                return true;
+            }
+            json requests = json::array();
+            for (const auto& topic : topics) {
+                requests.push_back({
+                    {"self", m_topic},
+                    {"action", "unregister"},
+                    {"topic", topic}
+                });
+            }
+            try {
+                json reply = m_cns_client->call({
+                    {"self", m_topic},
+                    {"action", "batch"},
+                    {"requests", std::move(requests)}
+                }, timeout);
+                if (reply.value("status", "") != "success") {
+                    LOG_WARNING(m_logger, "CNS refused to unregister our topics: {}", reply.value("message", ""));
+                    return false;
+                }
+            } catch (const std::exception& err) {
+                LOG_WARNING(m_logger, "Could not unregister our topics, leaving them to expire: {}", err.what());
                 return false;
             }
-            m_registered_topics.push_back(topic);
-            
-            return true;
+            LOG_INFO(m_logger, "Unregistered {} topics", topics.size());
+            return true;
+        }
+
+        /**
+         * Reads one parameter from the CNS key/value store.
+         *
+         * @return the get reply: "found", and "data" and "revision" if found
+         */
+        json get_parameter(const string& key) {
+            return cns_request({
+                {"self", m_topic},
+                {"action", "get"},
+                {"key", key}
+            });
+        }
+
+        /**
+         * Reads several parameters in one round trip, all as of the same store revision.
+         *
+         * @return one entry per key, in order: "key", "found", and "data" and "revision" if found
+         * @throws std::runtime_error if the read failed
+         */
+        vector<json> get_parameters(const vector<string>& keys) {
+            json reply = cns_request({
+                {"self", m_topic},
+                {"action", "mget"},
+                {"keys", keys}
+            });
+            if (reply.value("status", "") != "success") {
+                LOG_ERROR(m_logger, "Reading {} parameters failed: {}", keys.size(), reply.value("message", ""));
+                throw std::runtime_error("CNS mget request failed");
+            }
+            return reply["entries"].get<vector<json>>();
+        }
+
+        /**
+         * Sets a parameter. With expected_revision it is a compare-and-set: the value is only
+         * written if the key is still at that revision (0: does not exist yet), so a
+         * read-modify-write cannot lose a concurrent update.
+         *
+         * @param expected_revision the revision the key was read at, or -1 to always write
+         * @return the set reply: the new "revision" on success; on a failed compare-and-set
+         *         "status" is "error", "conflict" is true and "revision" is the current one
+         * @throws CnsTimeout if a compare-and-set got no reply, since it is not retried; read
+         *         the key again to find out whether it was written
+         */
+        json set_parameter(const string& key, const string& value, int64_t expected_revision = -1) {
+            json request = {
+                {"self", m_topic},
+                {"action", "set"},
+                {"key", key},
+                {"data", value}
+            };
+            if (expected_revision >= 0) {
+                request["expected_revision"] = expected_revision;
+            }
+            return cns_request(request);
+        }
+
+        /**
+         * Calls callback(key, value, revision) with the current value of every parameter whose
+         * key starts with prefix, and again each time one of them changes. Changes are pushed
+         * by the CNS, once per change for all watching nodes, so nothing polls.
+         *
+         * Callbacks run on the CNS event thread and must not block. Each revision of a key is
+         * delivered at most once and never after a later one. Changes are picked up again
+         * after events were lost or the CNS failed over, but intermediate values may then be
+         * skipped. An empty value means the parameter was cleared.
+         */
+        void watch_parameters(const string& prefix, ParameterCallback callback) {
+            lock_guard<mutex> lock(m_watches_mtx);
+            m_watches.emplace_back(prefix, std::move(callback));
+        }
+
+        /**
+         * Stores a large value (calibration tables, camera intrinsics, lookup tables) as a
+         * blob. The value is cut into CNS_BLOB_CHUNK_SIZE chunks named by their hash; only the
+         * chunks the CNS does not have yet are uploaded, several at a time, and the key is then
+         * set to refer to them. get_parameter() and watchers see the blob's reference, which
+         * changes whenever the content does; read the content with get_blob().
+         *
+         * @param expected_revision as for set_parameter()
+         * @return the set reply, with the blob's "hash" on success
+         * @throws std::runtime_error if a chunk could not be uploaded
+         */
+        json set_blob(const string& key, const string& content, int64_t expected_revision = -1) {
+            if (content.empty()) {
+                return set_parameter(key, content, expected_revision);
+            }
+            vector<string> chunks;
+            for (size_t offset = 0; offset < content.size(); offset += CNS_BLOB_CHUNK_SIZE) {
+                chunks.push_back(sha256_hex(content.data() + offset, min(CNS_BLOB_CHUNK_SIZE, content.size() - offset)));
+            }
+            json reply = cns_request({
+                {"self", m_topic},
+                {"action", "blob_missing"},
+                {"chunks", chunks}
+            });
+            if (reply.value("status", "") != "success") {
+                LOG_ERROR(m_logger, "Blob {}: checking for stored chunks failed: {}", key, reply.value("message", ""));
+                throw std::runtime_error("CNS blob_missing request failed");
+            }
+            unordered_set<string> missing = reply["missing"].get<unordered_set<string>>();
+
+            // A bounded number of chunks in flight, so a huge value is not copied all at once
+            const size_t window = BLOB_REQUESTS_IN_FLIGHT * CNS_MAX_BLOB_READ / CNS_BLOB_CHUNK_SIZE;
+            deque<std::future<CnsReply>> uploads;
+            size_t uploaded = 0;
+            auto finish_upload = [&]() {
+                CnsReply upload = uploads.front().get();
+                uploads.pop_front();
+                if (upload.body.value("status", "") != "success") {
+                    LOG_ERROR(m_logger, "Blob {}: uploading a chunk failed: {}", key, upload.body.value("message", ""));
+                    throw std::runtime_error("CNS put_chunk request failed");
+                }
+                uploaded++;
+            };
+            for (size_t i = 0; i < chunks.size(); i++) {
+                // Identical chunks are uploaded once
+                if (missing.erase(chunks[i]) == 0) {
+                    continue;
+                }
+                if (uploads.size() >= window) {
+                    finish_upload();
+                }
+                size_t offset = i * CNS_BLOB_CHUNK_SIZE;
+                vector<zmq::message_t> frames;
+                frames.emplace_back(content.data() + offset, min(CNS_BLOB_CHUNK_SIZE, content.size() - offset));
+                uploads.push_back(m_cns_client->request_frames({
+                    {"self", m_topic},
+                    {"action", "put_chunk"},
+                    {"hash", chunks[i]}
+                }, std::move(frames), std::chrono::milliseconds(CNS_FAILOVER_TIMEOUT_MS)));
+            }
+            while (!uploads.empty()) {
+                finish_upload();
+            }
+            LOG_INFO(m_logger, "Blob {}: {} bytes in {} chunks, uploaded {}", key, content.size(), chunks.size(), uploaded);
+
+            json request = {
+                {"self", m_topic},
+                {"action", "set"},
+                {"key", key},
+                {"blob", {
+                    {"size", content.size()},
+                    {"chunks", chunks}
+                }}
+            };
+            if (expected_revision >= 0) {
+                request["expected_revision"] = expected_revision;
+            }
+            return cns_request(request);
+        }
+
+        /**
+         * Reads a blob stored with set_blob(), or the value of a plain parameter. Chunks are
+         * kept in the blob cache directory, so a node that starts again, or reads a blob of
+         * which only a part changed, downloads only the chunks it has not seen: an unchanged
+         * blob costs a single get. Missing chunks come CNS_MAX_BLOB_READ bytes per request,
+         * several requests in flight, and every chunk is checked against its hash.
+         *
+         * @param content receives the value
+         * @return false if the key is not set
+         * @throws std::runtime_error if the blob could not be read completely
+         */
+        bool get_blob(const string& key, string& content) {
+            json reply = get_parameter(key);
+            if (!reply.value("found", false)) {
+                return false;
+            }
+            if (!reply.contains("blob")) {
+                content = reply["data"].get<string>();
+                return true;
+            }
+            const json& blob = reply["blob"];
+            vector<string> chunks = blob["chunks"].get<vector<string>>();
+            uint64_t size = blob["size"].get<uint64_t>();
+            uint64_t chunk_size = blob["chunk_size"].get<uint64_t>();
+            content.assign(size, '\0');
+
+            // Where each distinct chunk goes; a chunk may repeat
+            map<string, vector<size_t>> positions;
+            for (size_t i = 0; i < chunks.size(); i++) {
+                positions[chunks[i]].push_back(i);
+            }
+            auto place = [&](const string& hash, const void* data, size_t data_size) {
+                for (size_t index : positions[hash]) {
+                    uint64_t offset = index * chunk_size;
+                    uint64_t expected = index + 1 < chunks.size() ? chunk_size : size - min(offset, size);
+                    if (offset >= size || data_size != expected) {
+                        throw std::runtime_error("Blob " + key + " has a chunk of the wrong size");
+                    }
+                    memcpy(&content[offset], data, data_size);
+                }
+            };
+
+            vector<string> missing;
+            string cached;
+            for (const auto& chunk : positions) {
+                if (read_cached_chunk(chunk.first, cached)) {
+                    place(chunk.first, cached.data(), cached.size());
+                } else {
+                    missing.push_back(chunk.first);
+                }
+            }
+
+            const size_t per_request = max<size_t>(1, CNS_MAX_BLOB_READ / max<uint64_t>(chunk_size, 1));
+            deque<std::future<CnsReply>> reads;
+            size_t next = 0;
+            while (next < missing.size() || !reads.empty()) {
+                while (next < missing.size() && reads.size() < BLOB_REQUESTS_IN_FLIGHT) {
+                    vector<string> batch(missing.begin() + next, missing.begin() + min(next + per_request, missing.size()));
+                    next += batch.size();
+                    reads.push_back(m_cns_client->request_frames({
+                        {"self", m_topic},
+                        {"action", "get_chunks"},
+                        {"chunks", batch}
+                    }, {}, std::chrono::milliseconds(CNS_FAILOVER_TIMEOUT_MS)));
+                }
+                CnsReply read = reads.front().get();
+                reads.pop_front();
+                json served = read.body.value("chunks", json::array());
+                if (read.body.value("status", "") != "success" || !read.body.value("missing", json::array()).empty()
+                        || served.size() != read.frames.size()) {
+                    LOG_ERROR(m_logger, "Blob {}: reading chunks failed: {}", key, read.body.value("message", "chunks missing"));
+                    throw std::runtime_error("CNS get_chunks request failed");
+                }
+                for (size_t i = 0; i < served.size(); i++) {
+                    const string& hash = served[i].get_ref<const string&>();
+                    const zmq::message_t& frame = read.frames[i];
+                    if (sha256_hex(frame.data(), frame.size()) != hash) {
+                        throw std::runtime_error("Blob " + key + " has a chunk that does not match its hash");
+                    }
+                    place(hash, frame.data(), frame.size());
+                    write_cached_chunk(hash, frame.data(), frame.size());
+                }
+            }
+            LOG_INFO(m_logger, "Blob {}: {} bytes, {} of {} chunks from the cache", key, size,
+                     positions.size() - missing.size(), positions.size());
+            return true;
+        }
+
+        /**
+         * Reads part of a blob without fetching the rest: length bytes from offset, fewer at
+         * the end of the blob. Requests of CNS_MAX_BLOB_READ bytes are pipelined and all pinned
+         * to the blob the first one saw, so a concurrent set_blob() fails the read rather than
+         * mixing two values. Nothing is cached.
+         *
+         * @param data receives the bytes read
+         * @param hash if not empty, the blob must still be this one (from a get_parameter() or
+         *             an earlier read)
+         * @return false if the key is not set or not a blob
+         * @throws std::runtime_error if the blob changed or a request failed
+         */
+        bool read_blob(const string& key, uint64_t offset, uint64_t length, string& data, const string& hash = "") {
+            auto range_request = [&](uint64_t from, uint64_t bytes, const string& pinned) {
+                json request = {
+                    {"self", m_topic},
+                    {"action", "read_blob"},
+                    {"key", key},
+                    {"offset", from},
+                    {"length", bytes}
+                };
+                if (!pinned.empty()) {
+                    request["hash"] = pinned;
+                }
+                return m_cns_client->request_frames(request, {}, std::chrono::milliseconds(CNS_FAILOVER_TIMEOUT_MS));
+            };
+            auto append = [&](CnsReply& read) {
+                if (read.body.value("status", "") != "success") {
+                    LOG_ERROR(m_logger, "Blob {}: range read failed: {}", key, read.body.value("message", ""));
+                    throw std::runtime_error("CNS read_blob request failed");
+                }
+                for (const zmq::message_t& frame : read.frames) {
+                    data.append(static_cast<const char*>(frame.data()), frame.size());
+                }
+            };
+
+            data.clear();
+            CnsReply first = range_request(offset, min<uint64_t>(length, CNS_MAX_BLOB_READ), hash).get();
+            if (first.body.value("status", "") == "success" && !first.body.value("found", false)) {
+                return false;
+            }
+            append(first);
+            string pinned = first.body["hash"].get<string>();
+            uint64_t end = min(offset + length, first.body["size"].get<uint64_t>());
+            data.reserve(end - offset);
+
+            deque<std::future<CnsReply>> reads;
+            uint64_t next = offset + data.size();
+            while (next < end || !reads.empty()) {
+                while (next < end && reads.size() < BLOB_REQUESTS_IN_FLIGHT) {
+                    uint64_t bytes = min<uint64_t>(end - next, CNS_MAX_BLOB_READ);
+                    reads.push_back(range_request(next, bytes, pinned));
+                    next += bytes;
+                }
+                CnsReply read = reads.front().get();
+                reads.pop_front();
+                append(read);
+            }
+            return true;
+        }
+
+        /**
+         * Reads a chunk from the blob cache, if it is there and intact.
+         */
+        bool read_cached_chunk(const string& hash, string& data) {
+            if (m_blob_cache_directory.empty()) {
+                return false;
+            }
+            ifstream file(m_blob_cache_directory + "/" + hash, ios::binary);
+            if (!file) {
+                return false;
+            }
+            data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+            return sha256_hex(data.data(), data.size()) == hash;
+        }
+
+        /**
+         * Adds a chunk to the blob cache. Written to a temporary file and renamed, so readers
+         * never see half a chunk; a cache that cannot be written is only a slower start.
+         */
+        void write_cached_chunk(const string& hash, const void* data, size_t size) {
+            if (m_blob_cache_directory.empty()) {
+                return;
+            }
+            mkdir(IPC_DIRECTORY, 0777);
+            mkdir(m_blob_cache_directory.c_str(), 0777);
+            string path = m_blob_cache_directory + "/" + hash;
+            // Unique, since other threads and processes may cache the same chunk at once
+            static std::atomic<uint64_t> tmp_files{0};
+            string tmp_path = path + "." + to_string(getpid()) + "." + to_string(tmp_files++) + ".tmp";
+            {
+                ofstream file(tmp_path, ios::binary | ios::trunc);
+                file.write(static_cast<const char*>(data), size);
+                if (!file) {
+                    LOG_DEBUG(m_logger, "Could not cache blob chunk in {}", m_blob_cache_directory);
+                    file.close();
+                    unlink(tmp_path.c_str());
+                    return;
+                }
+            }
+            if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+                unlink(tmp_path.c_str());
+            }
+        }
+
+        /**
+         * Looks a topic up, from the cache when possible.
+         *
+         * @return the CNS lookup reply
+         */
+        json lookup_topic(const string& topic) {
+            uint64_t generation = 0;
+            bool cacheable = false;
+            {
+                lock_guard<mutex> lock(m_lookup_cache_mtx);
+                if (m_lookup_cache_live) {
+                    auto entry = m_lookup_cache.find(topic);
+                    if (entry != m_lookup_cache.end()) {
+                        return entry->second;
+                    }
+                }
+                generation = m_lookup_cache_generation;
+                cacheable = m_enable_lookup_cache && m_lookup_cache_live;
+            }
+
+            json reply = cns_request(lookup_request(topic));
+            if (cacheable) {
+                lock_guard<mutex> lock(m_lookup_cache_mtx);
+                store_lookup(topic, reply, generation);
+            }
+            return reply;
+        }
+
+        /**
+         * Looks several topics up: cached ones locally, the rest in one batch to the CNS.
+         *
+         * @return one CNS lookup reply per topic, in order
+         * @throws std::runtime_error if the batch failed
+         */
+        vector<json> lookup_many(const vector<string>& topics) {
+            vector<json> replies(topics.size());
+            vector<size_t> misses;
+            uint64_t generation = 0;
+            bool cacheable = false;
+            {
+                lock_guard<mutex> lock(m_lookup_cache_mtx);
+                for (size_t i = 0; i < topics.size(); i++) {
+                    auto entry = m_lookup_cache_live ? m_lookup_cache.find(topics[i]) : m_lookup_cache.end();
+                    if (entry != m_lookup_cache.end()) {
+                        replies[i] = entry->second;
+                    } else {
+                        misses.push_back(i);
+                    }
+                }
+                generation = m_lookup_cache_generation;
+                cacheable = m_enable_lookup_cache && m_lookup_cache_live;
+            }
+            if (misses.empty()) {
+                return replies;
+            }
+
+            vector<json> requests;
+            for (size_t i : misses) {
+                requests.push_back(lookup_request(topics[i]));
+            }
+            vector<json> results = cns_batch(requests);
+
+            lock_guard<mutex> lock(m_lookup_cache_mtx);
+            for (size_t j = 0; j < misses.size(); j++) {
+                if (cacheable) {
+                    store_lookup(topics[misses[j]], results[j], generation);
+                }
+                replies[misses[j]] = std::move(results[j]);
+            }
+            return replies;
+        }
+
+        json lookup_request(const string& topic) {
+            return {
+                {"self", m_topic},
+                {"action", "lookup"},
+                {"topic", topic}
+            };
+        }
+
+        /**
+         * Caches a successful lookup unless the registry changed since `generation` was read.
+         * Caller holds m_lookup_cache_mtx.
+         */
+        void store_lookup(const string& topic, const json& reply, uint64_t generation) {
+            if (m_lookup_cache_live && generation == m_lookup_cache_generation
+                    && reply.value("status", "") == "success" && reply.value("found", false)) {
+                m_lookup_cache[topic] = reply;
+            }
+        }
+
+        /**
+         * Remembers the standby a primary advertised, unless it is the CNS we talk to.
+         */
+        void learn_cns_standby(const string& standby) {
+            size_t colon = standby.rfind(':');
+            if (colon == string::npos) {
+                return;
+            }
+            string ip = standby.substr(0, colon);
+            int port = std::stoi(standby.substr(colon + 1));
+            lock_guard<mutex> lock(m_cns_endpoint_mtx);
+            if ((ip == m_cns_ip && port == m_cns_port) || (ip == m_cns_standby_ip && port == m_cns_standby_port)) {
+                return;
+            }
+            LOG_INFO(m_logger, "CNS standby is {}", standby);
+            m_cns_standby_ip = ip;
+            m_cns_standby_port = port;
+        }
+
+        /**
+         * Applies one CNS registry event to the lookup cache. A gap in the sequence numbers
+         * means events were lost (or the CNS restarted), so the cache starts over.
+         *
+         * @return true if the cache started over, i.e. events before this one may be missing
+         */
+        bool apply_cns_event(const json& event, uint64_t& last_seq) {
+            uint64_t seq = event.value("seq", uint64_t(0));
+            string type = event.value("event", "");
+            string topic = event.value("topic", "");
+
+            lock_guard<mutex> lock(m_lookup_cache_mtx);
+            bool resynced = !m_lookup_cache_live || seq != last_seq + 1;
+            if (resynced) {
+                if (m_lookup_cache_live) {
+                    LOG_WARNING(m_logger, "Missed CNS events {} to {}, dropping lookup cache", last_seq + 1, seq - 1);
+                }
+                m_lookup_cache.clear();
+                m_lookup_cache_generation++;
+                m_lookup_cache_live = true;
+            }
+            last_seq = seq;
+
+            if (type == "sync") {
+                if (event.contains("standby")) {
+                    learn_cns_standby(event["standby"].get<string>());
+                }
+                return resynced;
+            }
+            m_lookup_cache_generation++;
+            if (type == "register" || type == "moved") {
+                auto entry = m_lookup_cache.find(topic);
+                if (entry != m_lookup_cache.end()) {
+                    entry->second = event["lookup"];
+                }
+                if (type == "moved") {
+                    LOG_INFO(m_logger, "Topic {} moved to {}:{}", topic, event["lookup"].value("ip", ""), event["lookup"].value("port", 0));
+                }
+            } else if (type == "unregister" || type == "expired") {
+                m_lookup_cache.erase(topic);
+            } else {
+                m_lookup_cache.clear();
+            }
+            return resynced;
+        }
+
+        /**
+         * Points managed subscriptions at the new endpoint of a topic that was registered
+         * again or moved. If events may have been missed, every subscribed topic is looked
+         * up again instead.
+         */
+        void update_subscriptions(const json& event, bool resynced) {
+            string type = event.value("event", "");
+            if (resynced) {
+                resolve_subscriptions();
+                return;
+            }
+            if (type != "register" && type != "moved") {
+                return;
+            }
+            string topic = event.value("topic", "");
+            vector<shared_ptr<Subscription>> subscriptions;
+            {
+                lock_guard<mutex> lock(m_subscriptions_mtx);
+                m_subscription_events++;
+                subscriptions = live_subscriptions(topic);
+            }
+            if (subscriptions.empty()) {
+                return;
+            }
+            SubscriberTarget target = subscriber_target(topic, event["lookup"]);
+            for (auto& subscription : subscriptions) {
+                subscription->retarget(target);
+            }
+        }
+
+        /**
+         * Registers this node's topics again when the CNS has lost them, so a node whose lease
+         * ran out during a CNS stall or after lost heartbeats does not stay unreachable. That
+         * is the case for one of its topics expiring or being unregistered by someone else.
+         * After a reset or missed events (a CNS restart or failover among them) its topics are
+         * looked up, and the ones that are not registered any more are registered again.
+         * A topic another publisher registered is left to it.
+         */
+        void restore_registrations(const json& event, bool resynced) {
+            string type = event.value("event", "");
+            bool all = resynced || type == "reset";
+            vector<json> requests;
+            {
+                lock_guard<mutex> lock(m_registered_topics_mtx);
+                if (all) {
+                    for (const auto& entry : m_registered_topics) {
+                        requests.push_back(entry.second);
+                    }
+                } else if (type == "expired" || type == "unregister") {
+                    auto it = m_registered_topics.find(event.value("topic", ""));
+                    if (it != m_registered_topics.end()) {
+                        requests.push_back(it->second);
+                    }
+                } else if (type == "register" || type == "moved") {
+                    // Another publisher took the topic over; it is theirs now
+                    auto it = m_registered_topics.find(event.value("topic", ""));
+                    const json& lookup = event["lookup"];
+                    if (it != m_registered_topics.end()
+                            && (lookup.value("ip", "") != it->second["ip"] || lookup.value("port", 0) != it->second["port"])) {
+                        LOG_INFO(m_logger, "Topic {} was registered by {}, no longer restoring it", it->first, lookup.value("owner", ""));
+                        m_registered_topics.erase(it);
+                    }
+                }
+            }
+            if (requests.empty() || m_atomic_stop.load(std::memory_order_relaxed)) {
+                return;
+            }
+            if (all) {
+                vector<string> topics;
+                for (const json& request : requests) {
+                    topics.push_back(request["topic"].get<string>());
+                }
+                vector<json> replies = lookup_many(topics);
+                vector<json> lost;
+                for (size_t i = 0; i < replies.size(); i++) {
+                    if (replies[i].value("status", "") == "success" && !replies[i].value("found", false)) {
+                        lost.push_back(std::move(requests[i]));
+                    }
+                }
+                requests = std::move(lost);
+                if (requests.empty()) {
+                    return;
+                }
+            }
+
+            vector<json> results = cns_batch(requests);
+            vector<json> unwanted;
+            lock_guard<mutex> lock(m_registered_topics_mtx);
+            for (size_t i = 0; i < results.size(); i++) {
+                const string& topic = requests[i]["topic"].get_ref<const string&>();
+                if (results[i].value("status", "") != "success") {
+                    LOG_ERROR(m_logger, "Could not register {} again: {}", topic, results[i].value("message", ""));
+                } else if (m_registered_topics.count(topic) == 0) {
+                    // Unregistered by this node meanwhile
+                    unwanted.push_back({
+                        {"self", m_topic},
+                        {"action", "unregister"},
+                        {"topic", topic}
+                    });
+                } else {
+                    LOG_WARNING(m_logger, "The CNS lost topic {}, registered it again", topic);
+                }
+            }
+            if (!unwanted.empty()) {
+                cns_request_async({
+                    {"self", m_topic},
+                    {"action", "batch"},
+                    {"requests", std::move(unwanted)}
+                });
+            }
+        }
+
+        /**
+         * Looks every subscribed topic up and retargets the subscriptions whose publisher
+         * moved. Topics that are not registered right now are left alone; their next
+         * registration event retargets them.
+         */
+        void resolve_subscriptions() {
+            vector<string> topics;
+            {
+                lock_guard<mutex> lock(m_subscriptions_mtx);
+                m_subscription_events++;
+                for (auto it = m_subscriptions.begin(); it != m_subscriptions.end();) {
+                    if (live_subscriptions(it->first).empty()) {
+                        it = m_subscriptions.erase(it);
+                    } else {
+                        topics.push_back(it->first);
+                        ++it;
+                    }
+                }
+            }
+            if (topics.empty()) {
+                return;
+            }
+            vector<json> replies = lookup_many(topics);
+            for (size_t i = 0; i < topics.size(); i++) {
+                if (replies[i].value("status", "") != "success" || !replies[i].value("found", false)) {
+                    continue;
+                }
+                SubscriberTarget target = subscriber_target(topics[i], replies[i]);
+                lock_guard<mutex> lock(m_subscriptions_mtx);
+                for (auto& subscription : live_subscriptions(topics[i])) {
+                    subscription->retarget(target);
+                }
+            }
+        }
+
+        /**
+         * Subscriptions of a topic that are still in use; drops the rest. Caller holds
+         * m_subscriptions_mtx.
+         */
+        vector<shared_ptr<Subscription>> live_subscriptions(const string& topic) {
+            vector<shared_ptr<Subscription>> live;
+            auto it = m_subscriptions.find(topic);
+            if (it == m_subscriptions.end()) {
+                return live;
+            }
+            auto& entries = it->second;
+            for (auto entry = entries.begin(); entry != entries.end();) {
+                if (auto subscription = entry->lock()) {
+                    live.push_back(std::move(subscription));
+                    ++entry;
+                } else {
+                    entry = entries.erase(entry);
+                }
+            }
+            return live;
+        }
+
+        /**
+         * Subscribes the CNS event socket to watches added since the last call.
+         *
+         * @return true if there were any
+         */
+        bool subscribe_watches(zmq::socket_t& events) {
+            lock_guard<mutex> lock(m_watches_mtx);
+            if (m_watches_subscribed == m_watches.size()) {
+                return false;
+            }
+            for (; m_watches_subscribed < m_watches.size(); m_watches_subscribed++) {
+                events.set(zmq::sockopt::subscribe, CNS_DATA_EVENT_PREFIX + m_watches[m_watches_subscribed].first);
+            }
+            return true;
+        }
+
+        /**
+         * Reads every watched prefix from the CNS and delivers whatever is newer than what
+         * the watches have seen.
+         *
+         * @throws std::runtime_error if a read fails
+         */
+        void refresh_watches() {
+            vector<string> prefixes;
+            {
+                lock_guard<mutex> lock(m_watches_mtx);
+                for (const auto& watch : m_watches) {
+                    prefixes.push_back(watch.first);
+                }
+            }
+            for (const string& prefix : prefixes) {
+                json reply = cns_request({
+                    {"self", m_topic},
+                    {"action", "mget"},
+                    {"prefix", prefix}
+                });
+                if (reply.value("status", "") != "success") {
+                    throw std::runtime_error("Failed to read parameters under " + prefix);
+                }
+                for (const json& entry : reply["entries"]) {
+                    deliver_parameter(entry["key"], entry["data"], entry["revision"]);
+                }
+            }
+        }
+
+        /**
+         * Calls the watches of a key with its new value, unless they have seen this revision
+         * or a later one already. Runs on the CNS event thread.
+         */
+        void deliver_parameter(const string& key, const string& value, uint64_t revision) {
+            uint64_t& seen = m_watch_revisions[key];
+            if (revision <= seen) {
+                return;
+            }
+            seen = revision;
+            vector<ParameterCallback> callbacks;
+            {
+                lock_guard<mutex> lock(m_watches_mtx);
+                for (const auto& watch : m_watches) {
+                    if (key.compare(0, watch.first.size(), watch.first) == 0) {
+                        callbacks.push_back(watch.second);
+                    }
+                }
+            }
+            for (auto& callback : callbacks) {
+                callback(key, value, revision);
+            }
+        }
+
+        /**
+         * Follows the CNS registry events to keep the lookup cache current. If the stream goes
+         * quiet for longer than a few sync intervals the cache is dropped until it resumes.
+         */
+        void cns_event_loop() {
+            zmq::socket_t events;
+            uint64_t generation = 0;
+            auto connect_events = [&]() {
+                generation = m_cns_generation.load();
+                events = zmq::socket_t(m_context, zmq::socket_type::sub);
+                events.set(zmq::sockopt::linger, 0);
+                events.connect("tcp://" + cns_endpoint(CNS_EVENTS_PORT_OFFSET));
+                events.set(zmq::sockopt::subscribe, CNS_EVENT_TOPIC);
+                // Watched values are read again once the new stream resyncs
+                m_watches_subscribed = 0;
+                subscribe_watches(events);
+            };
+            connect_events();
+
+            const auto stale_after = std::chrono::milliseconds(3 * CNS_EVENT_SYNC_INTERVAL_MS);
+            auto last_event = std::chrono::steady_clock::now();
+            uint64_t last_seq = 0;
+            bool resolve_pending = false;
+            vector<zmq::message_t> frames;
+            while (!m_atomic_stop.load(std::memory_order_relaxed)) {
+                try {
+                    if (generation != m_cns_generation.load()) {
+                        // Different CNS, different sequence numbers; start over
+                        connect_events();
+                        last_event = std::chrono::steady_clock::now();
+                        lock_guard<mutex> lock(m_lookup_cache_mtx);
+                        m_lookup_cache.clear();
+                        m_lookup_cache_generation++;
+                        m_lookup_cache_live = false;
+                    }
+                    if (subscribe_watches(events)) {
+                        // Changes from before the subscription took effect
+                        refresh_watches();
+                    }
+                    zmq::pollitem_t items[] = {
+                        { events, 0, ZMQ_POLLIN, 0 }
+                    };
+                    zmq::poll(items, 1, std::chrono::milliseconds(WATCH_POLL_MS));
+                    if (!(items[0].revents & ZMQ_POLLIN)) {
+                        auto silent = std::chrono::steady_clock::now() - last_event;
+                        if (silent > stale_after) {
+                            lock_guard<mutex> lock(m_lookup_cache_mtx);
+                            if (m_lookup_cache_live) {
+                                LOG_WARNING(m_logger, "No CNS events for {} ms, dropping lookup cache", stale_after.count());
+                                m_lookup_cache.clear();
+                                m_lookup_cache_live = false;
+                            }
+                        }
+                        // Nodes that never send requests still need their heartbeats to
+                        // reach whichever CNS is live
+                        if (silent > std::chrono::milliseconds(CNS_FAILOVER_TIMEOUT_MS)) {
+                            fail_over_cns(generation);
+                        }
+                        continue;
+                    }
+
+                    frames.clear();
+                    if (!zmq::recv_multipart(events, std::back_inserter(frames)) || frames.size() != 2) {
+                        continue;
+                    }
+                    last_event = std::chrono::steady_clock::now();
+                    json event = decode_cns_message(frames[1].data(), frames[1].size());
+                    if (frames[0].to_string_view().rfind(CNS_DATA_EVENT_PREFIX, 0) == 0) {
+                        deliver_parameter(event["key"], event["data"], event["revision"]);
+                        continue;
+                    }
+                    bool resynced = apply_cns_event(event, last_seq) || resolve_pending;
+                    update_subscriptions(event, resynced);
+                    restore_registrations(event, resynced);
+                    if (resynced) {
+                        // Parameter changes may have been missed along with registry events
+                        refresh_watches();
+                    }
+                    resolve_pending = false;
+                } catch (const zmq::error_t& err) {
+                    if (err.num() == ETERM) {
+                        break;
+                    }
+                    LOG_ERROR(m_logger, "ZMQ error on CNS events: {}", err.what());
+                } catch (const json::exception& e) {
+                    LOG_ERROR(m_logger, "Bad CNS event: {}", e.what());
+                } catch (const std::runtime_error& e) {
+                    // Re-resolving subscriptions, watches or registrations failed; try again with
+                    // the next event
+                    resolve_pending = true;
+                    LOG_WARNING(m_logger, "Could not look subscribed topics or watched parameters up again, or restore our topics: {}", e.what());
+                }
+            }
         }
 
         /**
-         * unregisters a service from the Central Name Server (CNS).
-         * 
-         * This function constructs a deregistration request for the given topic 
-         * and sends it to the CNS. It waits for a reply and checks if the 
-         * deregistration was successful.
-         * 
-         * @param topic The topic of the service to be unregistered.
-         * @return true if the deregistration was successful, false otherwise.
+         * @brief Creates this node's shared memory frame ring.
+         *
+         * Must be called before setup_publisher() so the segment name is registered with the
+         * CNS next to the tcp endpoint. Subscribers on the same host then map the segment and
+         * read frames in place; remote subscribers keep using tcp.
+         *
+         * @param slot_count number of frames the ring holds before it wraps
+         * @param slot_size size of the largest frame that will be published
          */
-        bool unregister_service(const string& topic) {
-            json request = {
-                {"self", m_topic},
-                {"action", "unregister"},
-                {"topic", topic}
-            };
-            
-            string request_str = request.dump();
-            zmq::message_t reply;
-            send_req_cns(reply, request_str);
-
-            string reply_str(static_cast<char*>(reply.data()), reply.size());
-            LOG_DEBUG(m_logger, "Received reply: {}", reply_str);
+        void setup_shm_transport(uint64_t slot_count, uint64_t slot_size) {
+            string name = "candor_" + m_node_id + "_" + to_string(getpid());
+            std::replace(name.begin(), name.end(), '/', '_');
+            m_shm_writer = make_unique<ShmRingWriter>("/" + name, slot_count, slot_size);
+            LOG_INFO(m_logger, "Shared memory ring {} ({} x {} bytes)", m_shm_writer->name(), slot_count, slot_size);
+        }
 
-            // parse the reply
-            json reply_json = json::parse(reply_str);
-            if (reply_json["status"] != "success") {
-                LOG_ERROR(m_logger, "Deregistration failed: {}", to_string(reply_json["error"]));
+        /**
+         * Maps a publisher's shared memory segment if it is not mapped yet.
+         *
+         * @return true if the segment is available for reading
+         */
+        bool attach_shm_segment(const string& segment) {
+            lock_guard<mutex> lock(m_shm_mtx);
+            if (m_shm_readers.find(segment) != m_shm_readers.end()) {
+                return true;
+            }
+            try {
+                m_shm_readers[segment] = make_unique<ShmRingReader>(segment);
+            } catch (const std::runtime_error& e) {
+                LOG_WARNING(m_logger, "Falling back to tcp: {}", e.what());
                 return false;
             }
-            
+            LOG_INFO(m_logger, "Mapped shared memory segment {}", segment);
             return true;
         }
 
         /**
-         * unregisters all currently registered services from
-         * the Central Name Server (CNS).
-         *
-         * This function iterates over all topics stored in m_registered_topics
-         * and attempts to unregister each one. If any service fails to unregister,
-         * the function returns false immediately. If all services are successfully
-         * unregistered, the function returns true.
+         * Copies a frame into this node's shared memory ring and publishes its slot
+         * descriptor on SHM_TOPIC_PREFIX + topic.
          *
-         * @return true if all services are successfully unregistered, false otherwise.
+         * @return false if the shared memory transport is not set up or the frame does not fit
          */
-        bool unregister_all_services() {
-            for (const auto& topic : m_registered_topics) {
-                LOG_INFO(m_logger, "unregistering service: {}", topic);
-                if (!unregister_service(topic)) {
-                    LOG_ERROR(m_logger, "Deregistration failed for {}", topic);
-                    return false;
-                }
+        bool publish_shm_frame(zmq::socket_t& socket, const string& topic, const FrameHeader& header, const void* data, size_t size) {
+            if (!m_shm_writer) {
+                return false;
+            }
+            ShmSlotDescriptor desc;
+            if (!m_shm_writer->write(data, size, desc)) {
+                LOG_WARNING(m_logger, "Frame of {} bytes does not fit shared memory slot of {} bytes", size, m_shm_writer->slot_size());
+                return false;
             }
+
+            const size_t prefix_len = sizeof(SHM_TOPIC_PREFIX) - 1;
+            zmq::message_t topic_msg(prefix_len + topic.size());
+            memcpy(topic_msg.data(), SHM_TOPIC_PREFIX, prefix_len);
+            memcpy(static_cast<char*>(topic_msg.data()) + prefix_len, topic.data(), topic.size());
+            socket.send(topic_msg, zmq::send_flags::sndmore);
+
+            FrameHeader shm_header = header;
+            shm_header.flags |= FRAME_FLAG_SHM;
+            zmq::message_t header_msg(sizeof(FrameHeader));
+            encode_frame_header(shm_header, header_msg.data(), header_msg.size());
+            socket.send(header_msg, zmq::send_flags::sndmore);
+
+            zmq::message_t desc_msg(&desc, sizeof(desc));
+            socket.send(desc_msg, zmq::send_flags::none);
             return true;
         }
 
@@ -211,58 +1438,312 @@ class GenericNode {
          * This function contacts the Central Name Server (CNS) to retrieve the IP address 
          * and port associated with the specified topic. It then connects the provided 
          * subscriber socket to the retrieved endpoint and subscribes to the topic.
+         * If the topic is not registered yet it waits for it (see wait_for_topic()).
          * 
+         * The socket stays connected to the endpoint found now; use subscribe() to follow
+         * the publisher when it restarts.
+         *
          * @param topic The topic to subscribe to.
-         * @param new_subscriber The ZMQ subscriber socket to be configured.
          * 
          * @throws std::runtime_error if the topic lookup fails.
          */
         unique_ptr<zmq::socket_t> setup_subscriber(const string& topic) {
-            // Find the port number from the cns
-            json request = {
-                {"self", m_topic},
-                {"action", "lookup"},
-                {"topic", topic}
-            };
-            
-            bool found = false;
-            json reply_json;
-            while (!found && !m_atomic_stop.load(std::memory_order_relaxed)) {
+            return connect_subscriber(topic, resolve_topic(topic));
+        }
+
+        /**
+         * @brief Subscribes to a topic and keeps following its publisher.
+         *
+         * Resolves the topic like setup_subscriber(), waiting for it to be registered. When
+         * the publisher restarts somewhere else, the CNS event thread retargets the
+         * subscription, and Subscription::refresh() moves the same socket over. A reader
+         * that polls the socket should call refresh() once per loop iteration, since a dead
+         * publisher sends nothing to wake it up; recv_frame() also calls it.
+         *
+         * @throws std::runtime_error if the topic lookup fails
+         */
+        shared_ptr<Subscription> subscribe(const string& topic) {
+            uint64_t events = subscription_events();
+            return manage_subscription(topic, resolve_topic(topic), events);
+        }
+
+        /**
+         * @brief subscribe() to every topic currently matching a glob pattern (see
+         * query_topics()).
+         *
+         * @return one subscription per match, sorted by topic
+         * @throws std::runtime_error if a query fails
+         */
+        vector<shared_ptr<Subscription>> subscribe_matching(const string& pattern) {
+            uint64_t events = subscription_events();
+            vector<shared_ptr<Subscription>> subscriptions;
+            for (const json& reply : query_topics(pattern)) {
+                subscriptions.push_back(manage_subscription(reply["topic"], reply, events));
+            }
+            LOG_INFO(m_logger, "Subscribed to {} topics matching {}", subscriptions.size(), pattern);
+            return subscriptions;
+        }
 
-                // Send the request
-                string request_str = request.dump();
-                zmq::message_t reply;
-                send_req_cns(reply, request_str);
+        uint64_t subscription_events() {
+            lock_guard<mutex> lock(m_subscriptions_mtx);
+            return m_subscription_events;
+        }
 
-                string reply_str(static_cast<char*>(reply.data()), reply.size());
-                LOG_DEBUG(m_logger, "Received reply: {}", reply_str);
+        /**
+         * Creates a subscription from a lookup reply and hands it to the CNS event thread.
+         *
+         * @param events subscription_events() from before the lookup. If a registration event
+         *               came in since, it may have been for this topic before the subscription
+         *               was listed, so the topic is looked up once more.
+         */
+        shared_ptr<Subscription> manage_subscription(const string& topic, const json& reply_json, uint64_t events) {
+            auto socket = make_unique<zmq::socket_t>(m_context, zmq::socket_type::sub);
+            socket->set(zmq::sockopt::rcvhwm, 10);
+            auto subscription = make_shared<Subscription>(topic, std::move(socket), subscriber_target(topic, reply_json), m_logger);
+            LOG_INFO(m_logger, "Subscribed to topic: {} at {}", topic, subscription->target().endpoint);
+            bool raced;
+            {
+                lock_guard<mutex> lock(m_subscriptions_mtx);
+                m_subscriptions[topic].push_back(subscription);
+                raced = m_subscription_events != events;
+            }
+            if (raced) {
+                json latest = lookup_topic(topic);
+                if (latest.value("status", "") == "success" && latest.value("found", false)) {
+                    subscription->retarget(subscriber_target(topic, latest));
+                }
+            }
+            return subscription;
+        }
 
-                // parse the reply
-                reply_json = json::parse(reply_str);
+        /**
+         * Looks a topic up, waiting for it to be registered if it is not yet.
+         *
+         * @return the CNS lookup reply
+         * @throws std::runtime_error if the topic lookup fails
+         */
+        json resolve_topic(const string& topic) {
+            // Find the port number from the cns
+            bool found = false;
+            json reply_json;
+            reply_json = lookup_topic(topic);
+            while (!m_atomic_stop.load(std::memory_order_relaxed)) {
                 if (reply_json["status"] != "success") {
                     LOG_ERROR(m_logger, "Lookup failed: {}", to_string(reply_json["error"]));
                     throw std::runtime_error("Failed to lookup topic");
                 } 
                 found = reply_json["found"];
-                if (!found) {
-                    LOG_WARNING(m_logger, "Topic {} not found. Retrying...", topic);
+                if (found) {
+                    break;
+                }
+                // The CNS answers as soon as the topic is registered
+                LOG_WARNING(m_logger, "Topic {} not found. Waiting for it...", topic);
+                reply_json = wait_for_topic(topic, SUBSCRIBER_WAIT_MS);
+                if (!reply_json.value("found", false) && !reply_json.value("timed_out", false)) {
+                    // The CNS did not hold the request, e.g. it predates wait_for
                     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+                    reply_json = lookup_topic(topic);
                 }
             }
-            
-            // Connect to the topic
-            string ip = reply_json["ip"];
-            string port = to_string(reply_json["port"]);
+            return reply_json;
+        }
+
+        /**
+         * Waits until a topic is registered, or timeout_ms passes. The request is parked on
+         * the CNS and answered the moment the topic is registered; other requests from this
+         * node go ahead meanwhile. Gives up early if the node is stopped.
+         *
+         * @return the CNS lookup reply; "found" is false and "timed_out" true on timeout
+         */
+        json wait_for_topic(const string& topic, int64_t timeout_ms) {
+            json request = {
+                {"self", m_topic},
+                {"action", "wait_for"},
+                {"topic", topic},
+                {"timeout_ms", timeout_ms}
+            };
+            uint64_t generation = m_cns_generation.load();
+            std::future<json> reply = cns_request_async(request, std::chrono::milliseconds(timeout_ms + CNS_FAILOVER_TIMEOUT_MS));
+            while (!m_atomic_stop.load(std::memory_order_relaxed)) {
+                if (reply.wait_for(std::chrono::milliseconds(500)) != std::future_status::ready) {
+                    continue;
+                }
+                try {
+                    return reply.get();
+                } catch (const CnsTimeout&) {
+                    break;
+                }
+            }
+            if (!m_atomic_stop.load(std::memory_order_relaxed)) {
+                fail_over_cns(generation);
+            }
+            return {
+                {"status", "success"},
+                {"topic", topic},
+                {"found", false},
+                {"timed_out", true}
+            };
+        }
+
+        /**
+         * @brief Sets up subscriber sockets for several topics, looking them all up in one
+         * round trip. Topics that are not registered yet are waited for one at a time, the same
+         * as setup_subscriber().
+         *
+         * @return one subscriber socket per topic, in order
+         * @throws std::runtime_error if a lookup fails
+         */
+        vector<unique_ptr<zmq::socket_t>> setup_subscribers(const vector<string>& topics) {
+            vector<json> replies = lookup_many(topics);
+            vector<unique_ptr<zmq::socket_t>> subscribers;
+            for (size_t i = 0; i < topics.size(); i++) {
+                if (replies[i].value("status", "") == "success" && replies[i].value("found", false)) {
+                    subscribers.push_back(connect_subscriber(topics[i], replies[i]));
+                } else {
+                    subscribers.push_back(setup_subscriber(topics[i]));
+                }
+            }
+            return subscribers;
+        }
+
+        /**
+         * Finds every registered topic matching a glob pattern, following the CNS's pages.
+         * `*` matches within one level of a topic name and `**` across levels.
+         *
+         * @return the lookup reply of each matching topic, sorted by topic
+         * @throws std::runtime_error if a query fails
+         */
+        vector<json> query_topics(const string& pattern) {
+            vector<json> topics;
+            string after;
+            while (true) {
+                json request = {
+                    {"self", m_topic},
+                    {"action", "query"},
+                    {"pattern", pattern},
+                    {"limit", CNS_MAX_QUERY_LIMIT}
+                };
+                if (!after.empty()) {
+                    request["after"] = after;
+                }
+                json reply = cns_request(request);
+                if (reply.value("status", "") != "success") {
+                    LOG_ERROR(m_logger, "Query {} failed: {}", pattern, reply.value("message", ""));
+                    throw std::runtime_error("Failed to query topics");
+                }
+                for (json& topic : reply["topics"]) {
+                    topics.push_back(std::move(topic));
+                }
+                if (!reply.contains("next")) {
+                    return topics;
+                }
+                after = reply["next"].get<string>();
+            }
+        }
+
+        /**
+         * @brief Subscribes to every topic currently matching a glob pattern (see
+         * query_topics()), with one round trip per thousand topics.
+         *
+         * @return topic and subscriber socket of each match, sorted by topic
+         * @throws std::runtime_error if a query fails
+         */
+        vector<pair<string, unique_ptr<zmq::socket_t>>> setup_matching_subscribers(const string& pattern) {
+            vector<pair<string, unique_ptr<zmq::socket_t>>> subscribers;
+            for (const json& reply : query_topics(pattern)) {
+                string topic = reply["topic"];
+                subscribers.emplace_back(topic, connect_subscriber(topic, reply));
+            }
+            LOG_INFO(m_logger, "Subscribed to {} topics matching {}", subscribers.size(), pattern);
+            return subscribers;
+        }
+
+        /**
+         * Where a subscriber of a topic connects to, and what it subscribes to, according to
+         * the topic's CNS lookup reply.
+         */
+        SubscriberTarget subscriber_target(const string& topic, const json& reply_json) {
+            // Publishers on this host may offer frames through shared memory, in which case
+            // only slot descriptors travel over the socket
+            SubscriberTarget target;
+            target.filter = topic;
+            if (reply_json.contains("shm") && reply_json.value("host", "") == m_hostname) {
+                if (attach_shm_segment(reply_json["shm"])) {
+                    target.filter = SHM_TOPIC_PREFIX + topic;
+                }
+            }
+
+            // Connect to the topic over the cheapest transport the publisher offers
+            target.endpoint = select_endpoint(reply_json);
+            return target;
+        }
+
+        /**
+         * Connects a subscriber socket to a topic using its CNS lookup reply.
+         */
+        unique_ptr<zmq::socket_t> connect_subscriber(const string& topic, const json& reply_json) {
+            SubscriberTarget target = subscriber_target(topic, reply_json);
             unique_ptr<zmq::socket_t> new_subscriber = make_unique<zmq::socket_t>(m_context, zmq::socket_type::sub);
             new_subscriber->set(zmq::sockopt::rcvhwm, 10);
-            new_subscriber->connect("tcp://" + ip + ":" + port);
-            new_subscriber->set(zmq::sockopt::subscribe, topic.c_str());
-            LOG_INFO(m_logger, "Connected to topic: {} at {}:{}", topic, ip, port);
+            new_subscriber->connect(target.endpoint);
+            new_subscriber->set(zmq::sockopt::subscribe, target.filter);
+            LOG_INFO(m_logger, "Connected to topic: {} at {}{}", topic, target.endpoint,
+                     target.filter == topic ? "" : " (frames in shared memory)");
             return new_subscriber;
         }
 
-        unique_ptr<zmq::socket_t> setup_publisher(vector<string> topics) {
-            unique_ptr<zmq::socket_t> socket_ = make_unique<zmq::socket_t>(m_context, zmq::socket_type::pub);
+        /**
+         * Identifies this node's zmq context. inproc endpoints are only reachable from
+         * sockets created in the same context, so subscribers compare this (and the pid)
+         * before choosing one.
+         */
+        string context_token() {
+            return to_string(reinterpret_cast<uintptr_t>(m_context.handle()));
+        }
+
+        /**
+         * @brief Picks the cheapest endpoint from a CNS lookup reply.
+         *
+         * inproc if the publisher lives in this process and zmq context, ipc if it is on
+         * this host, and tcp otherwise. Replies from publishers that only registered
+         * ip and port always resolve to tcp.
+         */
+        string select_endpoint(const json& reply_json) {
+            string tcp_endpoint = "tcp://" + reply_json["ip"].get<string>() + ":" + to_string(reply_json["port"].get<int>());
+            if (!reply_json.contains("endpoints")) {
+                return tcp_endpoint;
+            }
+
+            bool same_host = reply_json.value("host", "") == m_hostname;
+            bool same_context = same_host && reply_json.value("pid", -1) == getpid() &&
+                                reply_json.value("context", "") == context_token();
+            string ipc_endpoint;
+            for (const auto& endpoint : reply_json["endpoints"]) {
+                const string& e = endpoint.get_ref<const string&>();
+                if (same_context && e.rfind("inproc://", 0) == 0) {
+                    return e;
+                }
+                if (same_host && e.rfind("ipc://", 0) == 0) {
+                    ipc_endpoint = e;
+                }
+            }
+            return ipc_endpoint.empty() ? tcp_endpoint : ipc_endpoint;
+        }
+
+        /**
+         * @brief Creates a publisher socket and registers its topics with the CNS.
+         *
+         * The socket is bound to a random tcp port, to an ipc endpoint under IPC_DIRECTORY
+         * and, if enable_inproc_transport() was called, to an inproc endpoint. All of them are
+         * registered so that each subscriber can pick the cheapest one (see select_endpoint()).
+         *
+         * @param topics The topics that will be published on this socket.
+         * @param type zmq::socket_type::pub, or xpub to also receive subscription messages
+         *             (see SubscriptionTracker).
+         * @return The bound publisher socket.
+         */
+        unique_ptr<zmq::socket_t> setup_publisher(vector<string> topics, zmq::socket_type type = zmq::socket_type::pub) {
+            unique_ptr<zmq::socket_t> socket_ = make_unique<zmq::socket_t>(m_context, type);
             
             // Bind to a random port
             socket_->bind("tcp://*:0"); 
@@ -285,9 +1766,33 @@ class GenericNode {
                 LOG_ERROR(m_logger, "Could not retrieve port number from socket bound to {} - topics may not register properly", endpoint_str);
             }
 
-            for(string topic : topics) {
-                register_service(topic, port);
+            // Same host and same process transports. These are best effort; tcp always works.
+            vector<string> endpoints = {"tcp://" + m_ip_address + ":" + to_string(port)};
+            string suffix = m_node_id + "_" + to_string(getpid()) + "_" + to_string(m_publisher_count++);
+            std::replace(suffix.begin(), suffix.end(), '/', '_');
+
+            mkdir(IPC_DIRECTORY, 0777);
+            string ipc_endpoint = string("ipc://") + IPC_DIRECTORY + "/" + suffix;
+            try {
+                socket_->bind(ipc_endpoint);
+                endpoints.push_back(ipc_endpoint);
+                LOG_INFO(m_logger, "Socket bound to {}", ipc_endpoint);
+            } catch (const zmq::error_t& e) {
+                LOG_WARNING(m_logger, "Could not bind {}: {}", ipc_endpoint, e.what());
+            }
+
+            if (m_enable_inproc) {
+                string inproc_endpoint = "inproc://" + suffix;
+                socket_->bind(inproc_endpoint);
+                endpoints.push_back(inproc_endpoint);
+                LOG_INFO(m_logger, "Socket bound to {}", inproc_endpoint);
+            }
+
+            vector<pair<string, int>> services;
+            for (const string& topic : topics) {
+                services.emplace_back(topic, port);
             }
+            register_services(services, endpoints);
 
             return socket_;
         }
@@ -332,14 +1837,21 @@ class GenericNode {
             this->m_alignment_log_name = "AlignedDataMatrix_" + node_id;
             this->m_ip_address = ip_address;
             this->m_topic = "/" + m_node_type + "/" + m_node_id;
+
+            char hostname[256] = {};
+            gethostname(hostname, sizeof(hostname) - 1);
+            this->m_hostname = hostname;
             
             this->init_logger(&m_logger, m_log_name);
             LOG_INFO(m_logger, "Initializing {} node with ID {}", m_node_type, m_node_id);
             LOG_INFO(m_logger, "My IP: {}, CNS IP: {}", m_ip_address, m_cns_ip);
 
-            // Set up our cns socket
-            this->setup_cns_socket();
-            LOG_INFO(m_logger, "CNS socket setup complete");
+            // Set up our cns client
+            this->m_cns_client = make_unique<CnsClient>(m_context, "tcp://" + cns_endpoint(0), m_cns_encoding);
+            LOG_INFO(m_logger, "CNS client setup complete");
+
+            // Follow registry changes so lookups can be answered locally
+            this->m_threads.push_back(std::thread(&GenericNode::cns_event_loop, this));
 
             // Start heartbeat thread immediately
             this->m_threads.push_back(std::thread(&GenericNode::publish_heartbeat, this));
@@ -355,23 +1867,36 @@ class GenericNode {
         }
         
         ~GenericNode() {
-            m_atomic_stop.store(true);
+            shutdown();
+        }
 
-            // TODO: MOVE THIS SOMEWHERE ELSE OR MAYBE JUST NEVER UNREGISTER ON SHUTDOWN
-            //       Can't call this because of current shutdown procedure design-- before the destructor is called,
-            //       the context is shutdown so you can't send zmq messages which results in zmq errors in unregister_all_services()
-            // this->unregister_all_services();
+        /**
+         * Stops the node's threads, releases its registrations and closes the zmq context,
+         * which waits until every message still queued has been sent or dropped. A child
+         * whose outgoing messages borrow memory from its own members (zero copy frames)
+         * calls this from its destructor, after closing its sockets, so zmq is done with
+         * them before those members go away. Only the first call does anything.
+         */
+        void shutdown() {
+            if (m_shut_down.exchange(true)) {
+                return;
+            }
+            m_atomic_stop.store(true);
 
-            // Close sockets
-            m_cns_socket.close();
+            // Best effort: if the CNS does not answer in time, the leases run out instead
+            release_registrations(std::chrono::milliseconds(SHUTDOWN_UNREGISTER_MS));
 
-            // Join all threads created by generic node and child
+            // Join all threads created by generic node and child, which may still be using
+            // the CNS client
             for (auto& t : m_threads) {
                 if (t.joinable()) {
                     t.join();
                 }
             }
 
+            // Close sockets
+            m_cns_client.reset();
+
             // Close context
             m_context.close();
 
@@ -407,26 +1932,92 @@ class GenericNode {
         };
 
         /**
-         * @brief Publishes a heartbeat message to `/{type}/{id}/heartbeat`.
-         * 
-         * This function is an infinite loop that publishes a heartbeat message to the CNS
-         * at regular intervals. The heartbeat message contains the node type, node ID, and
-         * current state of the node.
+         * @brief Pushes a heartbeat to the CNS every HEARTBEAT_INTERVAL_MS.
+         *
+         * Heartbeats go one way over their own PUSH socket, so they never wait on the CNS and
+         * never hold the lock that registrations and lookups share. If the CNS is unreachable
+         * the heartbeat is dropped rather than queued; a late heartbeat is worth nothing.
          */
         void publish_heartbeat() {
+            zmq::socket_t socket(m_context, zmq::socket_type::push);
+            socket.set(zmq::sockopt::linger, 0);
+            socket.set(zmq::sockopt::sndhwm, 1);
+            socket.set(zmq::sockopt::immediate, 1);
+            uint64_t generation = m_cns_generation.load();
+            string endpoint = "tcp://" + cns_endpoint(CNS_HEARTBEAT_PORT_OFFSET);
+            socket.connect(endpoint);
+
             while (!m_atomic_stop.load(std::memory_order_relaxed)) {
+                if (generation != m_cns_generation.load()) {
+                    socket.disconnect(endpoint);
+                    generation = m_cns_generation.load();
+                    endpoint = "tcp://" + cns_endpoint(CNS_HEARTBEAT_PORT_OFFSET);
+                    socket.connect(endpoint);
+                }
                 json heartbeat_msg = {
                     {"self", m_topic},
                     {"action", "heartbeat"},
                     {"timestamp", std::chrono::system_clock::now().time_since_epoch().count()}
                 };
-                
-                zmq::message_t reply; //this gets thrown away cause we don't really care if the central server responds
-                send_req_cns(reply, heartbeat_msg.dump());
+                try {
+                    string body = encode_cns_message(heartbeat_msg, m_cns_encoding);
+                    socket.send(zmq::buffer(body), zmq::send_flags::dontwait);
+                } catch (const zmq::error_t& err) {
+                    if (err.num() == ETERM) {
+                        break;
+                    }
+                    LOG_ERROR(m_logger, "Failed to send heartbeat: {}", err.what());
+                }
                 std::this_thread::sleep_for(std::chrono::milliseconds(HEARTBEAT_INTERVAL_MS));
             }
         }
 
+        /**
+         * Also bind publishers to inproc endpoints. Only useful when subscribers are
+         * created in this node's zmq context.
+         */
+        void enable_inproc_transport(bool enable) {
+            this->m_enable_inproc = enable;
+        }
+
+        /**
+         * Encoding used for requests to the CNS. JSON unless set; the binary encodings are
+         * cheaper to build and parse on both ends.
+         */
+        void set_cns_encoding(CnsEncoding encoding) {
+            this->m_cns_encoding = encoding;
+            this->m_cns_client->set_encoding(encoding);
+        }
+
+        /**
+         * CNS to fail over to when the current one stops answering. Only needed if the
+         * primary does not advertise its standby, e.g. before its first sync event arrives.
+         */
+        void set_cns_standby(const string& ip, int port) {
+            lock_guard<mutex> lock(m_cns_endpoint_mtx);
+            this->m_cns_standby_ip = ip;
+            this->m_cns_standby_port = port;
+        }
+
+        /**
+         * Where get_blob() caches blob chunks, BLOB_CACHE_DIRECTORY by default; empty to not
+         * cache them. Set it before reading blobs.
+         */
+        void set_blob_cache_directory(const string& directory) {
+            this->m_blob_cache_directory = directory;
+        }
+
+        /**
+         * Answer repeated topic lookups from a cache kept current by CNS events. On by default.
+         */
+        void enable_lookup_cache(bool enable) {
+            lock_guard<mutex> lock(m_lookup_cache_mtx);
+            this->m_enable_lookup_cache = enable;
+            if (!enable) {
+                m_lookup_cache.clear();
+            }
+        }
+
         void set_debug(bool debug) { 
             this->debug = debug;
             this->init_logger(&m_logger, m_log_name);
@@ -443,24 +2034,7 @@ class GenericNode {
          * @return true if the topic is found and the endpoint is populated, false otherwise.
          */
         bool get_topic_endpoint(const string& topic, string &endpoint) {
-            json request = {
-                {"action", "lookup"},
-                {"topic", topic}
-            };
-            
-            string request_str = request.dump();
-            zmq::message_t reply;
-            auto result = send_req_cns(reply, request_str);
-            if (!result.has_value()) {
-                LOG_ERROR(m_logger, "Timeout waiting for CNS reply after 5000 ms");
-                throw std::runtime_error("CNS lookup request timed out");
-            }
-
-            string reply_str(static_cast<char*>(reply.data()), reply.size());
-            LOG_DEBUG(m_logger, "Received reply: {}", reply_str); 
-
-            // parse the reply
-            json reply_json = json::parse(reply_str);
+            json reply_json = lookup_topic(topic);
             if (reply_json["status"] != "success") {
                 LOG_ERROR(m_logger, "Query failed: {}", to_string(reply_json["error"]));
                 throw std::runtime_error("Failed to lookup topic");
@@ -476,7 +2050,111 @@ class GenericNode {
             return true;
         }
 
-        
+        /**
+         * @brief Publishes a metrics snapshot to `/{type}/{id}/metrics`.
+         *
+         * Sent as a two part message (topic, json). The metrics topic has to be included in
+         * the topics passed to setup_publisher() for subscribers to find it.
+         *
+         * @param socket The publisher socket to send on, must be owned by the calling thread.
+         * @param metrics The metrics to publish.
+         */
+        void publish_metrics(zmq::socket_t& socket, const json& metrics) {
+            string topic = m_topic + "/metrics";
+            string payload = metrics.dump();
+            socket.send(zmq::buffer(topic), zmq::send_flags::sndmore);
+            socket.send(zmq::buffer(payload), zmq::send_flags::none);
+        }
+
+        /**
+         * @brief Receives one image frame (topic, metadata, image) from a subscriber socket.
+         *
+         * The metadata frame may be either a binary FrameHeader or the legacy JSON form;
+         * both are decoded into the same FrameHeader so callers never have to care. Frames
+         * published through shared memory are resolved to a pointer into the mapped slot and
+         * reported under their original topic.
+         *
+         * @param sub_socket The subscriber socket to read from.
+         * @param frame Filled with the topic, decoded metadata and image data.
+         * @return true if a complete frame was received and its metadata decoded, false otherwise.
+         */
+        bool recv_frame(zmq::socket_t& sub_socket, ReceivedFrame& frame) {
+            zmq::message_t topic_msg;
+            if (!sub_socket.recv(topic_msg, zmq::recv_flags::none)) {
+                LOG_ERROR(m_logger, "Failed to receive topic");
+                return false;
+            }
+            frame.topic.assign(static_cast<char*>(topic_msg.data()), topic_msg.size());
+
+            zmq::message_t metadata_msg;
+            if (!sub_socket.recv(metadata_msg, zmq::recv_flags::none)) {
+                LOG_ERROR(m_logger, "Failed to receive metadata");
+                return false;
+            }
+
+            if (!sub_socket.recv(frame.payload, zmq::recv_flags::none)) {
+                LOG_ERROR(m_logger, "Failed to receive image");
+                return false;
+            }
+
+            if (!decode_frame_metadata(metadata_msg.data(), metadata_msg.size(), frame.header)) {
+                LOG_ERROR(m_logger, "Failed to decode metadata for topic {}", frame.topic);
+                return false;
+            }
+
+            frame.shm = nullptr;
+            if (!(frame.header.flags & FRAME_FLAG_SHM)) {
+                frame.data = frame.payload.data();
+                frame.size = frame.payload.size();
+                return true;
+            }
+
+            if (frame.payload.size() != sizeof(ShmSlotDescriptor)) {
+                LOG_ERROR(m_logger, "Bad shared memory descriptor for topic {}", frame.topic);
+                return false;
+            }
+            memcpy(&frame.shm_desc, frame.payload.data(), sizeof(ShmSlotDescriptor));
+            frame.topic.erase(0, sizeof(SHM_TOPIC_PREFIX) - 1);
+
+            string_view segment(frame.shm_desc.segment, strnlen(frame.shm_desc.segment, SHM_SEGMENT_NAME_LEN));
+            const ShmRingReader* reader = nullptr;
+            {
+                lock_guard<mutex> lock(m_shm_mtx);
+                auto it = m_shm_readers.find(segment);
+                if (it != m_shm_readers.end()) {
+                    reader = it->second.get();
+                }
+            }
+            if (reader == nullptr) {
+                LOG_ERROR(m_logger, "Frame for topic {} refers to unmapped segment {}", frame.topic, segment);
+                return false;
+            }
+
+            frame.data = reader->data(frame.shm_desc);
+            frame.size = frame.shm_desc.size;
+            frame.shm = reader;
+            if (frame.data == nullptr) {
+                LOG_WARNING(m_logger, "Shared memory frame {} on {} was overwritten before it was read", frame.header.sequence, frame.topic);
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * recv_frame() from a managed subscription. Counts the frame for the subscription's
+         * gap measurement, and moves the socket if its publisher moved.
+         */
+        bool recv_frame(Subscription& subscription, ReceivedFrame& frame) {
+            bool received = recv_frame(subscription.socket(), frame);
+            if (received) {
+                subscription.note_message();
+            }
+            // Only after receiving: a reconnect drops whatever the socket had queued, which
+            // may be the message the caller was told about
+            subscription.refresh();
+            return received;
+        }
+
         /**
          * Drop frames until they start arriving slower than 3ms apart.
          */
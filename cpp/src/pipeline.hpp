@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/**
+ * @brief Bounded lock-free queue used to hand frames from one pipeline stage to the next.
+ *
+ * Each stage pair has exactly one producer and one consumer thread. When the consumer falls
+ * behind the producer drops the oldest queued item instead of blocking, so a slow stage never
+ * stalls the stages upstream of it (in particular the device read). Because dropping means
+ * the producer also pops, slots carry their own sequence number (Vyukov's bounded queue)
+ * rather than relying on a plain head/tail pair.
+ *
+ * @tparam T element type, must be default constructible and movable
+ */
+template <typename T>
+class HandoffQueue {
+    public:
+        explicit HandoffQueue(size_t capacity) : m_mask(round_up_pow2(capacity) - 1), m_slots(m_mask + 1) {
+            for (size_t i = 0; i <= m_mask; i++) {
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        HandoffQueue(const HandoffQueue&) = delete;
+        HandoffQueue& operator=(const HandoffQueue&) = delete;
+
+        /**
+         * @return false if the queue is full
+         */
+        bool try_push(T&& item) {
+            size_t pos = m_tail.load(std::memory_order_relaxed);
+            while (true) {
+                Slot& slot = m_slots[pos & m_mask];
+                size_t seq = slot.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (diff == 0) {
+                    if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        slot.value = std::move(item);
+                        slot.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+         * @return false if the queue is empty
+         */
+        bool try_pop(T& item) {
+            size_t pos = m_head.load(std::memory_order_relaxed);
+            while (true) {
+                Slot& slot = m_slots[pos & m_mask];
+                size_t seq = slot.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0) {
+                    if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        item = std::move(slot.value);
+                        slot.sequence.store(pos + m_mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = m_head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+         * Pushes an item, discarding the oldest queued items until it fits.
+         *
+         * @return the number of items dropped
+         */
+        size_t push_drop_oldest(T&& item) {
+            size_t dropped = 0;
+            while (!try_push(std::move(item))) {
+                T discarded;
+                if (try_pop(discarded)) {
+                    dropped++;
+                }
+            }
+            return dropped;
+        }
+
+        /**
+         * Pops an item, waiting up to timeout for one to arrive. Backs off from spinning to
+         * short sleeps so an idle stage does not burn a core.
+         *
+         * @return false if the timeout expired with the queue still empty
+         */
+        bool pop_wait(T& item, std::chrono::microseconds timeout) {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            for (int spins = 0; !try_pop(item); spins++) {
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    return false;
+                }
+                if (spins < 64) {
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+            return true;
+        }
+
+        size_t capacity() const { return m_mask + 1; }
+
+    private:
+        struct Slot {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        static size_t round_up_pow2(size_t n) {
+            size_t p = 2;
+            while (p < n) p <<= 1;
+            return p;
+        }
+
+        const size_t m_mask;
+        std::vector<Slot> m_slots;
+        alignas(64) std::atomic<size_t> m_head{0};
+        alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+/**
+ * @brief Timing counters for one pipeline stage.
+ *
+ * Updated by the stage's own thread and read from anywhere (metrics, logging). Totals
+ * are cumulative; window values are reset every time snapshot() is called.
+ */
+struct StageStats {
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> busy_ns{0};
+    std::atomic<uint64_t> window_frames{0};
+    std::atomic<uint64_t> window_busy_ns{0};
+    std::atomic<uint64_t> window_max_ns{0};
+    std::atomic<uint64_t> window_allocations{0};
+
+    /**
+     * @param busy time spent on one frame
+     * @param allocations heap allocations made while handling it (see alloc_counter.hpp)
+     */
+    void record(std::chrono::steady_clock::duration busy, uint64_t allocations = 0) {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count();
+        frames.fetch_add(1, std::memory_order_relaxed);
+        busy_ns.fetch_add(ns, std::memory_order_relaxed);
+        window_frames.fetch_add(1, std::memory_order_relaxed);
+        window_busy_ns.fetch_add(ns, std::memory_order_relaxed);
+        window_allocations.fetch_add(allocations, std::memory_order_relaxed);
+        uint64_t max = window_max_ns.load(std::memory_order_relaxed);
+        while (ns > max && !window_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+    }
+
+    void record_dropped(size_t count) {
+        dropped.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the counters as json and starts a new window.
+     */
+    nlohmann::json snapshot() {
+        uint64_t n = window_frames.exchange(0, std::memory_order_relaxed);
+        uint64_t busy = window_busy_ns.exchange(0, std::memory_order_relaxed);
+        uint64_t max = window_max_ns.exchange(0, std::memory_order_relaxed);
+        uint64_t allocations = window_allocations.exchange(0, std::memory_order_relaxed);
+        return {
+            {"frames", frames.load(std::memory_order_relaxed)},
+            {"dropped", dropped.load(std::memory_order_relaxed)},
+            {"window_frames", n},
+            {"avg_ms", n > 0 ? busy / 1e6 / n : 0.0},
+            {"max_ms", max / 1e6},
+            {"window_allocations", allocations}
+        };
+    }
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr uint32_t SHM_RING_MAGIC = 0x474e5243;  // "CRNG"
+constexpr uint32_t SHM_RING_VERSION = 1;
+constexpr size_t SHM_SEGMENT_NAME_LEN = 48;
+
+/**
+ * @brief Sent over zmq in place of the image payload when a frame lives in shared memory.
+ *
+ * The subscriber maps `segment` once and reads the slot in place. `sequence` is the value
+ * of the slot's seqlock when the frame was committed, so a reader can tell whether the
+ * writer has since lapped the ring and overwritten the slot.
+ */
+#pragma pack(push, 1)
+struct ShmSlotDescriptor {
+    char segment[SHM_SEGMENT_NAME_LEN] = {};
+    uint32_t slot = 0;
+    uint32_t reserved = 0;
+    uint64_t sequence = 0;
+    uint64_t size = 0;
+};
+#pragma pack(pop)
+
+/**
+ * @brief Layout at the start of every ring segment. Followed by `slot_count` ShmSlotState
+ * entries and then `slot_count * slot_size` bytes of frame data.
+ */
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t slot_count;
+    uint64_t slot_size;
+    std::atomic<uint64_t> write_index;
+};
+
+struct ShmSlotState {
+    std::atomic<uint64_t> sequence;   // odd while the writer is inside the slot
+    uint64_t size;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory ring needs address-free atomics");
+
+inline size_t shm_ring_data_offset(uint64_t slot_count) {
+    size_t offset = sizeof(ShmRingHeader) + slot_count * sizeof(ShmSlotState);
+    return (offset + 63) & ~size_t(63);  // cache line align the frame data
+}
+
+/**
+ * @brief Single writer side of a shared memory frame ring.
+ *
+ * Creates (and on destruction unlinks) a POSIX shared memory segment holding a fixed
+ * number of fixed size slots. Frames are written round robin; each slot is protected by a
+ * seqlock so readers never block the writer. The segment is only accessible to the user
+ * running the producer.
+ */
+class ShmRingWriter {
+    public:
+        ShmRingWriter(const std::string& name, uint64_t slot_count, uint64_t slot_size)
+            : m_name(name) {
+            if (name.size() >= SHM_SEGMENT_NAME_LEN) {
+                throw std::runtime_error("Shared memory segment name too long: " + name);
+            }
+
+            m_size = shm_ring_data_offset(slot_count) + slot_count * slot_size;
+            shm_unlink(name.c_str());  // remove a stale segment left by a crashed process
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0) {
+                throw std::runtime_error("Failed to create shared memory segment " + name);
+            }
+            if (ftruncate(fd, m_size) != 0) {
+                close(fd);
+                shm_unlink(name.c_str());
+                throw std::runtime_error("Failed to size shared memory segment " + name);
+            }
+            void* base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (base == MAP_FAILED) {
+                shm_unlink(name.c_str());
+                throw std::runtime_error("Failed to map shared memory segment " + name);
+            }
+
+            m_base = static_cast<uint8_t*>(base);
+            m_header = new (m_base) ShmRingHeader{SHM_RING_MAGIC, SHM_RING_VERSION, slot_count, slot_size, {0}};
+            m_slots = reinterpret_cast<ShmSlotState*>(m_base + sizeof(ShmRingHeader));
+            for (uint64_t i = 0; i < slot_count; i++) {
+                new (&m_slots[i]) ShmSlotState{{0}, 0};
+            }
+            m_data = m_base + shm_ring_data_offset(slot_count);
+        }
+
+        ~ShmRingWriter() {
+            munmap(m_base, m_size);
+            shm_unlink(m_name.c_str());
+        }
+
+        ShmRingWriter(const ShmRingWriter&) = delete;
+        ShmRingWriter& operator=(const ShmRingWriter&) = delete;
+
+        const std::string& name() const { return m_name; }
+        uint64_t slot_size() const { return m_header->slot_size; }
+
+        /**
+         * Claims the next slot for writing and returns a pointer to its data. The slot is
+         * marked busy until commit() is called, so the caller can render straight into it.
+         *
+         * @return pointer to slot_size() writable bytes, or nullptr if size does not fit
+         */
+        void* begin_write(size_t size, uint32_t& slot) {
+            if (size > m_header->slot_size) {
+                return nullptr;
+            }
+            slot = m_header->write_index.fetch_add(1, std::memory_order_relaxed) % m_header->slot_count;
+            ShmSlotState& state = m_slots[slot];
+            state.sequence.store(state.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return m_data + slot * m_header->slot_size;
+        }
+
+        /**
+         * Publishes a slot claimed with begin_write() and fills in its descriptor.
+         */
+        void commit(uint32_t slot, size_t size, ShmSlotDescriptor& desc) {
+            ShmSlotState& state = m_slots[slot];
+            state.size = size;
+            uint64_t sequence = state.sequence.load(std::memory_order_relaxed) + 1;
+            state.sequence.store(sequence, std::memory_order_release);
+
+            std::memcpy(desc.segment, m_name.c_str(), m_name.size() + 1);
+            desc.slot = slot;
+            desc.sequence = sequence;
+            desc.size = size;
+        }
+
+        /**
+         * Copies a frame into the next slot.
+         *
+         * @return false if the frame is larger than a slot
+         */
+        bool write(const void* data, size_t size, ShmSlotDescriptor& desc) {
+            uint32_t slot;
+            void* dst = begin_write(size, slot);
+            if (dst == nullptr) {
+                return false;
+            }
+            std::memcpy(dst, data, size);
+            commit(slot, size, desc);
+            return true;
+        }
+
+    private:
+        std::string m_name;
+        size_t m_size = 0;
+        uint8_t* m_base = nullptr;
+        ShmRingHeader* m_header = nullptr;
+        ShmSlotState* m_slots = nullptr;
+        uint8_t* m_data = nullptr;
+};
+
+/**
+ * @brief Read only view of a ring created by a ShmRingWriter in another process.
+ */
+class ShmRingReader {
+    public:
+        explicit ShmRingReader(const std::string& name) : m_name(name) {
+            int fd = shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd < 0) {
+                throw std::runtime_error("Failed to open shared memory segment " + name);
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmRingHeader)) {
+                close(fd);
+                throw std::runtime_error("Invalid shared memory segment " + name);
+            }
+            m_size = st.st_size;
+            void* base = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (base == MAP_FAILED) {
+                throw std::runtime_error("Failed to map shared memory segment " + name);
+            }
+
+            m_base = static_cast<const uint8_t*>(base);
+            m_header = reinterpret_cast<const ShmRingHeader*>(m_base);
+            if (m_header->magic != SHM_RING_MAGIC || m_header->version != SHM_RING_VERSION ||
+                shm_ring_data_offset(m_header->slot_count) + m_header->slot_count * m_header->slot_size > m_size) {
+                munmap(const_cast<uint8_t*>(m_base), m_size);
+                throw std::runtime_error("Unsupported shared memory segment layout in " + name);
+            }
+            m_slots = reinterpret_cast<const ShmSlotState*>(m_base + sizeof(ShmRingHeader));
+            m_data = m_base + shm_ring_data_offset(m_header->slot_count);
+        }
+
+        ~ShmRingReader() {
+            munmap(const_cast<uint8_t*>(m_base), m_size);
+        }
+
+        ShmRingReader(const ShmRingReader&) = delete;
+        ShmRingReader& operator=(const ShmRingReader&) = delete;
+
+        const std::string& name() const { return m_name; }
+
+        /**
+         * Returns a pointer to the frame described by desc, or nullptr if the slot has
+         * already been overwritten. The data must be re-checked with is_valid() after use.
+         */
+        const void* data(const ShmSlotDescriptor& desc) const {
+            if (desc.slot >= m_header->slot_count || desc.size > m_header->slot_size || !is_valid(desc)) {
+                return nullptr;
+            }
+            return m_data + desc.slot * m_header->slot_size;
+        }
+
+        /**
+         * True while the slot still holds the frame described by desc.
+         */
+        bool is_valid(const ShmSlotDescriptor& desc) const {
+            if (desc.slot >= m_header->slot_count) {
+                return false;
+            }
+            return m_slots[desc.slot].sequence.load(std::memory_order_acquire) == desc.sequence;
+        }
+
+    private:
+        std::string m_name;
+        size_t m_size = 0;
+        const uint8_t* m_base = nullptr;
+        const ShmRingHeader* m_header = nullptr;
+        const ShmSlotState* m_slots = nullptr;
+        const uint8_t* m_data = nullptr;
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <zmq.hpp>
+
+#include "quill/LogMacros.h"
+#include "quill/Logger.h"
+
+/**
+ * @brief Where a subscriber socket should be connected: the publisher endpoint and the
+ * subscription filter (the topic, or the shared memory descriptor topic).
+ */
+struct SubscriberTarget {
+    std::string endpoint;
+    std::string filter;
+
+    bool operator==(const SubscriberTarget& other) const {
+        return endpoint == other.endpoint && filter == other.filter;
+    }
+    bool operator!=(const SubscriberTarget& other) const { return !(*this == other); }
+};
+
+/**
+ * @brief A subscriber socket that GenericNode keeps pointed at its topic's publisher.
+ *
+ * Publishers bind random ports, so a restarted publisher comes back somewhere else. The
+ * node's CNS event thread sees the topic's new registration (a "moved" or "register"
+ * event) and hands the new target to every subscription of the topic with retarget().
+ * zmq sockets belong to one thread, so the socket itself is only reconnected in refresh(),
+ * on the thread that reads it: the socket object, and anything polling it, stays the same.
+ *
+ * Each subscription also measures the gap a restart causes: the time from the last message
+ * of the old publisher to the first message of the new one.
+ */
+class Subscription {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        Subscription(std::string topic, std::unique_ptr<zmq::socket_t> socket, SubscriberTarget target, quill::Logger* logger)
+            : m_topic(std::move(topic)), m_socket(std::move(socket)), m_target(std::move(target)), m_logger(logger) {
+            m_socket->connect(m_target.endpoint);
+            m_socket->set(zmq::sockopt::subscribe, m_target.filter);
+        }
+
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+
+        const std::string& topic() const { return m_topic; }
+
+        /**
+         * The subscriber socket, to poll and receive from. It stays the same object across
+         * reconnects.
+         */
+        zmq::socket_t& socket() { return *m_socket; }
+
+        const SubscriberTarget& target() const { return m_target; }
+
+        /**
+         * Moves the socket to the publisher's new endpoint if it changed. Call this from the
+         * thread that reads the socket, e.g. once per poll loop iteration; cheap when nothing
+         * changed. Messages still queued from the old publisher are dropped.
+         *
+         * @return true if the socket was reconnected
+         */
+        bool refresh() {
+            if (!m_dirty.load(std::memory_order_acquire)) {
+                return false;
+            }
+            SubscriberTarget next;
+            Clock::time_point changed_at;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_dirty.store(false, std::memory_order_relaxed);
+                next = m_next;
+                changed_at = m_changed_at;
+            }
+            if (next == m_target) {
+                return false;
+            }
+
+            // A disconnect from an endpoint that is already gone is fine to fail
+            try {
+                m_socket->disconnect(m_target.endpoint);
+            } catch (const zmq::error_t&) {
+            }
+            if (next.filter != m_target.filter) {
+                m_socket->set(zmq::sockopt::unsubscribe, m_target.filter);
+                m_socket->set(zmq::sockopt::subscribe, next.filter);
+            }
+            m_socket->connect(next.endpoint);
+            LOG_INFO(m_logger, "Topic {} moved from {} to {}, reconnected {:.1f} ms after the CNS reported it", m_topic,
+                     m_target.endpoint, next.endpoint, ms_between(changed_at, Clock::now()));
+            m_target = std::move(next);
+            m_reconnects++;
+            m_awaiting_first = true;
+            return true;
+        }
+
+        /**
+         * Records that a message arrived, for the gap measurement. Called by
+         * GenericNode::recv_frame() for every frame.
+         */
+        void note_message() {
+            auto now = Clock::now();
+            if (m_awaiting_first) {
+                m_awaiting_first = false;
+                if (m_received > 0) {
+                    m_last_gap_ms = ms_between(m_last_message, now);
+                    m_max_gap_ms = std::max(m_max_gap_ms, m_last_gap_ms);
+                    LOG_INFO(m_logger, "Topic {} resumed after a {:.1f} ms gap", m_topic, m_last_gap_ms);
+                }
+            }
+            m_last_message = now;
+            m_received++;
+        }
+
+        uint64_t reconnects() const { return m_reconnects; }
+        uint64_t received() const { return m_received; }
+
+        /**
+         * Gap of the last reconnect: last message from the old publisher to the first from
+         * the new one. -1 until a reconnect was followed by a message.
+         */
+        double last_gap_ms() const { return m_last_gap_ms; }
+        double max_gap_ms() const { return m_max_gap_ms; }
+
+    private:
+        friend class GenericNode;
+
+        /**
+         * Hands the subscription a new target. Safe from any thread; the socket moves at the
+         * next refresh().
+         */
+        void retarget(SubscriberTarget target) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (target == m_next) {
+                return;
+            }
+            m_next = std::move(target);
+            m_changed_at = Clock::now();
+            m_dirty.store(true, std::memory_order_release);
+        }
+
+        static double ms_between(Clock::time_point from, Clock::time_point to) {
+            return std::chrono::duration<double, std::milli>(to - from).count();
+        }
+
+        std::string m_topic;
+        std::unique_ptr<zmq::socket_t> m_socket;
+        SubscriberTarget m_target;          // what the socket is connected to, reader thread only
+        quill::Logger* m_logger;
+
+        // Handed over by retarget(), guarded by m_mtx
+        std::mutex m_mtx;
+        SubscriberTarget m_next = m_target;
+        Clock::time_point m_changed_at;
+        std::atomic<bool> m_dirty{false};
+
+        // Gap measurement, reader thread only
+        Clock::time_point m_last_message;
+        uint64_t m_received = 0;
+        uint64_t m_reconnects = 0;
+        bool m_awaiting_first = false;
+        double m_last_gap_ms = -1;
+        double m_max_gap_ms = -1;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <string>
+#include <zmq.hpp>
+#include <nlohmann/json.hpp>
+
+#include "constants.hpp"
+
+/**
+ * @brief Tracks which published streams currently have at least one subscriber.
+ *
+ * Fed from an XPUB socket, which delivers a message of the form `\x01<prefix>` when the
+ * first subscriber asks for a prefix and `\x00<prefix>` when the last one leaves (including
+ * by disconnecting). A stream is active while any subscribed prefix matches its topic or
+ * its shared memory topic, so an empty prefix ("subscribe to everything") activates all of
+ * them. Whether the shared memory topic alone is subscribed is tracked separately, so the
+ * ring is only written while a reader is attached.
+ *
+ * poll() must be called from the thread that owns the socket; is_active() may be called
+ * from any thread.
+ */
+class SubscriptionTracker {
+    public:
+        /**
+         * Registers a topic to track. Must be called before the first poll().
+         *
+         * @return the stream index to pass to is_active()
+         */
+        size_t watch(const std::string& topic) {
+            m_streams.emplace_back(topic);
+            return m_streams.size() - 1;
+        }
+
+        /**
+         * Drains pending subscription messages from an XPUB socket without blocking.
+         *
+         * @return true if any stream changed state
+         */
+        bool poll(zmq::socket_t& xpub) {
+            bool changed = false;
+            zmq::message_t msg;
+            while (xpub.recv(msg, zmq::recv_flags::dontwait)) {
+                if (msg.size() == 0 || msg.data<uint8_t>()[0] > 1) {
+                    continue;  // not a subscription message
+                }
+                std::string prefix(msg.data<char>() + 1, msg.size() - 1);
+                if (msg.data<uint8_t>()[0] == 1) {
+                    m_prefixes[prefix]++;
+                } else {
+                    auto it = m_prefixes.find(prefix);
+                    if (it != m_prefixes.end() && --it->second == 0) {
+                        m_prefixes.erase(it);
+                    }
+                }
+                changed = true;
+            }
+
+            if (changed) {
+                changed = false;
+                for (Stream& stream : m_streams) {
+                    bool shm_active = matches(SHM_TOPIC_PREFIX + stream.topic);
+                    bool active = shm_active || matches(stream.topic);
+                    stream.shm_active.store(shm_active, std::memory_order_relaxed);
+                    if (stream.active.exchange(active, std::memory_order_relaxed) != active) {
+                        changed = true;
+                    }
+                }
+            }
+            return changed;
+        }
+
+        bool is_active(size_t stream) const {
+            return m_streams[stream].active.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @return true if a subscriber asked for the stream's shared memory topic
+         */
+        bool is_shm_active(size_t stream) const {
+            return m_streams[stream].shm_active.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Per stream state for node metrics, e.g. {"/camera/rgb": "inactive"}.
+         */
+        nlohmann::json snapshot() const {
+            nlohmann::json j = nlohmann::json::object();
+            for (const Stream& stream : m_streams) {
+                j[stream.topic] = stream.active.load(std::memory_order_relaxed) ? "active" : "inactive";
+            }
+            return j;
+        }
+
+    private:
+        struct Stream {
+            explicit Stream(const std::string& t) : topic(t) {}
+            std::string topic;
+            std::atomic<bool> active{false};
+            std::atomic<bool> shm_active{false};
+        };
+
+        bool matches(const std::string& topic) const {
+            for (const auto& [prefix, count] : m_prefixes) {
+                if (topic.compare(0, prefix.size(), prefix) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::deque<Stream> m_streams;           // deque so the atomics never move
+        std::map<std::string, int> m_prefixes;  // subscribed prefix -> subscribe count
+};